@@ -23,6 +23,22 @@ if [ ! -z "`which gmake`" ]; then
     MAKE=gmake;
 fi
 
+# SIMD code of libwebp selected at runtime by CPUID, and libpng's SSE2
+# filters, which the rest of libpng calls only if the target has SSE2.
+# (NEON is enabled by the compiler's target.)
+case `$CC -dumpmachine` in
+    x86_64*|amd64*|i?86*)
+        WEBP_CFLAGS="-DWEBP_HAVE_SSE2 -DWEBP_HAVE_SSE41";
+        SSE2_CFLAGS="-msse2";
+        SSE41_CFLAGS="-msse4.1";
+        ;;
+    *)
+        WEBP_CFLAGS="";
+        SSE2_CFLAGS="";
+        SSE41_CFLAGS="";
+        ;;
+esac
+
 rm -rf tmp $PREFIX
 mkdir -p tmp $PREFIX
 mkdir -p $PREFIX/include $PREFIX/lib
@@ -46,13 +62,7 @@ cd ..
 echo 'Building libwebp...'
 $TAR xzf ../../../external/archive/libwebp-1.3.2.tar.gz
 cd libwebp-1.3.2
-sed \
-    -e 's|#define WEBP_USE_NEON|#undef WEBP_USE_NEON|g' \
-    -e 's|#define WEBP_USE_SSE2|#undef WEBP_USE_SSE2|g' \
-    < src/dsp/cpu.h \
-    > src/dsp/cpu.h.new
-mv src/dsp/cpu.h.new src/dsp/cpu.h
-$MAKE -j`nproc` -f ../../../../external/mk/libwebp.mk CC="$CC" CFLAGS="$CFLAGS -w" AR="$AR" PREFIX="$PREFIX"
+$MAKE -j`nproc` -f ../../../../external/mk/libwebp.mk CC="$CC" CFLAGS="$CFLAGS -w $WEBP_CFLAGS" SSE2_CFLAGS="$SSE2_CFLAGS" SSE41_CFLAGS="$SSE41_CFLAGS" AR="$AR" PREFIX="$PREFIX"
 cp -R src/webp $PREFIX/include/
 cd ..
 
@@ -71,7 +81,7 @@ sed \
     -e 's|/\*#undef PNG_ARM_NEON_CHECK_SUPPORTED\*/|#undef PNG_ARM_NEON_CHECK_SUPPORTED|g' \
     < scripts/pnglibconf.h.prebuilt \
     > pnglibconf.h
-$MAKE -j`nproc` -f ../../../../external/mk/libpng.mk CC="$CC" CFLAGS="$CFLAGS -w" AR="$AR" PREFIX="$PREFIX"
+$MAKE -j`nproc` -f ../../../../external/mk/libpng.mk CC="$CC" CFLAGS="$CFLAGS -w" SSE2_CFLAGS="$SSE2_CFLAGS" AR="$AR" PREFIX="$PREFIX"
 mkdir $PREFIX/include/png
 cp *.h $PREFIX/include/png/
 cd ..
@@ -1,47 +1,62 @@
-all: pngget.o pngread.o pngrutil.o pngtrans.o pngwtran.o png.o pngmem.o pngrio.o pngset.o pngwio.o pngwutil.o pngerror.o pngpread.o pngrtran.o pngwrite.o
-	$(AR) rcs $(PREFIX)/lib/libpng.a pngget.o pngread.o pngrutil.o pngtrans.o pngwtran.o png.o pngmem.o pngrio.o pngset.o pngwio.o pngwutil.o pngerror.o pngpread.o pngrtran.o pngwrite.o
+all: pngget.o pngread.o pngrutil.o pngtrans.o pngwtran.o png.o pngmem.o pngrio.o pngset.o pngwio.o pngwutil.o pngerror.o pngpread.o pngrtran.o pngwrite.o arm_init.o filter_neon_intrinsics.o palette_neon_intrinsics.o intel_init.o filter_sse2_intrinsics.o
+	$(AR) rcs $(PREFIX)/lib/libpng.a pngget.o pngread.o pngrutil.o pngtrans.o pngwtran.o png.o pngmem.o pngrio.o pngset.o pngwio.o pngwutil.o pngerror.o pngpread.o pngrtran.o pngwrite.o arm_init.o filter_neon_intrinsics.o palette_neon_intrinsics.o intel_init.o filter_sse2_intrinsics.o
 
 pngget.o: pngget.c
-	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_ARM_NEON_OPT=0 -c $<
+	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_INTEL_SSE -c $<
 
 pngread.o: pngread.c
-	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_ARM_NEON_OPT=0 -c $<
+	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_INTEL_SSE -c $<
 
 pngrutil.o: pngrutil.c
-	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_ARM_NEON_OPT=0 -c $<
+	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_INTEL_SSE -c $<
 
 pngtrans.o: pngtrans.c
-	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_ARM_NEON_OPT=0 -c $<
+	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_INTEL_SSE -c $<
 
 pngwtran.o: pngwtran.c
-	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_ARM_NEON_OPT=0 -c $<
+	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_INTEL_SSE -c $<
 
 png.o: png.c
-	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_ARM_NEON_OPT=0 -c $<
+	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_INTEL_SSE -c $<
 
 pngmem.o: pngmem.c
-	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_ARM_NEON_OPT=0 -c $<
+	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_INTEL_SSE -c $<
 
 pngrio.o: pngrio.c
-	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_ARM_NEON_OPT=0 -c $<
+	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_INTEL_SSE -c $<
 
 pngset.o: pngset.c
-	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_ARM_NEON_OPT=0 -c $<
+	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_INTEL_SSE -c $<
 
 pngwio.o: pngwio.c
-	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_ARM_NEON_OPT=0 -c $<
+	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_INTEL_SSE -c $<
 
 pngwutil.o: pngwutil.c
-	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_ARM_NEON_OPT=0 -c $<
+	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_INTEL_SSE -c $<
 
 pngerror.o: pngerror.c
-	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_ARM_NEON_OPT=0 -c $<
+	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_INTEL_SSE -c $<
 
 pngpread.o: pngpread.c
-	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_ARM_NEON_OPT=0 -c $<
+	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_INTEL_SSE -c $<
 
 pngrtran.o: pngrtran.c
-	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_ARM_NEON_OPT=0 -c $<
+	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_INTEL_SSE -c $<
 
 pngwrite.o: pngwrite.c
-	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_ARM_NEON_OPT=0 -c $<
+	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -DPNG_INTEL_SSE -c $<
+
+arm_init.o: arm/arm_init.c
+	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -c $<
+
+filter_neon_intrinsics.o: arm/filter_neon_intrinsics.c
+	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -c $<
+
+palette_neon_intrinsics.o: arm/palette_neon_intrinsics.c
+	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) -c $<
+
+intel_init.o: intel/intel_init.c
+	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) $(SSE2_CFLAGS) -DPNG_INTEL_SSE -c $<
+
+filter_sse2_intrinsics.o: intel/filter_sse2_intrinsics.c
+	$(CC) -I. -I./src -I$(PREFIX)/include $(CFLAGS) $(SSE2_CFLAGS) -DPNG_INTEL_SSE -c $<
@@ -19,6 +19,16 @@
  */
 struct image;
 
+/*
+ * Rectangle in pixels.
+ */
+struct image_rect {
+	int x;
+	int y;
+	int w;
+	int h;
+};
+
 /*
  * RGBA-color pixel value.
  */
@@ -89,20 +99,186 @@ static INLINE uint32_t get_pixel_b(pixel_t p)
 bool image_init(void);
 
 /* Cleanup the stdimage module. */
-void mage_cleanup(void);
+void image_cleanup(void);
+
+/* Get the name of the SIMD kernel level selected by image_init(). */
+const char *image_get_simd_level(void);
+
+/*
+ * Set the parallel execution mode of clears and draws.
+ *  - threads is the number of threads including the calling thread,
+ *    and 1 disables the mode.
+ *  - Draws smaller than threshold pixels run on the calling thread.
+ *    Zero selects the default.
+ *  - Draws must be called from one thread at a time.
+ */
+bool image_set_parallel(int threads, int threshold);
 
-/* Create an image. */
+/*
+ * Create an image.
+ *  - The pixels are straight (not premultiplied) until marked otherwise.
+ */
 bool image_create(int w, int h, struct image **img);
 
+/*
+ * Image pool
+ *  - image_destroy() keeps the image with its pixels in a pool, and
+ *    image_create() of a similar size reuses it.
+ *  - The pool holds at most the limit bytes. (64 MiB by default)
+ *  - image_trim_pool() frees pooled images until at most the specified
+ *    bytes remain, e.g. 0 on a low memory warning.
+ */
+void image_set_pool_limit(size_t bytes);
+void image_trim_pool(size_t bytes);
+size_t image_get_pool_size(void);
+
+/*
+ * Create a view of a rectangle of an image.
+ *  - The view shares the pixels, so the parent must outlive it.
+ *  - The view also shares the premultiplied state of the parent, so
+ *    image_premultiply() on a view converts the whole parent.
+ *  - Destroy a view with image_destroy().
+ */
+bool image_create_view(struct image *parent, int x, int y, int w, int h, struct image **img);
+
+/*
+ * The decoders below return premultiplied images.  The draw functions
+ * pick the kernels by the premultiplied flag of the source image.
+ */
+
 /* Create an image with a PNG file. */
 bool image_create_with_png(const uint8_t *data, size_t size, struct image **img);
 
+/*
+ * Streaming PNG decoding
+ *  - Feed a PNG file in chunks of any size as they arrive.  The callback
+ *    receives the premultiplied rows completed by each chunk, so reads,
+ *    inflate and texture uploads can overlap.
+ *  - The image is allocated when the header arrives, and
+ *    image_get_png_stream_image() returns NULL until then.
+ *  - An interlaced image completes all of its rows at the end.
+ *  - image_finish_png_stream() frees the stream, and returns the image
+ *    if the decode is complete or destroys it otherwise.
+ */
+struct image_png_stream;
+typedef void (*image_rows_callback)(void *arg, struct image *img, int top, int count);
+bool image_create_png_stream(image_rows_callback callback, void *arg, struct image_png_stream **stream);
+bool image_feed_png_stream(struct image_png_stream *stream, const uint8_t *data, size_t size);
+struct image *image_get_png_stream_image(struct image_png_stream *stream);
+bool image_finish_png_stream(struct image_png_stream *stream, struct image **img);
+
 /* Create an image with a JPEG file. */
 bool image_create_with_jpeg(const uint8_t *data, size_t size, struct image **img);
 
+/*
+ * Create an image with a JPEG file, scaled down in the IDCT.
+ *  - denom is 1, 2, 4 or 8.
+ *  - The size is the full size divided by denom, rounded up.
+ *  - A reduced decode costs a fraction of a full one.
+ */
+bool image_create_with_jpeg_scaled(const uint8_t *data, size_t size, int denom, struct image **img);
+
 /* Create an image with a WebP file. */
 bool image_create_with_webp(const uint8_t *data, size_t size, struct image **img);
 
+/* Create an image with a PNG, JPEG or WebP file, telling the format by the signature. */
+bool image_create_with_data(const uint8_t *data, size_t size, struct image **img);
+
+/* Read an image file with the file component and create an image. */
+bool image_create_with_file(const char *path, struct image **img);
+
+/*
+ * Disk cache of decoded images
+ *  - image_create_with_file() and image_decode_file_async() keep the
+ *    decoded pixels of each file in the directory, and map them on the
+ *    next load instead of decoding.
+ *  - An entry is keyed by the path and is used only while the size and
+ *    the content hash of the file match, so a changed file is decoded
+ *    again.
+ *  - A mapped image is copy-on-write, and can be drawn to as usual.
+ *  - The directory must exist.  Set it before loading images.
+ *  - NULL disables the cache. (default)
+ */
+bool image_set_disk_cache(const char *dir);
+
+/*
+ * Image cache
+ *  - image_acquire() shares one image among the loads of a path, and
+ *    counts the references.  Don't draw to a shared image.
+ *  - image_release() drops a reference instead of image_destroy().  An
+ *    image without a reference is kept for the next image_acquire(),
+ *    and is freed in the LRU order while the cache exceeds the budget.
+ *    (256 MiB by default)
+ *  - Call from one thread.
+ */
+struct image_cache_stats {
+	int count;		/* Cached images. */
+	int unused_count;	/* Cached images without a reference. */
+	size_t bytes;		/* Pixel bytes of the cached images. */
+	size_t unused_bytes;	/* Pixel bytes of the images without a reference. */
+	uint64_t hits;		/* image_acquire() calls served from the cache. */
+	uint64_t misses;	/* image_acquire() calls that loaded the file. */
+	uint64_t evictions;	/* Images freed to fit in the budget. */
+};
+bool image_acquire(const char *path, struct image **img);
+void image_release(struct image *img);
+void image_set_cache_budget(size_t bytes);
+void image_purge_cache(void);
+void image_get_cache_stats(struct image_cache_stats *stats);
+
+/*
+ * Image file formats.
+ */
+enum image_format {
+	IMAGE_FORMAT_UNKNOWN,
+	IMAGE_FORMAT_PNG,
+	IMAGE_FORMAT_JPEG,
+	IMAGE_FORMAT_WEBP,
+};
+
+/*
+ * Metrics of an image file.
+ */
+struct image_info {
+	int format;		/* IMAGE_FORMAT_* */
+	int width;
+	int height;
+	bool has_alpha;		/* The file has an alpha channel or a transparent color. */
+};
+
+/*
+ * Get the format and the metrics of an image file without decoding.
+ *  - Only the headers are read.  A PNG file needs the chunks before
+ *    the pixel data.
+ *  - info->format is set even on a failure.
+ */
+bool image_probe(const uint8_t *data, size_t size, struct image_info *info);
+
+/*
+ * Asynchronous decoding
+ *  - The decoding threads run image_create_with_data(), so a scene load
+ *    doesn't stall the frame thread.
+ *  - data must stay valid until the decode completes.  A path is read
+ *    with the file component on a decoding thread.
+ *  - With a callback, image_dispatch_decodes() on the main thread calls
+ *    it for each completed decode with the image, or NULL on a failure.
+ *    The request is freed after the call, and *req is set to NULL.
+ *  - Without a callback, poll with image_is_decode_done() and take the
+ *    image with image_finish_decode(), which waits if not done and frees
+ *    the request.
+ *  - Without threads on the platform, the decode runs in the call.
+ */
+struct image_decode;
+typedef void (*image_decode_callback)(void *arg, struct image *img);
+bool image_decode_async(const uint8_t *data, size_t size, image_decode_callback callback, void *arg, struct image_decode **req);
+bool image_decode_file_async(const char *path, image_decode_callback callback, void *arg, struct image_decode **req);
+bool image_is_decode_done(struct image_decode *req);
+bool image_finish_decode(struct image_decode *req, struct image **img);
+void image_dispatch_decodes(void);
+
+/* Set the number of the decoding threads. (2 by default) */
+void image_set_decode_threads(int threads);
+
 /* Destroy an image. */
 void image_destroy(struct image *img);
 
@@ -112,9 +288,38 @@ int image_get_width(struct image *img);
 /* Get an image height. */
 int image_get_height(struct image *img);
 
-/* Get image pixels. */
+/* Get an image stride in pixels. (a view has the stride of its parent) */
+int image_get_stride(struct image *img);
+
+/* Get image pixels. (rows are image_get_stride() pixels apart) */
 pixel_t *image_get_pixels(struct image *img);
 
+/* Check if image pixels are premultiplied by alpha. (a view has the state of its parent) */
+bool image_is_premultiplied(struct image *img);
+
+/* Mark image pixels as premultiplied or straight, without a conversion. (a view marks its parent) */
+void image_set_premultiplied(struct image *img, bool is_premultiplied);
+
+/* Premultiply image pixels by alpha. (a view converts its whole parent) */
+void image_premultiply(struct image *img);
+
+/*
+ * Dirty rectangles
+ *  - Clears and draws record the changed rectangles in a small set,
+ *    merging them when the set is full.
+ *  - A view records changes in its parent too.
+ *  - A new image is dirty as a whole.
+ */
+
+/* Add a rectangle to the dirty rectangles, after writing pixels directly. */
+void image_mark_dirty(struct image *img, int x, int y, int w, int h);
+
+/* Get the dirty rectangles. Returns the count. */
+int image_get_dirty_rects(struct image *img, const struct image_rect **rects);
+
+/* Forget the dirty rectangles after an upload. */
+void image_clear_dirty(struct image *img);
+
 /* Clear an image with a uniform color. */
 void image_clear(struct image *img, pixel_t color);
 
@@ -137,11 +342,104 @@ void image_draw_add(struct image *dst_image, int dst_left, int dst_top,
 		    struct image *src_image, int width, int height,
 		    int src_left, int src_top, int alpha);
 
-/* Draw an image on an image. (add-blending) */
+/* Draw an image on an image. (sub-blending) */
 void image_draw_sub(struct image *dst_image, int dst_left, int dst_top,
 		    struct image *src_image, int width, int height,
 		    int src_left, int src_top, int alpha);
 
+/*
+ * Draw an image on an image through a rule image. (alpha-blending, dst_alpha=255)
+ *  - Each pixel is blended by a weight from the low byte of the rule
+ *    pixel at the destination position.  A gray rule image has the
+ *    value in all the color channels.
+ *  - threshold goes from 0 (nothing drawn) to 255 (all drawn), and the
+ *    pixels of smaller rule values appear first.
+ *  - softness is the width of the blended edge in rule values, and 0
+ *    makes a hard edge.
+ *  - The rule image must cover the destination image.
+ */
+void image_draw_rule(struct image *dst_image, int dst_left, int dst_top,
+		     struct image *src_image, int width, int height,
+		     int src_left, int src_top, struct image *rule_image,
+		     int threshold, int softness);
+
+/*
+ * Porter-Duff operators.
+ */
+enum image_composite_op {
+	IMAGE_COMPOSITE_CLEAR,
+	IMAGE_COMPOSITE_SRC,
+	IMAGE_COMPOSITE_DST,
+	IMAGE_COMPOSITE_SRC_OVER,
+	IMAGE_COMPOSITE_DST_OVER,
+	IMAGE_COMPOSITE_SRC_IN,
+	IMAGE_COMPOSITE_DST_IN,
+	IMAGE_COMPOSITE_SRC_OUT,
+	IMAGE_COMPOSITE_DST_OUT,
+	IMAGE_COMPOSITE_SRC_ATOP,
+	IMAGE_COMPOSITE_DST_ATOP,
+	IMAGE_COMPOSITE_XOR,
+};
+
+/*
+ * Composite an image on an image by a Porter-Duff operator.
+ *  - The destination alpha is honored and written, so layers can be
+ *    composited into a transparent image and drawn later as a
+ *    premultiplied source.
+ *  - The destination pixels must be premultiplied, and the caller must
+ *    mark them so by image_set_premultiplied(), also for a new canvas or
+ *    an opaque image.  A straight source is premultiplied on the fly.
+ *  - The source is scaled by alpha before the operator.
+ *  - Only the destination rectangle is affected, also by the operators
+ *    that clear outside of the source, such as IMAGE_COMPOSITE_SRC_IN.
+ */
+void image_draw_composite(struct image *dst_image, int dst_left, int dst_top,
+			  struct image *src_image, int width, int height,
+			  int src_left, int src_top, int alpha, int op);
+
+/*
+ * Draw a crossfade of two images on an image.
+ *  - Each pixel is replaced by the interpolation of the pixels of a and
+ *    b at the same position, by the weight t of b. (0 to 255)
+ *  - The area common to the three images is drawn.
+ *  - a and b must both be straight or both premultiplied, and the
+ *    destination takes the same state.
+ */
+void image_draw_crossfade(struct image *dst_image, struct image *a_image,
+			  struct image *b_image, int t);
+
+/*
+ * Scaling modes.
+ */
+enum image_scale_mode {
+	IMAGE_SCALE_NEAREST,
+	IMAGE_SCALE_BILINEAR,
+};
+
+/*
+ * Draw a scaled image on an image. (alpha-blending, dst_alpha=255)
+ *  - The source rectangle is stretched to the destination rectangle.
+ *  - The source rectangle must be inside the source image.
+ *  - Use a premultiplied source for bilinear scaling, or colors of
+ *    transparent pixels bleed into edges.
+ */
+void image_draw_scaled(struct image *dst_image, int dst_left, int dst_top,
+		       int dst_width, int dst_height, struct image *src_image,
+		       int src_left, int src_top, int src_width, int src_height,
+		       int alpha, int mode);
+
+/*
+ * Draw an affine-transformed image on an image. (alpha-blending, dst_alpha=255)
+ *  - matrix maps a source position relative to the source rectangle to a
+ *    destination position:
+ *        x' = matrix[0] * x + matrix[2] * y + matrix[4]
+ *        y' = matrix[1] * x + matrix[3] * y + matrix[5]
+ *  - mode is IMAGE_SCALE_NEAREST or IMAGE_SCALE_BILINEAR.
+ */
+void image_draw_affine(struct image *dst_image, struct image *src_image,
+		       int src_left, int src_top, int src_width, int src_height,
+		       const float *matrix, int alpha, int mode);
+
 /* Clip a rectangle by a source size. */
 bool image_clip_by_source(int src_cx,
 			  int src_cy,
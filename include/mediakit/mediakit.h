@@ -17,6 +17,7 @@
 /* Modules */
 #include "sys.h"
 #include "file.h"
+#include "stor.h"
 #include "image.h"
 #include "input.h"
 #include "render.h"
@@ -119,9 +119,12 @@ bool render_create_texture(int width, int height, int miplevel, struct render_te
 /* Destroy a texture. */
 void render_destroy_texture(struct render_texture *tex);
 
-/* Upload pixels to a texture. */
+/* Upload pixels to a texture. (A straight image is premultiplied on a copy, and left as is.) */
 void render_upload_texture(struct render_texture *tex, int miplevel, struct image *img);
 
+/* Upload the dirty rectangles of an image to a texture of the same size. (Likewise) */
+void render_update_texture(struct render_texture *tex, struct image *img);
+
 /*
  * Vertex Buffer
  */
@@ -12,25 +12,78 @@
 #ifndef MEDIAKIT_STOR_H
 #define MEDIAKIT_STOR_H
 
-#include "config.h"
+#include "compat.h"
 
 struct stor;
 
+/* Value types. */
+enum stor_type {
+	STOR_TYPE_STRING,
+	STOR_TYPE_INT,
+	STOR_TYPE_FLOAT,
+	STOR_TYPE_BOOL,
+	STOR_TYPE_BLOB,
+};
+
 /* Open a storage. */
 bool stor_open(const char *file_name, struct stor **s);
 
-/* Put an data item. */
+/* Put a string item. */
 bool stor_put(struct stor *s, const char *key, const char *value);
 
-/* Get an data item. */
+/* Put an int item. */
+bool stor_put_int(struct stor *s, const char *key, int value);
+
+/* Put a float item. */
+bool stor_put_float(struct stor *s, const char *key, float value);
+
+/* Put a bool item. */
+bool stor_put_bool(struct stor *s, const char *key, bool value);
+
+/* Put a blob item. */
+bool stor_put_blob(struct stor *s, const char *key, const void *data, size_t size);
+
+/* Get a string item. */
 bool stor_get(struct stor *s, const char *key, const char **value);
 
+/* Get an int item. */
+bool stor_get_int(struct stor *s, const char *key, int *value);
+
+/* Get a float item. */
+bool stor_get_float(struct stor *s, const char *key, float *value);
+
+/* Get a bool item. */
+bool stor_get_bool(struct stor *s, const char *key, bool *value);
+
+/* Get a blob item. (The data is valid until the item is changed.) */
+bool stor_get_blob(struct stor *s, const char *key, const void **data, size_t *size);
+
+/*
+ * Iterate items that have a key prefix, in the key order.
+ * The callback receives a key and a STOR_TYPE_* value, and may call
+ * stor_get*() but must not put or remove items.  Returning false from
+ * the callback stops the iteration and this function returns false.
+ */
+bool stor_iterate_prefix(struct stor *s, const char *prefix,
+			 bool (*callback)(void *arg, const char *key, int type),
+			 void *arg);
+
+/*
+ * Get string items at once.
+ * values[i] is set to NULL if keys[i] is not a string item.  Sorting
+ * the keys makes the lookups faster.  Returns the number of found items.
+ */
+int stor_get_many(struct stor *s, const char **keys, int count, const char **values);
+
 /* Remove an data item. */
 bool stor_remove(struct stor *s, const char *key);
 
 /* Remove all data items. */
 bool stor_remove_all(struct stor *s);
 
+/* Enable or disable the compression of a storage file. */
+void stor_set_compression(struct stor *s, bool enable);
+
 /* Close a storage. */
 bool stor_close(struct stor *s);
 
@@ -11,6 +11,7 @@
 
 #include "mediakit/mediakit.h"
 #include "glrender.h"
+#include "imagekernel.h"	/* image_premultiply_pixel() */
 
 /* Linux (OpenGL 3.2) */
 #if defined(TARGET_LINUX)
@@ -181,6 +182,7 @@ static bool render_create_program(void);
 static void render_setup_attributes(struct render_pipeline *p);
 static void render_setup_samplers(struct render_pipeline *p);
 static const char *render_translate_type(const char *type);
+static pixel_t *render_premultiply_rect(struct image *img, int x, int y, int w, int h);
 
 /*
  * Initialize the glrender module.
@@ -1179,8 +1181,14 @@ bool render_create_texture(int width, int height, int miplevel, struct render_te
 	}
 
 	/* Create a texture. */
-	glGenTextures(1, &render_texture[i].tex);
+	glGenTextures(1, &render_texture[index].tex);
+	render_texture[index].is_used = true;
 
+	/* No storage yet, so that the first update makes a full upload. */
+	render_texture[index].width = 0;
+	render_texture[index].height = 0;
+
+	*tex = &render_texture[index];
 	return true;
 }
 
@@ -1198,7 +1206,24 @@ void render_bind_texture(int index, struct render_texture *tex)
  */
 void render_upload_texture(struct render_texture *tex, int miplevel, struct image *img)
 {
+	const pixel_t *pixels;
+	pixel_t *staging;
+	int row_length;
+
+	/* The blend function expects premultiplied pixels. Convert a copy, the image may be shared. */
+	pixels = image_get_pixels(img);
+	row_length = image_get_stride(img);
+	staging = NULL;
+	if (!image_is_premultiplied(img)) {
+		staging = render_premultiply_rect(img, 0, 0, image_get_width(img), image_get_height(img));
+		if (staging == NULL)
+			return;
+		pixels = staging;
+		row_length = image_get_width(img);
+	}
+
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, row_length);
 	glBindTexture(GL_TEXTURE_2D, tex->tex);
 #ifdef TARGET_WASM
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -1215,8 +1240,106 @@ void render_upload_texture(struct render_texture *tex, int miplevel, struct imag
 		     0,
 		     GL_RGBA,
 		     GL_UNSIGNED_BYTE,
-		     image_get_pixels(img));
+		     pixels);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 	glActiveTexture(GL_TEXTURE0);
+	free(staging);
+
+	if (miplevel == 0) {
+		tex->width = (GLuint)image_get_width(img);
+		tex->height = (GLuint)image_get_height(img);
+		image_clear_dirty(img);
+	}
+}
+
+/*
+ * Upload the dirty rectangles of an image to a texture of the same size.
+ */
+void render_update_texture(struct render_texture *tex, struct image *img)
+{
+	const struct image_rect *rect;
+	pixel_t *pixels, *staging;
+	int count, stride, i;
+	bool is_premultiplied;
+
+	/* Reallocate the storage if the size doesn't match. */
+	if (tex->width != (GLuint)image_get_width(img) ||
+	    tex->height != (GLuint)image_get_height(img)) {
+		render_upload_texture(tex, 0, img);
+		return;
+	}
+
+	count = image_get_dirty_rects(img, &rect);
+	if (count == 0)
+		return;
+
+	pixels = image_get_pixels(img);
+	stride = image_get_stride(img);
+	is_premultiplied = image_is_premultiplied(img);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D, tex->tex);
+	for (i = 0; i < count; i++) {
+		if (is_premultiplied) {
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, stride);
+			glTexSubImage2D(GL_TEXTURE_2D,
+					0,
+					rect[i].x,
+					rect[i].y,
+					rect[i].w,
+					rect[i].h,
+					GL_RGBA,
+					GL_UNSIGNED_BYTE,
+					pixels + rect[i].y * stride + rect[i].x);
+			continue;
+		}
+
+		/* Convert a copy of a straight rectangle, as render_upload_texture() does. */
+		staging = render_premultiply_rect(img, rect[i].x, rect[i].y, rect[i].w, rect[i].h);
+		if (staging == NULL) {
+			/* Keep the rectangles dirty to retry. */
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+			return;
+		}
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, rect[i].w);
+		glTexSubImage2D(GL_TEXTURE_2D,
+				0,
+				rect[i].x,
+				rect[i].y,
+				rect[i].w,
+				rect[i].h,
+				GL_RGBA,
+				GL_UNSIGNED_BYTE,
+				staging);
+		free(staging);
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glActiveTexture(GL_TEXTURE0);
+
+	image_clear_dirty(img);
+}
+
+/* Copy a rectangle of a straight image with the pixels premultiplied. */
+static pixel_t *render_premultiply_rect(struct image *img, int x, int y, int w, int h)
+{
+	const pixel_t *src;
+	pixel_t *buf;
+	int stride, i, j;
+
+	buf = malloc(sizeof(pixel_t) * (size_t)(w > 0 ? w : 1) * (size_t)(h > 0 ? h : 1));
+	if (buf == NULL) {
+		sys_out_of_memory();
+		return NULL;
+	}
+
+	src = image_get_pixels(img);
+	stride = image_get_stride(img);
+	for (j = 0; j < h; j++) {
+		for (i = 0; i < w; i++)
+			buf[w * j + i] = image_premultiply_pixel(src[stride * (y + j) + x + i]);
+	}
+
+	return buf;
 }
 
 /*
@@ -1227,8 +1350,9 @@ void render_begin_frame(void)
 	glClearColor(0.0f, 0.0f, 1.0f, 0.0f);
 	glClear(GL_COLOR_BUFFER_BIT);
 
+	/* Textures are premultiplied by alpha. */
 	glEnable(GL_BLEND);
-	glBlendFunc(GL_ONE, GL_ONE);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
 }
 
 /*
@@ -10,14 +10,39 @@
  */
 
 #include "mediakit/mediakit.h"
+#include "imagekernel.h"
 
-#if defined(TARGET_WIN32)
+#include <math.h>	/* ceil() */
+
+#if defined(TARGET_WINDOWS)
 #include <malloc.h>	/* _aligned_malloc() */
 #endif
 
+#if (defined(ARCH_X86) || defined(ARCH_X86_64)) && defined(_MSC_VER)
+#include <intrin.h>	/* __cpuid() */
+#elif (defined(ARCH_X86) || defined(ARCH_X86_64)) && defined(__GNUC__)
+#include <cpuid.h>	/* __get_cpuid() */
+#endif
+
+#if defined(ARCH_ARM64) && defined(__linux__)
+#include <sys/auxv.h>	/* getauxval() */
+#include <asm/hwcap.h>	/* HWCAP_ASIMD */
+#endif
+
+/* POSIX */
+#if defined(TARGET_LINUX) || defined(TARGET_MACOS) || defined(TARGET_IOS) || defined(TARGET_ANDROID)
+#define USE_THREADS
+#include <pthread.h>
+#define USE_MMAP
+#include <sys/mman.h>	/* mmap() */
+#endif
+
 /* 512-bit alignment. */
 #define ALIGN_BYTES	(64)
 
+/* Maximum dirty rectangles of an image. */
+#define DIRTY_MAX	(8)
+
 /*
  * The body of the image structure.
  */
@@ -25,786 +50,3742 @@
 struct image {
 	int width;
 	int height;
+	int stride;		/* Pixels from a row to the next. */
 	pixel_t *pixels;
+	bool is_premultiplied;	/* Only of a root image. (see image_get_root()) */
+
+	/* The owner of the pixels and the position in it, if a view. */
+	struct image *parent;
+	int parent_x;
+	int parent_y;
+
+	/* Rectangles changed since the last upload. */
+	struct image_rect dirty[DIRTY_MAX];
+	int dirty_count;
+
+	/* Bytes of the pixel buffer, rounded up to the size class. */
+	size_t buffer_size;
+
+	/* Next image in a free list of the pool. */
+	struct image *next_free;
+
+	/* The mapping of a disk cache file holding the pixels, if any. */
+	void *map;
+	size_t map_size;
+
+	/* The entry in the image cache, if shared by image_acquire(). */
+	struct image_entry *entry;
 };
 
-/* Forward declaration. */
-static bool image_check_draw(struct image *dst_image, int *dst_left, int *dst_top, struct image *src_image, int *width, int *height, int *src_left, int *src_top, int alpha);
+/*
+ * Kernel levels.
+ */
+enum image_level {
+	IMAGE_LEVEL_C,
+	IMAGE_LEVEL_SSE2,
+	IMAGE_LEVEL_AVX2,
+	IMAGE_LEVEL_NEON,
+};
+
+/* Names of the levels, for the environment variable and the log. */
+static const char *level_name[] = {
+	"c",
+	"sse2",
+	"avx2",
+	"neon",
+};
+
+/* Environment variable to force a level. */
+#define LEVEL_ENV	"MEDIAKIT_IMAGE_SIMD"
 
 /*
- * Initialize the stdimage module.
+ * Dispatch table. (the scalar kernels until image_init() is called)
  */
-bool image_init(void)
-{
-	return true;
-}
+static struct image_kernels {
+	image_row_func alpha_row;
+	image_row_func add_row;
+	image_row_func sub_row;
+	image_row_func alpha_pm_row;
+	image_row_func alpha_pm_opaque_row;
+	image_row_func add_pm_row;
+	image_row_func sub_pm_row;
+	image_lerp_func lerp_row;
+	image_resample_func bilinear_row;
+	image_affine_func affine_bilinear_row;
+	image_expand_func expand_rgb_row;
+	image_expand_func expand_bgr_row;
+	image_rule_func rule_row;
+	image_rule_func rule_pm_row;
+	image_composite_func composite_row;
+	image_composite_func composite_pm_row;
+} kernels = {
+	image_alpha_row_c,
+	image_add_row_c,
+	image_sub_row_c,
+	image_alpha_pm_row_c,
+	image_alpha_pm_opaque_row_c,
+	image_add_pm_row_c,
+	image_sub_pm_row_c,
+	image_lerp_row_c,
+	image_bilinear_row_c,
+	image_affine_bilinear_row_c,
+	image_expand_rgb_row_c,
+	image_expand_bgr_row_c,
+	image_rule_row_c,
+	image_rule_pm_row_c,
+	image_composite_row_c,
+	image_composite_pm_row_c,
+};
+
+/* The level of the dispatch table. */
+static int image_level;
 
 /*
- * Cleanup the stdimage module.
+ * Band-parallel execution.
+ *
+ * A large draw is split into horizontal bands.  The calling thread runs
+ * the first band and each worker runs one of the others.
  */
-void image_cleanup(void)
-{
-}
+
+/* Maximum threads including the calling thread. */
+#define THREAD_MAX		(16)
+
+/* Default minimum pixels of a draw to split into bands. */
+#define DEFAULT_THRESHOLD	(256 * 256)
+
+/* Type of a band function. (band is the index from 0 to image_count_bands() - 1) */
+typedef void (*image_band_func)(void *arg, int band, int top, int bottom);
+
+/* Threads including the calling thread, and the size threshold. */
+static int thread_count = 1;
+static int parallel_threshold = DEFAULT_THRESHOLD;
+
+#ifdef USE_THREADS
+/* Worker pool. */
+static pthread_t worker[THREAD_MAX];
+static int worker_count;
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static bool is_quitting;
+
+/* The current job. */
+static image_band_func job_func;
+static void *job_arg;
+static int job_height;
+static uint32_t job_serial;
+static int job_next;
+static int job_done;
+#endif
 
 /*
- * Create an image.
+ * Image pool.
+ *
+ * A destroyed image is kept with its pixel buffer in a free list of its
+ * size class and reused by the next image_create() of the class.  The
+ * buffers are already faulted in.  Classes are four per power of two,
+ * so a buffer wastes less than a quarter of its size.
  */
-bool image_create(int w, int h, struct image **ret)
-{
-	struct image *img;
-	pixel_t *pixels;
 
-	assert(w > 0 && h > 0);
+/* Number of size classes. */
+#define POOL_CLASS_COUNT	(256)
 
-	/* Allocate a memory for a struct image. */
-	img = malloc(sizeof(struct image));
-	if (img == NULL) {
-		sys_out_of_memory();
-		return NULL;
-	}
+/* Default limit of the pooled bytes. */
+#define DEFAULT_POOL_LIMIT	((size_t)64 * 1024 * 1024)
 
-	/* Allocate a pixel buffer. */
-#if defined(TARGET_WIN32)
-	pixels = _aligned_malloc((size_t)w * (size_t)h * sizeof(pixel_t), ALIGN_BYTES);
-	if (pixels == NULL) {
-		system_out_of_memory();
-		free(img);
-		return NULL;
-	}
-#else
-	if (posix_memalign((void **)&pixels, ALIGN_BYTES, (size_t)w * (size_t)h * sizeof(pixel_t)) != 0) {
-		sys_out_of_memory();
-		free(img);
-		return NULL;
-	}
+/* Free lists by size class, and the pooled bytes. */
+static struct image *free_list[POOL_CLASS_COUNT];
+static size_t free_bytes;
+static size_t free_limit = DEFAULT_POOL_LIMIT;
+
+#ifdef USE_THREADS
+/* Images are created and destroyed by the decoding threads too. */
+static pthread_mutex_t free_mutex = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
-	/* Setup members */
-	img->width = w;
-	img->height = h;
-	img->pixels = pixels;
+/*
+ * Asynchronous decoding.
+ *
+ * Requests are queued to the decoding threads, which are started on the
+ * first request.  A completed request with a callback moves to the done
+ * list until image_dispatch_decodes() on the main thread.
+ */
 
-	return img;
-}
+/* Maximum and default decoding threads. */
+#define DECODE_THREAD_MAX	(8)
+#define DEFAULT_DECODE_THREADS	(2)
+
+/* A decode request. */
+struct image_decode {
+	const uint8_t *data;	/* Borrowed from the caller. */
+	size_t size;
+	char *path;		/* Read on a decoding thread if not NULL. */
+	image_decode_callback callback;
+	void *callback_arg;
+	struct image *img;	/* The result, or NULL on a failure. */
+	bool is_done;
+	struct image_decode *next;
+};
+
+/* Queued requests, and completed requests with a callback. */
+static struct image_decode *decode_head, *decode_tail;
+static struct image_decode *done_head, *done_tail;
+
+/* Decoding threads to start. */
+static int decode_thread_count = DEFAULT_DECODE_THREADS;
+
+#ifdef USE_THREADS
+/* Decoding threads. */
+static pthread_t decoder[DECODE_THREAD_MAX];
+static int decoder_count;
+static pthread_mutex_t decode_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t decode_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t finish_cond = PTHREAD_COND_INITIALIZER;
+static bool is_decode_quitting;
+#endif
 
 /*
- * Destroy an image.
+ * Disk cache.
+ *
+ * [Cache File Format]
+ *
+ * struct header {
+ *     u8  magic[4];          // "MKIC"
+ *     u32 version;           // CACHE_VERSION
+ *     u32 pixel_order;       // make_pixel(1, 2, 3, 4)
+ *     u32 width;
+ *     u32 height;
+ *     u32 is_premultiplied;
+ *     u64 path_hash;
+ *     u64 source_size;
+ *     u64 source_hash;
+ * };
+ * u8 pad[CACHE_HEADER_SIZE - sizeof(header)];
+ * pixel_t pixels[height][width];
+ *
+ * Integers are in the native byte order since a cache never leaves the
+ * machine.  The pixels start at a page boundary so that a mapping of
+ * the file serves them as is.  A file is named by the hash of the asset
+ * path, and is valid while the size and the hash of the asset match.
  */
-void image_destroy(struct image *img)
-{
-	assert(img != NULL);
-	assert(img->width > 0 && img->height > 0);
-	assert(img->pixels != NULL);
 
-	/* Free the pixel buffer. */
-#if defined(OPENNOVEL_TARGET_WIN32)
-	_aligned_free(img->pixels);
-#else
-	free(img->pixels);
-#endif
-	img->pixels = NULL;
+/* File magic and format version. */
+#define CACHE_MAGIC		"MKIC"
+#define CACHE_VERSION		(1)
+
+/* Size of the header part. (a multiple of 4 KiB and 16 KiB pages) */
+#define CACHE_HEADER_SIZE	(16384)
+
+/* Maximum width and height of a cached image. */
+#define CACHE_SIZE_MAX		(32768)
+
+/* Cache file header. */
+struct image_cache_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t pixel_order;
+	uint32_t width;
+	uint32_t height;
+	uint32_t is_premultiplied;
+	uint64_t path_hash;
+	uint64_t source_size;
+	uint64_t source_hash;
+};
 
-	/* Free the structure. */
-	free(img);
-}
+/* Cache directory, or NULL if disabled. (guarded by decode_mutex) */
+static char *cache_dir;
 
 /*
- * Get an image width.
+ * Image cache.
+ *
+ * Images loaded by image_acquire() are shared by the path and counted
+ * by the references.  An image without a reference stays in the cache
+ * in the LRU order, and is evicted from the least recently released
+ * while the cache exceeds the budget.
  */
-int image_get_width(struct image *img)
-{
-	assert(img != NULL);
 
-	return img->width;
-}
+/* Number of the hash buckets. (a power of two) */
+#define ENTRY_BUCKETS		(1024)
+
+/* Default budget of the cached bytes. */
+#define DEFAULT_CACHE_BUDGET	((size_t)256 * 1024 * 1024)
+
+/* A cached image. */
+struct image_entry {
+	char *path;
+	uint64_t path_hash;
+	struct image *img;
+	size_t size;
+	int ref_count;
+
+	/* Next entry in the bucket. */
+	struct image_entry *next;
+
+	/* Neighbors in the LRU list, while unreferenced. */
+	struct image_entry *lru_prev;
+	struct image_entry *lru_next;
+};
+
+/* Hash buckets of the entries. */
+static struct image_entry *entry_bucket[ENTRY_BUCKETS];
+
+/* Unreferenced entries, from the least recently released. */
+static struct image_entry *lru_head, *lru_tail;
+
+/* Budget and statistics. */
+static size_t cache_budget = DEFAULT_CACHE_BUDGET;
+static struct image_cache_stats cache_stats;
 
 /*
- * Get an image height.
+ * A draw of rows.
  */
-int image_get_height(struct image *img)
-{
-	assert(img != NULL);
+struct image_blit {
+	pixel_t *dst;
+	const pixel_t *src;
+	int dst_pitch;
+	int src_pitch;
+	int width;
+	uint32_t alpha;
+	image_row_func row;
+};
 
-	return img->height;
-}
+/*
+ * A draw of rows through a rule image.
+ */
+struct image_rule {
+	pixel_t *dst;
+	const pixel_t *src;
+	const pixel_t *rule;	/* At the same position as dst. */
+	int dst_pitch;
+	int src_pitch;
+	int rule_pitch;
+	int width;
+	uint32_t pos;
+	uint32_t limit;
+	uint32_t gain;
+	image_rule_func row;
+};
 
 /*
- * Get image pixels.
+ * A Porter-Duff composition of rows.
  */
-pixel_t *image_get_pixels(struct image *img)
-{
-	assert(img != NULL);
+struct image_composite {
+	pixel_t *dst;
+	const pixel_t *src;
+	int dst_pitch;
+	int src_pitch;
+	int width;
+	uint32_t alpha;
+	const struct image_pd *pd;
+	image_composite_func row;
+};
 
-	return img->pixels;
-}
+/* Porter-Duff factors by IMAGE_COMPOSITE_*. */
+static const struct image_pd pd_table[] = {
+	/* CLEAR:    0,      0      */ {   0,  0,   0,  0 },
+	/* SRC:      1,      0      */ { 255,  0,   0,  0 },
+	/* DST:      0,      1      */ {   0,  0, 255,  0 },
+	/* SRC_OVER: 1,      1 - Sa */ { 255,  0, 255, -1 },
+	/* DST_OVER: 1 - Da, 1      */ { 255, -1, 255,  0 },
+	/* SRC_IN:   Da,     0      */ {   0,  1,   0,  0 },
+	/* DST_IN:   0,      Sa     */ {   0,  0,   0,  1 },
+	/* SRC_OUT:  1 - Da, 0      */ { 255, -1,   0,  0 },
+	/* DST_OUT:  0,      1 - Sa */ {   0,  0, 255, -1 },
+	/* SRC_ATOP: Da,     1 - Sa */ {   0,  1, 255, -1 },
+	/* DST_ATOP: 1 - Da, Sa     */ { 255, -1,   0,  1 },
+	/* XOR:      1 - Da, 1 - Sa */ { 255, -1, 255, -1 },
+};
 
 /*
- * Clear an image with a uniform color.
+ * A crossfade of rows.
  */
-void image_clear(struct image *img, pixel_t color)
-{
-	image_clear_rect(img, 0, 0, img->width, img->height, color);
-}
+struct image_crossfade {
+	pixel_t *dst;
+	const pixel_t *a;
+	const pixel_t *b;
+	int dst_pitch;
+	int a_pitch;
+	int b_pitch;
+	int width;
+	uint32_t w;		/* The weight of b, 0 to 256. */
+};
 
 /*
- * Clear an image rectangle with a uniform color.
+ * A scaled draw of rows.
  */
-void image_clear_rect(struct image *img, int x, int y, int w, int h, pixel_t color)
+struct image_scale {
+	pixel_t *dst;		/* The top-left of the clipped rectangle. */
+	int dst_pitch;
+	const pixel_t *src;	/* The top-left of the source rectangle. */
+	int src_pitch;
+	int src_width;
+	int src_height;
+	int width;
+	int32_t fx;		/* 16.16 source position of the first column. */
+	int32_t fy;		/* 16.16 source position of the first row. */
+	int32_t step_x;
+	int32_t step_y;
+	uint32_t alpha;
+	int mode;
+	image_row_func blend;
+	pixel_t *rows;		/* Row buffers of the bands. */
+	int row_size;		/* Pixels of the row buffer of a band. */
+};
+
+/*
+ * An affine draw of rows.
+ */
+struct image_affine {
+	pixel_t *dst;
+	int dst_pitch;
+	int dst_width;
+	const pixel_t *src;	/* The top-left of the source rectangle. */
+	int src_pitch;
+	int src_width;
+	int src_height;
+	int top;		/* The first row of the destination bounds. */
+	double inv[6];		/* Destination to source mapping. */
+	uint32_t alpha;
+	int mode;
+	image_row_func blend;
+	pixel_t *rows;		/* A row buffer of dst_width pixels for each band. */
+};
+
+/*
+ * A fill of rows.
+ */
+struct image_fill {
+	pixel_t *dst;
+	int pitch;
+	int width;
+	pixel_t color;
+};
+
+/* Forward declaration. */
+static int image_size_class(size_t size, size_t *class_size);
+static struct image *image_pool_get(int cls);
+static bool image_pool_put(struct image *img);
+static pixel_t *image_alloc_buffer(size_t size);
+static void image_free_buffer(pixel_t *pixels);
+static void image_free_image(struct image *img);
+static bool image_queue_decode(struct image_decode *req);
+static void image_run_decode(struct image_decode *req);
+static void image_complete_decode(struct image_decode *req);
+static bool image_read_file(const char *path, uint8_t **data, size_t *size);
+static uint64_t image_hash(const void *data, size_t size);
+static char *image_make_cache_path(uint64_t path_hash);
+static bool image_load_cache(const char *path, uint64_t path_hash, size_t size, uint64_t hash, struct image **img);
+static void image_save_cache(const char *path, uint64_t path_hash, size_t size, uint64_t hash, struct image *img);
+static void image_unlink_lru(struct image_entry *entry);
+static void image_evict_entries(size_t budget);
+static int image_detect_format(const uint8_t *data, size_t size);
+static bool image_probe_png(const uint8_t *data, size_t size, struct image_info *info);
+static bool image_probe_jpeg(const uint8_t *data, size_t size, struct image_info *info);
+static bool image_probe_webp(const uint8_t *data, size_t size, struct image_info *info);
+#ifdef USE_THREADS
+static bool image_start_decoders(void);
+static void image_stop_decoders(void);
+static void *image_decoder_main(void *arg);
+#endif
+static int image_detect_level(void);
+static bool image_is_level_supported(int level);
+static void image_set_level(int level);
+static bool image_check_draw(struct image *dst_image, int *dst_left, int *dst_top, struct image *src_image, int *width, int *height, int *src_left, int *src_top, int alpha);
+static void image_draw_rows(struct image *dst_image, int dst_left, int dst_top, struct image *src_image, int width, int height, int src_left, int src_top, int alpha, image_row_func row, image_row_func pm_row);
+static void image_blit_band(void *arg, int band, int top, int bottom);
+static void image_rule_band(void *arg, int band, int top, int bottom);
+static void image_crossfade_band(void *arg, int band, int top, int bottom);
+static void image_composite_band(void *arg, int band, int top, int bottom);
+static void image_fill_band(void *arg, int band, int top, int bottom);
+static void image_scale_band(void *arg, int band, int top, int bottom);
+static void image_affine_band(void *arg, int band, int top, int bottom);
+static bool image_affine_span(double u0, double du, double limit, int width, int *left, int *right);
+static struct image_rect image_union_rect(const struct image_rect *a, const struct image_rect *b);
+static struct image *image_get_root(struct image *img);
+static void image_premultiply_rows(struct image *img, int top, int count);
+static void image_copy_row(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+static int image_count_bands(int width, int height);
+static void image_run_bands(image_band_func func, void *arg, int width, int height);
+#ifdef USE_THREADS
+static void image_stop_workers(void);
+static void *image_worker_main(void *arg);
+#endif
+
+/*
+ * Initialize the stdimage module.
+ */
+bool image_init(void)
 {
-	pixel_t *pixels;
-	int i, j, sx, sy;
+	const char *env;
+	int level, i;
 
-	assert(img != NULL);
-	assert(img->width > 0 && img->height > 0);
-	assert(img->pixels != NULL);
+	level = image_detect_level();
 
-	/* Check if we have to draw. */
-	if(w == 0 || h == 0)
-		return;
-	sx = sy = 0;
-	if(!image_clip_by_dest(img->width, img->height, &w, &h, &x, &y, &sx, &sy))
-		return;
+	/* Force a level if specified. */
+	env = getenv(LEVEL_ENV);
+	if (env != NULL && env[0] != '\0') {
+		for (i = 0; i < (int)(sizeof(level_name) / sizeof(level_name[0])); i++) {
+			if (strcmp(env, level_name[i]) == 0)
+				break;
+		}
+		if (i == (int)(sizeof(level_name) / sizeof(level_name[0])))
+			sys_log("%s: unknown level \"%s\".\n", LEVEL_ENV, env);
+		else if (!image_is_level_supported(i))
+			sys_log("%s: \"%s\" is not supported on this CPU.\n", LEVEL_ENV, env);
+		else
+			level = i;
+	}
 
-	assert(x >= 0 && x < img->width);
-	assert(w >= 0 && x + w <= img->width);
-	assert(y >= 0 && y < img->height);
-	assert(h >= 0 && y + h <= img->height);
+	image_set_level(level);
 
-	/* Fill pixels. */
-	pixels = img->pixels;
-	for (i = y; i < y + h; i++)
-		for (j = x; j < x + w; j++)
-			pixels[img->width * i + j] = color;
+	return true;
 }
 
 /*
- * Draw an image on an image. (copy)
+ * Cleanup the stdimage module.
  */
-void image_draw_copy(struct image *dst_image, int dst_left, int dst_top,
-		     struct image *src_image, int width, int height, int src_left,
-		     int src_top)
+void image_cleanup(void)
 {
-	pixel_t * RESTRICT src_ptr;
-	pixel_t * RESTRICT dst_ptr;
-	int x, y, sw, dw;
+	struct image_decode *req;
 
-	if (!image_check_draw(dst_image, &dst_left, &dst_top, src_image, &width, &height, &src_left, &src_top, 255))
-		return;
+#ifdef USE_THREADS
+	image_stop_workers();
+	image_stop_decoders();
+#endif
+	thread_count = 1;
+	parallel_threshold = DEFAULT_THRESHOLD;
+	decode_thread_count = DEFAULT_DECODE_THREADS;
+
+	/* Drop the completed requests that were not dispatched. */
+	while (done_head != NULL) {
+		req = done_head;
+		done_head = req->next;
+		if (req->img != NULL)
+			image_destroy(req->img);
+		free(req);
+	}
+	done_tail = NULL;
 
-	sw = src_image->width;
-	dw = dst_image->width;
-	src_ptr = src_image->pixels + sw * src_top + src_left;
-	dst_ptr = dst_image->pixels + dw * dst_top + dst_left;
+	image_set_pool_limit(DEFAULT_POOL_LIMIT);
+	image_trim_pool(0);
 
-	for(y = 0; y < height; y++) {
-		for(x = 0; x < width; x++)
-			*(dst_ptr + x) = *(src_ptr + x);
-		src_ptr += sw;
-		dst_ptr += dw;
-	}
+	image_purge_cache();
+	cache_budget = DEFAULT_CACHE_BUDGET;
+	memset(&cache_stats, 0, sizeof(cache_stats));
+	image_set_disk_cache(NULL);
+
+	image_set_level(IMAGE_LEVEL_C);
 }
 
 /*
- * Draw an image on an image. (alpha-blending, dst_alpha=255)
+ * Set the parallel execution mode.
  */
-void draw_image_alpha(struct image *dst_image, int dst_left, int dst_top,
-		      struct image *src_image, int width, int height,
-		      int src_left, int src_top, int alpha)
+bool image_set_parallel(int threads, int threshold)
 {
-	pixel_t * RESTRICT src_ptr;
-	pixel_t * RESTRICT dst_ptr;
-	float a, src_r, src_g, src_b, src_a, dst_r, dst_g, dst_b, dst_a;
-	uint32_t src_pix, dst_pix;
-	int src_line_inc, dst_line_inc, x, y, sw, dw;
-
-	if (!image_check_draw(dst_image, &dst_left, &dst_top, src_image, &width, &height, &src_left, &src_top, alpha))
-		return;
+#ifdef USE_THREADS
+	int i;
+#endif
 
-	sw = src_image->width;
-	dw = dst_image->width;
-	src_ptr = src_image->pixels + sw * src_top + src_left;
-	dst_ptr = dst_image->pixels + dw * dst_top + dst_left;
-	src_line_inc = sw - width;
-	dst_line_inc = dw - width;
-	a = (float)alpha / 255.0f;
-
-	for(y = 0; y < height; y++) {
-		for(x = 0; x < width; x++) {
-			/* Get the source and destination pixel values. */
-			src_pix	= *src_ptr++;
-			dst_pix	= *dst_ptr;
-
-			/* Calc alpha values. */
-			src_a = a * ((float)get_pixel_a(src_pix) / 255.0f);
-			dst_a = 1.0f - src_a;
-
-			/* Multiply the alpha value and the source pixel value. */
-			src_r = src_a * (float)get_pixel_r(src_pix);
-			src_g = src_a * (float)get_pixel_g(src_pix);
-			src_b = src_a * (float)get_pixel_b(src_pix);
-
-			/* Multiply the alpha value and the destination pixel value. */
-			dst_r = dst_a * (float)get_pixel_r(dst_pix);
-			dst_g = dst_a * (float)get_pixel_g(dst_pix);
-			dst_b = dst_a * (float)get_pixel_b(dst_pix);
-
-			/* Store to the destination. */
-			*dst_ptr++ = make_pixel(0xff,
-						(uint32_t)(src_r + dst_r),
-						(uint32_t)(src_g + dst_g),
-						(uint32_t)(src_b + dst_b));
+	if (threads < 1)
+		threads = 1;
+	if (threads > THREAD_MAX)
+		threads = THREAD_MAX;
+	parallel_threshold = threshold > 0 ? threshold : DEFAULT_THRESHOLD;
+
+#ifdef USE_THREADS
+	/* Restart the pool with the new size. */
+	image_stop_workers();
+	thread_count = 1;
+	is_quitting = false;
+	for (i = 0; i < threads - 1; i++) {
+		/* Pass the job serial so that the worker waits for the next job. */
+		if (pthread_create(&worker[i], NULL, image_worker_main, (void *)(uintptr_t)job_serial) != 0) {
+			sys_error("Cannot create an image worker thread.");
+			image_stop_workers();
+			return false;
 		}
-		src_ptr += src_line_inc;
-		dst_ptr += dst_line_inc;
+		worker_count++;
 	}
+	thread_count = threads;
+#else
+	/* No threads on this platform. */
+	if (threads > 1)
+		return false;
+#endif
+
+	return true;
 }
 
-/*
- * Draw an image on an image. (add-blending)
- */
-void image_draw_image_add(struct image *dst_image, int dst_left, int dst_top,
-			  struct image *src_image, int width, int height,
-			  int src_left, int src_top, int alpha)
+#ifdef USE_THREADS
+/* Stop and join the workers. */
+static void image_stop_workers(void)
 {
-	pixel_t * RESTRICT src_ptr;
-	pixel_t * RESTRICT dst_ptr;
-	float a, src_a;
-	uint32_t src_pix, src_r, src_g, src_b;
-	uint32_t dst_pix, dst_r, dst_g, dst_b;
-	uint32_t add_r, add_g, add_b;
-	int src_line_inc, dst_line_inc, x, y, sw, dw;
+	int i;
 
-	if (!image_check_draw(dst_image, &dst_left, &dst_top, src_image, &width, &height, &src_left, &src_top, alpha))
-		return;
+	pthread_mutex_lock(&pool_mutex);
+	is_quitting = true;
+	pthread_cond_broadcast(&start_cond);
+	pthread_mutex_unlock(&pool_mutex);
 
-	sw = src_image->width;
-	dw = dst_image->width;
-	src_ptr = src_image->pixels + sw * src_top + src_left;
-	dst_ptr = dst_image->pixels + dw * dst_top + dst_left;
-	src_line_inc = sw - width;
-	dst_line_inc = dw - width;
-	a = (float)alpha / 255.0f;
-
-	for(y = 0; y < height; y++) {
-		for(x = 0; x < width; x++) {
-			/* Get the source and destination pixel values. */
-			src_pix	= *src_ptr++;
-			dst_pix	= *dst_ptr;
-
-			/* Calc alpha values. */
-			src_a = a * ((float)get_pixel_a(src_pix) / 255.0f);
-
-			/* Multiply the alpha value and the source pixel value. */
-			src_r = (uint32_t)(src_a * ((float)get_pixel_r(src_pix) / 255.0f) * 255.0f);
-			src_g = (uint32_t)(src_a * ((float)get_pixel_g(src_pix) / 255.0f) * 255.0f);
-			src_b = (uint32_t)(src_a * ((float)get_pixel_b(src_pix) / 255.0f) * 255.0f);
-
-			/* Multiply the alpha value and the destination pixel value. */
-			dst_r = get_pixel_r(dst_pix);
-			dst_g = get_pixel_g(dst_pix);
-			dst_b = get_pixel_b(dst_pix);
-
-			/* Add. */
-			add_r = src_r + dst_r;
-			if (add_r > 255)
-				add_r = 255;
-			add_g = src_g + dst_g;
-			if (add_g > 255)
-				add_g = 255;
-			add_b = src_b + dst_b;
-			if (add_b > 255)
-				add_b = 255;
-
-			/* Store to the destination. */
-			*dst_ptr++ = make_pixel(0xff, add_r, add_g, add_b);
-		}
-		src_ptr += src_line_inc;
-		dst_ptr += dst_line_inc;
+	for (i = 0; i < worker_count; i++)
+		pthread_join(worker[i], NULL);
+	worker_count = 0;
+}
+
+/* Main function of a worker. */
+static void *image_worker_main(void *arg)
+{
+	image_band_func func;
+	void *func_arg;
+	uint32_t serial;
+	int index, height, bands;
+
+	serial = (uint32_t)(uintptr_t)arg;
+
+	pthread_mutex_lock(&pool_mutex);
+	for (;;) {
+		/* Wait for a job. */
+		while (job_serial == serial && !is_quitting)
+			pthread_cond_wait(&start_cond, &pool_mutex);
+		if (is_quitting)
+			break;
+		serial = job_serial;
+
+		/* Take a band. */
+		func = job_func;
+		func_arg = job_arg;
+		height = job_height;
+		bands = worker_count + 1;
+		index = job_next++;
+		pthread_mutex_unlock(&pool_mutex);
+
+		/* Run the band. */
+		func(func_arg, index, height * index / bands, height * (index + 1) / bands);
+
+		/* Tell the calling thread when all bands are done. */
+		pthread_mutex_lock(&pool_mutex);
+		if (++job_done == worker_count)
+			pthread_cond_signal(&done_cond);
 	}
+	pthread_mutex_unlock(&pool_mutex);
+
+	return NULL;
 }
+#endif
 
-/*
- * Draw an image on an image. (sub-blending)
- */
-void image_draw_sub(struct image *dst_image, int dst_left, int dst_top,
-		    struct image *src_image, int width, int height,
-		    int src_left, int src_top, int alpha)
+/* Get the number of bands that image_run_bands() splits a draw into. */
+static int image_count_bands(int width, int height)
 {
-	pixel_t * RESTRICT src_ptr;
-	pixel_t * RESTRICT dst_ptr;
-	float a, src_a;
-	uint32_t src_pix, src_r, src_g, src_b;
-	uint32_t dst_pix, dst_r, dst_g, dst_b;
-	uint32_t sub_r, sub_g, sub_b;
-	int src_line_inc, dst_line_inc, x, y, sw, dw;
+#ifdef USE_THREADS
+	if (thread_count > 1 && height >= thread_count && width * height >= parallel_threshold)
+		return worker_count + 1;
+#else
+	UNUSED_PARAMETER(width);
+	UNUSED_PARAMETER(height);
+#endif
+	return 1;
+}
 
-	if (!image_check_draw(dst_image, &dst_left, &dst_top, src_image, &width, &height, &src_left, &src_top, alpha))
+/* Run a band function on all rows, in parallel if the area is large. */
+static void image_run_bands(image_band_func func, void *arg, int width, int height)
+{
+#ifdef USE_THREADS
+	int bands;
+
+	bands = image_count_bands(width, height);
+	if (bands > 1) {
+		/* Start a job. */
+		pthread_mutex_lock(&pool_mutex);
+		job_func = func;
+		job_arg = arg;
+		job_height = height;
+		job_next = 1;
+		job_done = 0;
+		job_serial++;
+		pthread_cond_broadcast(&start_cond);
+		pthread_mutex_unlock(&pool_mutex);
+
+		/* Run the first band. */
+		func(arg, 0, 0, height / bands);
+
+		/* Wait for the workers. */
+		pthread_mutex_lock(&pool_mutex);
+		while (job_done < worker_count)
+			pthread_cond_wait(&done_cond, &pool_mutex);
+		pthread_mutex_unlock(&pool_mutex);
 		return;
-
-	sw = src_image->width;
-	dw = dst_image->width;
-	src_ptr = src_image->pixels + sw * src_top + src_left;
-	dst_ptr = dst_image->pixels + dw * dst_top + dst_left;
-	src_line_inc = sw - width;
-	dst_line_inc = dw - width;
-	a = (float)alpha / 255.0f;
-
-	for(y = 0; y < height; y++) {
-		for(x = 0; x < width; x++) {
-			/* Get the source and destination pixel values. */
-			src_pix	= *src_ptr++;
-			dst_pix	= *dst_ptr;
-
-			/* Calc alpha values. */
-			src_a = a * ((float)get_pixel_a(src_pix) / 255.0f);
-
-			/* Multiply the alpha value and the source pixel value. */
-			src_r = (uint32_t)(src_a * ((float)get_pixel_r(src_pix) / 255.0f) * 255.0f);
-			src_g = (uint32_t)(src_a * ((float)get_pixel_g(src_pix) / 255.0f) * 255.0f);
-			src_b = (uint32_t)(src_a * ((float)get_pixel_b(src_pix) / 255.0f) * 255.0f);
-
-			/* Multiply the alpha value and the destination pixel value. */
-			dst_r = get_pixel_r(dst_pix);
-			dst_g = get_pixel_g(dst_pix);
-			dst_b = get_pixel_b(dst_pix);
-
-			/* Add. */
-			sub_r = dst_r - src_r;
-			if (sub_r < 0)
-				sub_r = 0;
-			sub_g = dst_g - src_g;
-			if (sub_g < 0)
-				sub_g = 0;
-			sub_b = dst_b - src_b;
-			if (sub_b < 0)
-				sub_b = 0;
-
-			/* Store to the destination. */
-			*dst_ptr++ = make_pixel(0xff, sub_r, sub_g, sub_b);
-		}
-		src_ptr += src_line_inc;
-		dst_ptr += dst_line_inc;
 	}
+#endif
+
+	func(arg, 0, 0, height);
 }
 
-/* Check for draw_image_*() parameters. */
-static bool image_check_draw(struct image *dst_image, int *dst_left,
-			     int *dst_top, struct image *src_image,
-			     int *width, int *height, int *src_left,
-			     int *src_top, int alpha)
+/* Get the best level for the CPU. */
+static int image_detect_level(void)
 {
-	assert(dst_image != NULL);
-	assert(dst_image != src_image);
-	assert(dst_image->width > 0 && dst_image->height > 0);
-	assert(dst_image->pixels != NULL);
-	assert(src_image != NULL);
-	assert(src_image->width > 0 && src_image->height > 0);
-	assert(src_image->pixels != NULL);
+	if (image_is_level_supported(IMAGE_LEVEL_AVX2))
+		return IMAGE_LEVEL_AVX2;
+	if (image_is_level_supported(IMAGE_LEVEL_SSE2))
+		return IMAGE_LEVEL_SSE2;
+	if (image_is_level_supported(IMAGE_LEVEL_NEON))
+		return IMAGE_LEVEL_NEON;
+	return IMAGE_LEVEL_C;
+}
 
-	/* Return false if no need for a draw. */
-	if(alpha == 0 || *width == 0 || *height == 0)
-		return false;
-	if(!image_clip_by_source(src_image->width, src_image->height, width, height, dst_left, dst_top, src_left, src_top))
-		return false;
-	if(!image_clip_by_dest(dst_image->width, dst_image->height, width, height, dst_left, dst_top, src_left, src_top))
-		return false;
+#if defined(ARCH_X86) || defined(ARCH_X86_64)
+/* Execute CPUID. */
+static void image_cpuid(uint32_t leaf, uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
+{
+#if defined(_MSC_VER)
+	int r[4];
 
-	/* Need for a draw. */
-	return true;
+	__cpuidex(r, (int)leaf, 0);
+	*ebx = (uint32_t)r[1];
+	*ecx = (uint32_t)r[2];
+	*edx = (uint32_t)r[3];
+#else
+	uint32_t eax;
+
+	if (!__get_cpuid_count(leaf, 0, &eax, ebx, ecx, edx))
+		*ebx = *ecx = *edx = 0;
+#endif
 }
 
-/*
- * Clip a transfer rectangle by a size of a source size.
- */
-bool image_clip_by_source(int src_cx, int src_cy, int *cx, int *cy, int *dst_x,
-			  int *dst_y, int *src_x, int *src_y)
+/* Check if the OS saves the YMM registers. */
+static bool image_is_ymm_enabled(void)
 {
-	/* If the rectangle is completely out-of-scope.*/
-	if(*src_x < 0 && -*src_x >= *cx)
-		return false;	/* Left. */
-	if(*src_y < 0 && -*src_y >= *cy)
-		return false;	/* Top. */
-	if(*src_x > 0 && *src_x >= src_cx)
-		return false;	/* Right. */
-	if(*src_y > 0 && *src_y >= src_cy)
-		return false;	/* Bottom. */
+#if defined(_MSC_VER)
+	return (_xgetbv(0) & 6) == 6;
+#else
+	uint32_t eax, edx;
 
-	/* Cut by a left edge. */
-	if(*src_x < 0) {
-		*cx += *src_x;
+	__asm__ volatile ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+	(void)edx;
+	return (eax & 6) == 6;
+#endif
+}
+#endif
+
+/* Check if a level can run on the CPU. */
+static bool image_is_level_supported(int level)
+{
+#if defined(ARCH_X86) || defined(ARCH_X86_64)
+	uint32_t ebx, ecx, edx;
+#endif
+
+	switch (level) {
+	case IMAGE_LEVEL_C:
+		return true;
+#if defined(ARCH_X86) || defined(ARCH_X86_64)
+	case IMAGE_LEVEL_SSE2:
+		/* CPUID.1:EDX.SSE2[bit 26] */
+		image_cpuid(1, &ebx, &ecx, &edx);
+		return (edx & (1u << 26)) != 0;
+	case IMAGE_LEVEL_AVX2:
+		/* CPUID.1:ECX.OSXSAVE[bit 27] and AVX[bit 28] */
+		image_cpuid(1, &ebx, &ecx, &edx);
+		if ((ecx & (3u << 27)) != (3u << 27))
+			return false;
+		if (!image_is_ymm_enabled())
+			return false;
+
+		/* CPUID.(7,0):EBX.AVX2[bit 5] */
+		image_cpuid(7, &ebx, &ecx, &edx);
+		return (ebx & (1u << 5)) != 0;
+#endif
+#if defined(ARCH_ARM64)
+	case IMAGE_LEVEL_NEON:
+#if defined(__linux__)
+		return (getauxval(AT_HWCAP) & HWCAP_ASIMD) != 0;
+#else
+		/* Always available on AArch64. */
+		return true;
+#endif
+#endif
+	default:
+		break;
+	}
+
+	return false;
+}
+
+/* Fill the dispatch table. */
+static void image_set_level(int level)
+{
+	switch (level) {
+#if defined(ARCH_X86) || defined(ARCH_X86_64)
+	case IMAGE_LEVEL_SSE2:
+		kernels.alpha_row = image_alpha_row_sse2;
+		kernels.add_row = image_add_row_sse2;
+		kernels.sub_row = image_sub_row_sse2;
+		kernels.alpha_pm_row = image_alpha_pm_row_sse2;
+		kernels.alpha_pm_opaque_row = image_alpha_pm_opaque_row_sse2;
+		kernels.add_pm_row = image_add_pm_row_sse2;
+		kernels.sub_pm_row = image_sub_pm_row_sse2;
+		kernels.lerp_row = image_lerp_row_sse2;
+		kernels.bilinear_row = image_bilinear_row_sse2;
+		kernels.affine_bilinear_row = image_affine_bilinear_row_sse2;
+		kernels.expand_rgb_row = image_expand_rgb_row_c;
+		kernels.expand_bgr_row = image_expand_bgr_row_c;
+		kernels.rule_row = image_rule_row_sse2;
+		kernels.rule_pm_row = image_rule_pm_row_sse2;
+		kernels.composite_row = image_composite_row_sse2;
+		kernels.composite_pm_row = image_composite_pm_row_sse2;
+		break;
+	case IMAGE_LEVEL_AVX2:
+		kernels.alpha_row = image_alpha_row_avx2;
+		kernels.add_row = image_add_row_avx2;
+		kernels.sub_row = image_sub_row_avx2;
+		kernels.alpha_pm_row = image_alpha_pm_row_avx2;
+		kernels.alpha_pm_opaque_row = image_alpha_pm_opaque_row_avx2;
+		kernels.add_pm_row = image_add_pm_row_avx2;
+		kernels.sub_pm_row = image_sub_pm_row_avx2;
+		kernels.lerp_row = image_lerp_row_avx2;
+		kernels.bilinear_row = image_bilinear_row_sse2;
+		kernels.affine_bilinear_row = image_affine_bilinear_row_sse2;
+		kernels.expand_rgb_row = image_expand_rgb_row_avx2;
+		kernels.expand_bgr_row = image_expand_bgr_row_avx2;
+		kernels.rule_row = image_rule_row_avx2;
+		kernels.rule_pm_row = image_rule_pm_row_avx2;
+		kernels.composite_row = image_composite_row_avx2;
+		kernels.composite_pm_row = image_composite_pm_row_avx2;
+		break;
+#endif
+#if defined(ARCH_ARM64)
+	case IMAGE_LEVEL_NEON:
+		kernels.alpha_row = image_alpha_row_neon;
+		kernels.add_row = image_add_row_neon;
+		kernels.sub_row = image_sub_row_neon;
+		kernels.alpha_pm_row = image_alpha_pm_row_neon;
+		kernels.alpha_pm_opaque_row = image_alpha_pm_opaque_row_neon;
+		kernels.add_pm_row = image_add_pm_row_neon;
+		kernels.sub_pm_row = image_sub_pm_row_neon;
+		kernels.lerp_row = image_lerp_row_neon;
+		kernels.bilinear_row = image_bilinear_row_neon;
+		kernels.affine_bilinear_row = image_affine_bilinear_row_neon;
+		kernels.expand_rgb_row = image_expand_rgb_row_neon;
+		kernels.expand_bgr_row = image_expand_bgr_row_neon;
+		kernels.rule_row = image_rule_row_neon;
+		kernels.rule_pm_row = image_rule_pm_row_neon;
+		kernels.composite_row = image_composite_row_neon;
+		kernels.composite_pm_row = image_composite_pm_row_neon;
+		break;
+#endif
+	default:
+		level = IMAGE_LEVEL_C;
+		kernels.alpha_row = image_alpha_row_c;
+		kernels.add_row = image_add_row_c;
+		kernels.sub_row = image_sub_row_c;
+		kernels.alpha_pm_row = image_alpha_pm_row_c;
+		kernels.alpha_pm_opaque_row = image_alpha_pm_opaque_row_c;
+		kernels.add_pm_row = image_add_pm_row_c;
+		kernels.sub_pm_row = image_sub_pm_row_c;
+		kernels.lerp_row = image_lerp_row_c;
+		kernels.bilinear_row = image_bilinear_row_c;
+		kernels.affine_bilinear_row = image_affine_bilinear_row_c;
+		kernels.expand_rgb_row = image_expand_rgb_row_c;
+		kernels.expand_bgr_row = image_expand_bgr_row_c;
+		kernels.rule_row = image_rule_row_c;
+		kernels.rule_pm_row = image_rule_pm_row_c;
+		kernels.composite_row = image_composite_row_c;
+		kernels.composite_pm_row = image_composite_pm_row_c;
+		break;
+	}
+
+	image_level = level;
+}
+
+/*
+ * Get the name of the kernel level in use.
+ */
+const char *image_get_simd_level(void)
+{
+	return level_name[image_level];
+}
+
+/*
+ * Create an image.
+ */
+bool image_create(int w, int h, struct image **ret)
+{
+	struct image *img;
+	size_t size;
+	int cls;
+
+	assert(w > 0 && h > 0);
+
+	cls = image_size_class((size_t)w * (size_t)h * sizeof(pixel_t), &size);
+
+	/* Reuse a pooled image of the size class. */
+	img = image_pool_get(cls);
+	if (img == NULL) {
+		/* Allocate a memory for a struct image. */
+		img = malloc(sizeof(struct image));
+		if (img == NULL) {
+			sys_out_of_memory();
+			return false;
+		}
+
+		/* Allocate a pixel buffer. */
+		img->pixels = image_alloc_buffer(size);
+		if (img->pixels == NULL) {
+			sys_out_of_memory();
+			free(img);
+			return false;
+		}
+		img->buffer_size = size;
+	}
+
+	/* Setup members */
+	img->width = w;
+	img->height = h;
+	img->stride = w;
+	img->is_premultiplied = false;
+	img->parent = NULL;
+	img->parent_x = 0;
+	img->parent_y = 0;
+
+	/* The whole image is yet to be uploaded. */
+	img->dirty[0].x = 0;
+	img->dirty[0].y = 0;
+	img->dirty[0].w = w;
+	img->dirty[0].h = h;
+	img->dirty_count = 1;
+	img->next_free = NULL;
+	img->map = NULL;
+	img->map_size = 0;
+	img->entry = NULL;
+
+	*ret = img;
+	return true;
+}
+
+/*
+ * Create a view of a rectangle of an image.
+ */
+bool image_create_view(struct image *parent, int x, int y, int w, int h, struct image **ret)
+{
+	struct image *img;
+
+	assert(parent != NULL);
+	assert(parent->pixels != NULL);
+	assert(w > 0 && h > 0);
+
+	/* Check the rectangle. */
+	if (x < 0 || y < 0 || x + w > parent->width || y + h > parent->height) {
+		sys_error("View rectangle out of range.");
+		return false;
+	}
+
+	/* Allocate a memory for a struct image. */
+	img = malloc(sizeof(struct image));
+	if (img == NULL) {
+		sys_out_of_memory();
+		return false;
+	}
+
+	/* Alias the pixels of the parent. */
+	img->width = w;
+	img->height = h;
+	img->stride = parent->stride;
+	img->pixels = parent->pixels + parent->stride * y + x;
+	img->is_premultiplied = false;
+	img->parent = parent;
+	img->parent_x = x;
+	img->parent_y = y;
+	img->dirty_count = 0;
+	img->buffer_size = 0;
+	img->next_free = NULL;
+	img->map = NULL;
+	img->map_size = 0;
+	img->entry = NULL;
+
+	*ret = img;
+	return true;
+}
+
+/*
+ * Destroy an image.
+ */
+void image_destroy(struct image *img)
+{
+	assert(img != NULL);
+	assert(img->width > 0 && img->height > 0);
+	assert(img->pixels != NULL);
+	assert(img->entry == NULL);	/* Use image_release() for a shared image. */
+
+	/* Keep the image with the pixel buffer in the pool if we can. */
+	if (img->parent == NULL && img->map == NULL && image_pool_put(img))
+		return;
+
+	image_free_image(img);
+}
+
+/*
+ * Set the limit of the bytes kept in the image pool.
+ */
+void image_set_pool_limit(size_t bytes)
+{
+#ifdef USE_THREADS
+	pthread_mutex_lock(&free_mutex);
+#endif
+	free_limit = bytes;
+#ifdef USE_THREADS
+	pthread_mutex_unlock(&free_mutex);
+#endif
+
+	image_trim_pool(bytes);
+}
+
+/*
+ * Free pooled images, from the largest class, until the pool has at most
+ * the specified bytes.
+ */
+void image_trim_pool(size_t bytes)
+{
+	struct image *list, *img;
+	int cls;
+
+	/* Take images out of the pool. */
+	list = NULL;
+#ifdef USE_THREADS
+	pthread_mutex_lock(&free_mutex);
+#endif
+	for (cls = POOL_CLASS_COUNT - 1; cls >= 0 && free_bytes > bytes; cls--) {
+		while (free_list[cls] != NULL && free_bytes > bytes) {
+			img = free_list[cls];
+			free_list[cls] = img->next_free;
+			free_bytes -= img->buffer_size;
+			img->next_free = list;
+			list = img;
+		}
+	}
+#ifdef USE_THREADS
+	pthread_mutex_unlock(&free_mutex);
+#endif
+
+	/* Free them outside of the lock. */
+	while (list != NULL) {
+		img = list;
+		list = img->next_free;
+		image_free_image(img);
+	}
+}
+
+/*
+ * Get the pooled bytes.
+ */
+size_t image_get_pool_size(void)
+{
+	size_t bytes;
+
+#ifdef USE_THREADS
+	pthread_mutex_lock(&free_mutex);
+#endif
+	bytes = free_bytes;
+#ifdef USE_THREADS
+	pthread_mutex_unlock(&free_mutex);
+#endif
+
+	return bytes;
+}
+
+/* Get the size class of a buffer size and round up the size to it. */
+static int image_size_class(size_t size, size_t *class_size)
+{
+	size_t n;
+	int msb, shift;
+
+	if (size < ALIGN_BYTES)
+		size = ALIGN_BYTES;
+
+	/* Find the most significant bit of (size - 1). */
+	msb = 0;
+	while (((size - 1) >> msb) > 1)
+		msb++;
+
+	/* Keep the top three bits and round up, making four steps per octave. */
+	shift = msb - 2;
+	n = ((size - 1) >> shift) + 1;
+	assert(n >= 5 && n <= 8);
+
+	*class_size = n << shift;
+	return shift * 4 + (int)(n - 5);
+}
+
+/* Take a pooled image of a size class. */
+static struct image *image_pool_get(int cls)
+{
+	struct image *img;
+
+	assert(cls >= 0 && cls < POOL_CLASS_COUNT);
+
+#ifdef USE_THREADS
+	pthread_mutex_lock(&free_mutex);
+#endif
+	img = free_list[cls];
+	if (img != NULL) {
+		free_list[cls] = img->next_free;
+		free_bytes -= img->buffer_size;
+	}
+#ifdef USE_THREADS
+	pthread_mutex_unlock(&free_mutex);
+#endif
+
+	return img;
+}
+
+/* Put an image to the pool unless the pool is full. */
+static bool image_pool_put(struct image *img)
+{
+	size_t size;
+	int cls;
+	bool is_kept;
+
+	cls = image_size_class(img->buffer_size, &size);
+	assert(size == img->buffer_size);
+
+	is_kept = false;
+#ifdef USE_THREADS
+	pthread_mutex_lock(&free_mutex);
+#endif
+	if (free_bytes + img->buffer_size <= free_limit) {
+		img->next_free = free_list[cls];
+		free_list[cls] = img;
+		free_bytes += img->buffer_size;
+		is_kept = true;
+	}
+#ifdef USE_THREADS
+	pthread_mutex_unlock(&free_mutex);
+#endif
+
+	return is_kept;
+}
+
+/* Allocate an aligned pixel buffer. */
+static pixel_t *image_alloc_buffer(size_t size)
+{
+	pixel_t *pixels;
+
+#if defined(TARGET_WINDOWS)
+	pixels = _aligned_malloc(size, ALIGN_BYTES);
+#else
+	if (posix_memalign((void **)&pixels, ALIGN_BYTES, size) != 0)
+		pixels = NULL;
+#endif
+
+	return pixels;
+}
+
+/* Free an aligned pixel buffer. */
+static void image_free_buffer(pixel_t *pixels)
+{
+#if defined(TARGET_WINDOWS)
+	_aligned_free(pixels);
+#else
+	free(pixels);
+#endif
+}
+
+/* Free an image and the pixel buffer unless it is borrowed. */
+static void image_free_image(struct image *img)
+{
+#ifdef USE_MMAP
+	if (img->map != NULL)
+		munmap(img->map, img->map_size);
+	else
+#endif
+	if (img->parent == NULL)
+		image_free_buffer(img->pixels);
+	img->pixels = NULL;
+
+	free(img);
+}
+
+/*
+ * Get an image width.
+ */
+int image_get_width(struct image *img)
+{
+	assert(img != NULL);
+
+	return img->width;
+}
+
+/*
+ * Get an image height.
+ */
+int image_get_height(struct image *img)
+{
+	assert(img != NULL);
+
+	return img->height;
+}
+
+/*
+ * Get an image stride in pixels.
+ */
+int image_get_stride(struct image *img)
+{
+	assert(img != NULL);
+
+	return img->stride;
+}
+
+/*
+ * Get image pixels.
+ */
+pixel_t *image_get_pixels(struct image *img)
+{
+	assert(img != NULL);
+
+	return img->pixels;
+}
+
+/*
+ * Check if image pixels are premultiplied by alpha.
+ */
+bool image_is_premultiplied(struct image *img)
+{
+	assert(img != NULL);
+
+	return image_get_root(img)->is_premultiplied;
+}
+
+/*
+ * Mark image pixels as premultiplied or straight, without a conversion.
+ */
+void image_set_premultiplied(struct image *img, bool is_premultiplied)
+{
+	assert(img != NULL);
+
+	image_get_root(img)->is_premultiplied = is_premultiplied;
+}
+
+/*
+ * Premultiply image pixels by alpha.
+ */
+void image_premultiply(struct image *img)
+{
+	assert(img != NULL);
+
+	/* A view shares the pixels, so convert all of them. */
+	img = image_get_root(img);
+	if (img->is_premultiplied)
+		return;
+
+	image_premultiply_rows(img, 0, img->height);
+
+	img->is_premultiplied = true;
+
+	image_mark_dirty(img, 0, 0, img->width, img->height);
+}
+
+/* Get the image that owns the pixels of a view. (the image itself if not a view) */
+static struct image *image_get_root(struct image *img)
+{
+	while (img->parent != NULL)
+		img = img->parent;
+	return img;
+}
+
+/* Premultiply rows by alpha. */
+static void image_premultiply_rows(struct image *img, int top, int count)
+{
+	pixel_t *p;
+	int x, y;
+
+	for (y = top; y < top + count; y++) {
+		p = img->pixels + img->stride * y;
+		for (x = 0; x < img->width; x++)
+			p[x] = image_premultiply_pixel(p[x]);
+	}
+}
+
+/*
+ * Add a rectangle to the dirty rectangles.
+ */
+void image_mark_dirty(struct image *img, int x, int y, int w, int h)
+{
+	struct image_rect r, u;
+	int i, j, best, grow, best_grow;
+
+	assert(img != NULL);
+
+	/* Clip. */
+	if (x < 0) {
+		w += x;
+		x = 0;
+	}
+	if (y < 0) {
+		h += y;
+		y = 0;
+	}
+	if (x + w > img->width)
+		w = img->width - x;
+	if (y + h > img->height)
+		h = img->height - y;
+	if (w <= 0 || h <= 0)
+		return;
+
+	/* A view also changes its parent. */
+	if (img->parent != NULL)
+		image_mark_dirty(img->parent, img->parent_x + x, img->parent_y + y, w, h);
+
+	r.x = x;
+	r.y = y;
+	r.w = w;
+	r.h = h;
+
+	/* Merge with rectangles that don't grow by the merge. */
+	for (i = 0; i < img->dirty_count; i++) {
+		u = image_union_rect(&img->dirty[i], &r);
+		if (u.w * u.h > img->dirty[i].w * img->dirty[i].h + r.w * r.h)
+			continue;
+
+		/* Take the rectangle out and retry with the union. */
+		r = u;
+		img->dirty[i] = img->dirty[--img->dirty_count];
+		i = -1;
+	}
+
+	/* Append if we have a room. */
+	if (img->dirty_count < DIRTY_MAX) {
+		img->dirty[img->dirty_count++] = r;
+		return;
+	}
+
+	/* Otherwise, merge into the one that grows the least. */
+	best = 0;
+	best_grow = 0;
+	for (j = 0; j < img->dirty_count; j++) {
+		u = image_union_rect(&img->dirty[j], &r);
+		grow = u.w * u.h - img->dirty[j].w * img->dirty[j].h;
+		if (j == 0 || grow < best_grow) {
+			best = j;
+			best_grow = grow;
+		}
+	}
+	img->dirty[best] = image_union_rect(&img->dirty[best], &r);
+}
+
+/* Get the bounding rectangle of two rectangles. */
+static struct image_rect image_union_rect(const struct image_rect *a, const struct image_rect *b)
+{
+	struct image_rect u;
+
+	u.x = a->x < b->x ? a->x : b->x;
+	u.y = a->y < b->y ? a->y : b->y;
+	u.w = (a->x + a->w > b->x + b->w ? a->x + a->w : b->x + b->w) - u.x;
+	u.h = (a->y + a->h > b->y + b->h ? a->y + a->h : b->y + b->h) - u.y;
+
+	return u;
+}
+
+/*
+ * Get the dirty rectangles.
+ */
+int image_get_dirty_rects(struct image *img, const struct image_rect **rects)
+{
+	assert(img != NULL);
+	assert(rects != NULL);
+
+	*rects = img->dirty;
+
+	return img->dirty_count;
+}
+
+/*
+ * Forget the dirty rectangles after an upload.
+ */
+void image_clear_dirty(struct image *img)
+{
+	assert(img != NULL);
+
+	img->dirty_count = 0;
+}
+
+/*
+ * Clear an image with a uniform color.
+ */
+void image_clear(struct image *img, pixel_t color)
+{
+	image_clear_rect(img, 0, 0, img->width, img->height, color);
+}
+
+/*
+ * Clear an image rectangle with a uniform color.
+ */
+void image_clear_rect(struct image *img, int x, int y, int w, int h, pixel_t color)
+{
+	struct image_fill fill;
+	int sx, sy;
+
+	assert(img != NULL);
+	assert(img->width > 0 && img->height > 0);
+	assert(img->pixels != NULL);
+
+	/* Check if we have to draw. */
+	if(w == 0 || h == 0)
+		return;
+	sx = sy = 0;
+	if(!image_clip_by_dest(img->width, img->height, &w, &h, &x, &y, &sx, &sy))
+		return;
+
+	assert(x >= 0 && x < img->width);
+	assert(w >= 0 && x + w <= img->width);
+	assert(y >= 0 && y < img->height);
+	assert(h >= 0 && y + h <= img->height);
+
+	/* Fill pixels. */
+	fill.dst = img->pixels + img->stride * y + x;
+	fill.pitch = img->stride;
+	fill.width = w;
+	fill.color = color;
+	image_mark_dirty(img, x, y, w, h);
+	image_run_bands(image_fill_band, &fill, w, h);
+}
+
+/* Fill rows of a band. */
+static void image_fill_band(void *arg, int band, int top, int bottom)
+{
+	struct image_fill *fill;
+	pixel_t *p;
+	int x, y;
+
+	UNUSED_PARAMETER(band);
+
+	fill = arg;
+	for (y = top; y < bottom; y++) {
+		p = fill->dst + fill->pitch * y;
+		for (x = 0; x < fill->width; x++)
+			p[x] = fill->color;
+	}
+}
+
+/*
+ * Draw an image on an image. (copy)
+ */
+void image_draw_copy(struct image *dst_image, int dst_left, int dst_top,
+		     struct image *src_image, int width, int height, int src_left,
+		     int src_top)
+{
+	image_draw_rows(dst_image, dst_left, dst_top, src_image, width, height, src_left, src_top, 255, image_copy_row, image_copy_row);
+}
+
+/*
+ * Draw an image on an image. (alpha-blending, dst_alpha=255)
+ */
+void image_draw_alpha(struct image *dst_image, int dst_left, int dst_top,
+		      struct image *src_image, int width, int height,
+		      int src_left, int src_top, int alpha)
+{
+	image_draw_rows(dst_image, dst_left, dst_top, src_image, width, height, src_left, src_top, alpha, kernels.alpha_row, alpha == 255 ? kernels.alpha_pm_opaque_row : kernels.alpha_pm_row);
+}
+
+/*
+ * Draw an image on an image. (add-blending)
+ */
+void image_draw_add(struct image *dst_image, int dst_left, int dst_top,
+		    struct image *src_image, int width, int height,
+		    int src_left, int src_top, int alpha)
+{
+	image_draw_rows(dst_image, dst_left, dst_top, src_image, width, height, src_left, src_top, alpha, kernels.add_row, kernels.add_pm_row);
+}
+
+/*
+ * Draw an image on an image. (sub-blending)
+ */
+void image_draw_sub(struct image *dst_image, int dst_left, int dst_top,
+		    struct image *src_image, int width, int height,
+		    int src_left, int src_top, int alpha)
+{
+	image_draw_rows(dst_image, dst_left, dst_top, src_image, width, height, src_left, src_top, alpha, kernels.sub_row, kernels.sub_pm_row);
+}
+
+/* Draw an image on an image with a row kernel. */
+static void image_draw_rows(struct image *dst_image, int dst_left, int dst_top,
+			    struct image *src_image, int width, int height,
+			    int src_left, int src_top, int alpha,
+			    image_row_func row, image_row_func pm_row)
+{
+	struct image_blit blit;
+
+	if (!image_check_draw(dst_image, &dst_left, &dst_top, src_image, &width, &height, &src_left, &src_top, alpha))
+		return;
+
+	blit.src_pitch = src_image->stride;
+	blit.dst_pitch = dst_image->stride;
+	blit.src = src_image->pixels + blit.src_pitch * src_top + src_left;
+	blit.dst = dst_image->pixels + blit.dst_pitch * dst_top + dst_left;
+	blit.width = width;
+	blit.alpha = (uint32_t)alpha;
+	blit.row = image_is_premultiplied(src_image) ? pm_row : row;
+
+	image_mark_dirty(dst_image, dst_left, dst_top, width, height);
+	image_run_bands(image_blit_band, &blit, width, height);
+}
+
+/* Draw rows of a band. */
+static void image_blit_band(void *arg, int band, int top, int bottom)
+{
+	struct image_blit *blit;
+	int y;
+
+	UNUSED_PARAMETER(band);
+
+	blit = arg;
+	for (y = top; y < bottom; y++) {
+		blit->row(blit->dst + blit->dst_pitch * y,
+			  blit->src + blit->src_pitch * y,
+			  blit->width,
+			  blit->alpha);
+	}
+}
+
+/*
+ * Draw an image on an image through a rule image. (alpha-blending, dst_alpha=255)
+ */
+void image_draw_rule(struct image *dst_image, int dst_left, int dst_top,
+		     struct image *src_image, int width, int height,
+		     int src_left, int src_top, struct image *rule_image,
+		     int threshold, int softness)
+{
+	struct image_rule rl;
+
+	assert(rule_image != NULL);
+	assert(rule_image->width >= dst_image->width);
+	assert(rule_image->height >= dst_image->height);
+	assert(threshold >= 0 && threshold <= 255);
+	assert(softness >= 0 && softness <= 255);
+
+	/* Nothing or everything is drawn at the ends. */
+	if (threshold == 0)
+		return;
+	if (threshold == 255) {
+		image_draw_alpha(dst_image, dst_left, dst_top, src_image, width, height, src_left, src_top, 255);
+		return;
+	}
+
+	if (!image_check_draw(dst_image, &dst_left, &dst_top, src_image, &width, &height, &src_left, &src_top, 255))
+		return;
+
+	/*
+	 * The edge sweeps the rule values from 0 to 256 + softness, so that
+	 * the ends draw nothing and everything for any softness.
+	 */
+	rl.limit = (uint32_t)softness + 1;
+	rl.pos = ((uint32_t)threshold * (256 + (uint32_t)softness) + 127) / 255;
+	rl.gain = (255 * 256 + rl.limit - 1) / rl.limit;
+
+	rl.src_pitch = src_image->stride;
+	rl.dst_pitch = dst_image->stride;
+	rl.rule_pitch = rule_image->stride;
+	rl.src = src_image->pixels + rl.src_pitch * src_top + src_left;
+	rl.dst = dst_image->pixels + rl.dst_pitch * dst_top + dst_left;
+	rl.rule = rule_image->pixels + rl.rule_pitch * dst_top + dst_left;
+	rl.width = width;
+	rl.row = image_is_premultiplied(src_image) ? kernels.rule_pm_row : kernels.rule_row;
+
+	image_mark_dirty(dst_image, dst_left, dst_top, width, height);
+	image_run_bands(image_rule_band, &rl, width, height);
+}
+
+/* Draw rows of a band through a rule image. */
+static void image_rule_band(void *arg, int band, int top, int bottom)
+{
+	struct image_rule *rl;
+	int y;
+
+	UNUSED_PARAMETER(band);
+
+	rl = arg;
+	for (y = top; y < bottom; y++) {
+		rl->row(rl->dst + rl->dst_pitch * y,
+			rl->src + rl->src_pitch * y,
+			rl->rule + rl->rule_pitch * y,
+			rl->width,
+			rl->pos,
+			rl->limit,
+			rl->gain);
+	}
+}
+
+/*
+ * Composite an image on a premultiplied image by a Porter-Duff operator.
+ */
+void image_draw_composite(struct image *dst_image, int dst_left, int dst_top,
+			  struct image *src_image, int width, int height,
+			  int src_left, int src_top, int alpha, int op)
+{
+	struct image_composite cp;
+
+	assert(op >= 0 && op < (int)(sizeof(pd_table) / sizeof(pd_table[0])));
+	assert(alpha >= 0 && alpha <= 255);
+	assert(image_is_premultiplied(dst_image));
+
+	/* The destination is kept as is. */
+	if (op == IMAGE_COMPOSITE_DST)
+		return;
+
+	/* An alpha of zero still clears with some operators, so don't skip. */
+	if (!image_check_draw(dst_image, &dst_left, &dst_top, src_image, &width, &height, &src_left, &src_top, 255))
+		return;
+
+	cp.src_pitch = src_image->stride;
+	cp.dst_pitch = dst_image->stride;
+	cp.src = src_image->pixels + cp.src_pitch * src_top + src_left;
+	cp.dst = dst_image->pixels + cp.dst_pitch * dst_top + dst_left;
+	cp.width = width;
+	cp.alpha = (uint32_t)alpha;
+	cp.pd = &pd_table[op];
+	cp.row = image_is_premultiplied(src_image) ? kernels.composite_pm_row : kernels.composite_row;
+
+	image_mark_dirty(dst_image, dst_left, dst_top, width, height);
+	image_run_bands(image_composite_band, &cp, width, height);
+}
+
+/* Composite rows of a band. */
+static void image_composite_band(void *arg, int band, int top, int bottom)
+{
+	struct image_composite *cp;
+	int y;
+
+	UNUSED_PARAMETER(band);
+
+	cp = arg;
+	for (y = top; y < bottom; y++) {
+		cp->row(cp->dst + cp->dst_pitch * y,
+			cp->src + cp->src_pitch * y,
+			cp->width,
+			cp->alpha,
+			cp->pd);
+	}
+}
+
+/*
+ * Draw a crossfade of two images on an image.
+ */
+void image_draw_crossfade(struct image *dst_image, struct image *a_image,
+			  struct image *b_image, int t)
+{
+	struct image_crossfade cf;
+	int width, height;
+
+	assert(dst_image != NULL);
+	assert(a_image != NULL);
+	assert(b_image != NULL);
+	assert(dst_image != a_image && dst_image != b_image);
+	assert(dst_image->pixels != NULL);
+	assert(a_image->pixels != NULL);
+	assert(b_image->pixels != NULL);
+	assert(image_is_premultiplied(a_image) == image_is_premultiplied(b_image));
+	assert(t >= 0 && t <= 255);
+
+	/* The area common to the three images. */
+	width = dst_image->width;
+	if (a_image->width < width)
+		width = a_image->width;
+	if (b_image->width < width)
+		width = b_image->width;
+	height = dst_image->height;
+	if (a_image->height < height)
+		height = a_image->height;
+	if (b_image->height < height)
+		height = b_image->height;
+
+	cf.dst_pitch = dst_image->stride;
+	cf.a_pitch = a_image->stride;
+	cf.b_pitch = b_image->stride;
+	cf.dst = dst_image->pixels;
+	cf.a = a_image->pixels;
+	cf.b = b_image->pixels;
+	cf.width = width;
+	cf.w = (uint32_t)t + ((uint32_t)t >> 7);	/* 255 to 256 */
+
+	image_mark_dirty(dst_image, 0, 0, width, height);
+	image_run_bands(image_crossfade_band, &cf, width, height);
+
+	image_set_premultiplied(dst_image, image_is_premultiplied(a_image));
+}
+
+/* Interpolate rows of a band. */
+static void image_crossfade_band(void *arg, int band, int top, int bottom)
+{
+	struct image_crossfade *cf;
+	int y;
+
+	UNUSED_PARAMETER(band);
+
+	cf = arg;
+	for (y = top; y < bottom; y++) {
+		kernels.lerp_row(cf->dst + cf->dst_pitch * y,
+				 cf->a + cf->a_pitch * y,
+				 cf->b + cf->b_pitch * y,
+				 cf->width,
+				 cf->w);
+	}
+}
+
+/* Copy a row. */
+static void image_copy_row(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	UNUSED_PARAMETER(alpha);
+
+	memcpy(dst, src, (size_t)width * sizeof(pixel_t));
+}
+
+/*
+ * Draw a scaled image on an image. (alpha-blending, dst_alpha=255)
+ */
+void image_draw_scaled(struct image *dst_image, int dst_left, int dst_top,
+		       int dst_width, int dst_height, struct image *src_image,
+		       int src_left, int src_top, int src_width, int src_height,
+		       int alpha, int mode)
+{
+	struct image_scale sc;
+	int64_t half;
+	int ox, oy, bands;
+
+	assert(dst_image != NULL);
+	assert(dst_image != src_image);
+	assert(src_image != NULL);
+	assert(mode == IMAGE_SCALE_NEAREST || mode == IMAGE_SCALE_BILINEAR);
+	assert(src_left >= 0 && src_width >= 0 && src_left + src_width <= src_image->width);
+	assert(src_top >= 0 && src_height >= 0 && src_top + src_height <= src_image->height);
+
+	/* Return if no need for a draw. */
+	if (alpha == 0 || dst_width <= 0 || dst_height <= 0 || src_width == 0 || src_height == 0)
+		return;
+
+	/* Get the 16.16 steps from the whole rectangle. */
+	sc.step_x = (int32_t)(((int64_t)src_width << 16) / dst_width);
+	sc.step_y = (int32_t)(((int64_t)src_height << 16) / dst_height);
+
+	/* Clip by the destination, and get the offset into the rectangle. */
+	ox = oy = 0;
+	if (!image_clip_by_dest(dst_image->width, dst_image->height, &dst_width, &dst_height, &dst_left, &dst_top, &ox, &oy))
+		return;
+
+	/* Map the pixel centers. (bilinear samples from the top-left neighbor) */
+	half = mode == IMAGE_SCALE_BILINEAR ? 32768 : 0;
+	sc.fx = (int32_t)((int64_t)ox * sc.step_x + sc.step_x / 2 - half);
+	sc.fy = (int32_t)((int64_t)oy * sc.step_y + sc.step_y / 2 - half);
+
+	sc.dst = dst_image->pixels + dst_image->stride * dst_top + dst_left;
+	sc.dst_pitch = dst_image->stride;
+	sc.src = src_image->pixels + src_image->stride * src_top + src_left;
+	sc.src_pitch = src_image->stride;
+	sc.src_width = src_width;
+	sc.src_height = src_height;
+	sc.width = dst_width;
+	sc.alpha = (uint32_t)alpha;
+	sc.mode = mode;
+	if (!image_is_premultiplied(src_image))
+		sc.blend = kernels.alpha_row;
+	else if (alpha == 255)
+		sc.blend = kernels.alpha_pm_opaque_row;
+	else
+		sc.blend = kernels.alpha_pm_row;
+
+	/* Allocate a row, and a padded row of vertical interpolation, for each band. */
+	bands = image_count_bands(dst_width, dst_height);
+	sc.row_size = dst_width + src_width + 1;
+	sc.rows = malloc((size_t)sc.row_size * (size_t)bands * sizeof(pixel_t));
+	if (sc.rows == NULL) {
+		sys_out_of_memory();
+		return;
+	}
+
+	image_mark_dirty(dst_image, dst_left, dst_top, dst_width, dst_height);
+	image_run_bands(image_scale_band, &sc, dst_width, dst_height);
+
+	free(sc.rows);
+}
+
+/* Draw scaled rows of a band. */
+static void image_scale_band(void *arg, int band, int top, int bottom)
+{
+	struct image_scale *sc;
+	pixel_t *row, *vrow;
+	const pixel_t *line;
+	uint32_t w, last_w;
+	int y, sy, last_sy;
+
+	sc = arg;
+	row = sc->rows + (size_t)sc->row_size * (size_t)band;
+	vrow = row + sc->width;
+
+	last_sy = -1;
+	last_w = 0;
+	for (y = top; y < bottom; y++) {
+		if (sc->mode == IMAGE_SCALE_NEAREST) {
+			/* Pick the nearest row and columns. */
+			image_sample_pos(sc->fy + sc->step_y * y, sc->src_height - 1, &sy, &w);
+			line = sc->src + sc->src_pitch * sy;
+			image_nearest_row_c(row, line, sc->width, sc->fx, sc->step_x, sc->src_width - 1);
+		} else {
+			/* Interpolate two rows unless the last result is reusable. */
+			image_sample_pos(sc->fy + sc->step_y * y, sc->src_height - 1, &sy, &w);
+			if (sy != last_sy || w != last_w) {
+				line = sc->src + sc->src_pitch * sy;
+				kernels.lerp_row(vrow, line, w != 0 ? line + sc->src_pitch : line, sc->src_width, w);
+				vrow[sc->src_width] = vrow[sc->src_width - 1];
+				last_sy = sy;
+				last_w = w;
+			}
+
+			/* Interpolate columns. */
+			kernels.bilinear_row(row, vrow, sc->width, sc->fx, sc->step_x, sc->src_width - 1);
+		}
+
+		/* Blend. */
+		sc->blend(sc->dst + sc->dst_pitch * y, row, sc->width, sc->alpha);
+	}
+}
+
+/*
+ * Draw an affine-transformed image on an image. (alpha-blending, dst_alpha=255)
+ */
+void image_draw_affine(struct image *dst_image, struct image *src_image,
+		       int src_left, int src_top, int src_width, int src_height,
+		       const float *matrix, int alpha, int mode)
+{
+	struct image_affine af;
+	double m[6], det, x, y, min_x, max_x, min_y, max_y;
+	int i, left, right, top, bottom, bands;
+
+	assert(dst_image != NULL);
+	assert(dst_image != src_image);
+	assert(src_image != NULL);
+	assert(matrix != NULL);
+	assert(mode == IMAGE_SCALE_NEAREST || mode == IMAGE_SCALE_BILINEAR);
+	assert(src_left >= 0 && src_width >= 0 && src_left + src_width <= src_image->width);
+	assert(src_top >= 0 && src_height >= 0 && src_top + src_height <= src_image->height);
+
+	if (alpha == 0 || src_width == 0 || src_height == 0)
+		return;
+
+	/* Invert the matrix. */
+	for (i = 0; i < 6; i++)
+		m[i] = matrix[i];
+	det = m[0] * m[3] - m[1] * m[2];
+	if (det > -1e-9 && det < 1e-9)
+		return;
+	af.inv[0] = m[3] / det;
+	af.inv[1] = -m[1] / det;
+	af.inv[2] = -m[2] / det;
+	af.inv[3] = m[0] / det;
+	af.inv[4] = -(af.inv[0] * m[4] + af.inv[2] * m[5]);
+	af.inv[5] = -(af.inv[1] * m[4] + af.inv[3] * m[5]);
+
+	/* Get the bounds of the transformed corners. */
+	min_x = max_x = m[4];
+	min_y = max_y = m[5];
+	for (i = 1; i < 4; i++) {
+		x = (i & 1) ? src_width : 0;
+		y = (i & 2) ? src_height : 0;
+		det = m[0] * x + m[2] * y + m[4];
+		y = m[1] * x + m[3] * y + m[5];
+		x = det;
+		if (x < min_x)
+			min_x = x;
+		if (x > max_x)
+			max_x = x;
+		if (y < min_y)
+			min_y = y;
+		if (y > max_y)
+			max_y = y;
+	}
+	left = min_x < 0 ? 0 : (int)min_x;
+	right = max_x > dst_image->width ? dst_image->width : (int)max_x + 1;
+	top = min_y < 0 ? 0 : (int)min_y;
+	bottom = max_y > dst_image->height ? dst_image->height : (int)max_y + 1;
+	if (left >= right || top >= bottom)
+		return;
+
+	af.dst = dst_image->pixels;
+	af.dst_pitch = dst_image->stride;
+	af.dst_width = dst_image->width;
+	af.src = src_image->pixels + src_image->stride * src_top + src_left;
+	af.src_pitch = src_image->stride;
+	af.src_width = src_width;
+	af.src_height = src_height;
+	af.top = top;
+	af.alpha = (uint32_t)alpha;
+	af.mode = mode;
+	if (!image_is_premultiplied(src_image))
+		af.blend = kernels.alpha_row;
+	else if (alpha == 255)
+		af.blend = kernels.alpha_pm_opaque_row;
+	else
+		af.blend = kernels.alpha_pm_row;
+
+	/* Allocate a row for each band. */
+	bands = image_count_bands(dst_image->width, bottom - top);
+	af.rows = malloc((size_t)dst_image->width * (size_t)bands * sizeof(pixel_t));
+	if (af.rows == NULL) {
+		sys_out_of_memory();
+		return;
+	}
+
+	image_mark_dirty(dst_image, left, top, right - left, bottom - top);
+	image_run_bands(image_affine_band, &af, dst_image->width, bottom - top);
+
+	free(af.rows);
+}
+
+/* Draw affine-transformed rows of a band. */
+static void image_affine_band(void *arg, int band, int top, int bottom)
+{
+	struct image_affine *af;
+	pixel_t *row;
+	double u, v, half;
+	int y, left, right, l, r;
+
+	af = arg;
+	row = af->rows + (size_t)af->dst_width * (size_t)band;
+
+	/* Bilinear samples from the top-left neighbor. */
+	half = af->mode == IMAGE_SCALE_BILINEAR ? 0.5 : 0;
+
+	for (y = af->top + top; y < af->top + bottom; y++) {
+		/* Map the center of the first pixel of the row. */
+		u = af->inv[0] * 0.5 + af->inv[2] * (y + 0.5) + af->inv[4];
+		v = af->inv[1] * 0.5 + af->inv[3] * (y + 0.5) + af->inv[5];
+
+		/* Get the span where the source is inside its rectangle. */
+		if (!image_affine_span(u, af->inv[0], af->src_width, af->dst_width, &left, &right))
+			continue;
+		if (!image_affine_span(v, af->inv[1], af->src_height, af->dst_width, &l, &r))
+			continue;
+		if (l > left)
+			left = l;
+		if (r < right)
+			right = r;
+		if (left >= right)
+			continue;
+
+		/* Walk the span by 16.16 steps. */
+		u += af->inv[0] * left - half;
+		v += af->inv[1] * left - half;
+		if (af->mode == IMAGE_SCALE_NEAREST) {
+			image_affine_nearest_row_c(row, af->src, af->src_pitch, right - left,
+						   (int32_t)(u * 65536.0), (int32_t)(v * 65536.0),
+						   (int32_t)(af->inv[0] * 65536.0), (int32_t)(af->inv[1] * 65536.0),
+						   af->src_width - 1, af->src_height - 1);
+		} else {
+			kernels.affine_bilinear_row(row, af->src, af->src_pitch, right - left,
+						    (int32_t)(u * 65536.0), (int32_t)(v * 65536.0),
+						    (int32_t)(af->inv[0] * 65536.0), (int32_t)(af->inv[1] * 65536.0),
+						    af->src_width - 1, af->src_height - 1);
+		}
+
+		/* Blend. */
+		af->blend(af->dst + af->dst_pitch * y + left, row, right - left, af->alpha);
+	}
+}
+
+/* Get the pixels [left, right) of a row where 0 <= u0 + du * x < limit. */
+static bool image_affine_span(double u0, double du, double limit, int width, int *left, int *right)
+{
+	double a, b, t;
+
+	if (du > -1e-12 && du < 1e-12) {
+		/* Constant along the row. */
+		if (u0 < 0 || u0 >= limit)
+			return false;
+		*left = 0;
+		*right = width;
+		return true;
+	}
+
+	/* Solve for the two ends. */
+	a = (0 - u0) / du;
+	b = (limit - u0) / du;
+	if (a > b) {
+		t = a;
+		a = b;
+		b = t;
+	}
+	if (b <= 0 || a >= width)
+		return false;
+
+	*left = a <= 0 ? 0 : (int)ceil(a);
+	*right = b >= width ? width : (int)ceil(b);
+
+	return *left < *right;
+}
+
+/*
+ * Scalar row kernels. (also used for the tails of SIMD rows)
+ */
+
+/* Alpha-blend a row. */
+void image_alpha_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	int x;
+
+	for (x = 0; x < width; x++)
+		dst[x] = image_alpha_pixel(dst[x], src[x], alpha);
+}
+
+/* Add-blend a row. */
+void image_add_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	int x;
+
+	for (x = 0; x < width; x++)
+		dst[x] = image_add_pixel(dst[x], src[x], alpha);
+}
+
+/* Sub-blend a row. */
+void image_sub_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	int x;
+
+	for (x = 0; x < width; x++)
+		dst[x] = image_sub_pixel(dst[x], src[x], alpha);
+}
+
+/* Alpha-blend a row of premultiplied pixels. */
+void image_alpha_pm_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	int x;
+
+	for (x = 0; x < width; x++)
+		dst[x] = image_alpha_pm_pixel(dst[x], src[x], alpha);
+}
+
+/* Alpha-blend a row of premultiplied pixels at alpha=255. */
+void image_alpha_pm_opaque_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	int x;
+
+	UNUSED_PARAMETER(alpha);
+
+	for (x = 0; x < width; x++)
+		dst[x] = image_alpha_pm_opaque_pixel(dst[x], src[x]);
+}
+
+/* Add-blend a row of premultiplied pixels. */
+void image_add_pm_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	int x;
+
+	for (x = 0; x < width; x++)
+		dst[x] = image_add_pm_pixel(dst[x], src[x], alpha);
+}
+
+/* Sub-blend a row of premultiplied pixels. */
+void image_sub_pm_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	int x;
+
+	for (x = 0; x < width; x++)
+		dst[x] = image_sub_pm_pixel(dst[x], src[x], alpha);
+}
+
+/* Interpolate two rows. */
+void image_lerp_row_c(pixel_t * RESTRICT dst, const pixel_t *a, const pixel_t *b, int width, uint32_t w)
+{
+	int x;
+
+	for (x = 0; x < width; x++)
+		dst[x] = image_lerp_pixel(a[x], b[x], w);
+}
+
+/* Resample a row with bilinear filtering. */
+void image_bilinear_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, int32_t fx, int32_t step, int max_x)
+{
+	uint32_t w;
+	int x, i;
+
+	for (x = 0; x < width; x++) {
+		image_sample_pos(fx, max_x, &i, &w);
+		fx += step;
+		dst[x] = image_lerp_pixel(src[i], src[i + 1], w);
+	}
+}
+
+/* Sample a row along a line with the nearest neighbors. */
+void image_affine_nearest_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int pitch, int width, int32_t fu, int32_t fv, int32_t du, int32_t dv, int max_u, int max_v)
+{
+	uint32_t w;
+	int x, i, j;
+
+	for (x = 0; x < width; x++) {
+		image_sample_pos(fu, max_u, &i, &w);
+		image_sample_pos(fv, max_v, &j, &w);
+		fu += du;
+		fv += dv;
+		dst[x] = src[pitch * j + i];
+	}
+}
+
+/* Sample a row along a line with bilinear filtering. */
+void image_affine_bilinear_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int pitch, int width, int32_t fu, int32_t fv, int32_t du, int32_t dv, int max_u, int max_v)
+{
+	uint32_t wx, wy;
+	int x, i, j;
+
+	for (x = 0; x < width; x++) {
+		image_sample_pos(fu, max_u, &i, &wx);
+		image_sample_pos(fv, max_v, &j, &wy);
+		fu += du;
+		fv += dv;
+		dst[x] = image_bilinear_pixel(src, pitch, i, wx, j, wy);
+	}
+}
+
+/* Resample a row with the nearest neighbors. */
+void image_nearest_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, int32_t fx, int32_t step, int max_x)
+{
+	uint32_t w;
+	int x, i;
+
+	for (x = 0; x < width; x++) {
+		image_sample_pos(fx, max_x, &i, &w);
+		fx += step;
+		dst[x] = src[i];
+	}
+}
+
+/* Expand a row of 3-byte pixels, keeping the byte order. */
+void image_expand_rgb_row_c(pixel_t * RESTRICT dst, const uint8_t * RESTRICT src, int width)
+{
+	int x;
+
+	for (x = 0; x < width; x++) {
+		dst[x] = 0xff000000 | ((pixel_t)src[2] << 16) | ((pixel_t)src[1] << 8) | (pixel_t)src[0];
+		src += 3;
+	}
+}
+
+/* Expand a row of 3-byte pixels, swapping the first and the third bytes. */
+void image_expand_bgr_row_c(pixel_t * RESTRICT dst, const uint8_t * RESTRICT src, int width)
+{
+	int x;
+
+	for (x = 0; x < width; x++) {
+		dst[x] = 0xff000000 | ((pixel_t)src[0] << 16) | ((pixel_t)src[1] << 8) | (pixel_t)src[2];
+		src += 3;
+	}
+}
+
+/* Alpha-blend a row by weights from a rule row. */
+void image_rule_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, const pixel_t * RESTRICT rule, int width, uint32_t pos, uint32_t limit, uint32_t gain)
+{
+	int x;
+
+	for (x = 0; x < width; x++)
+		dst[x] = image_alpha_pixel(dst[x], src[x], image_rule_weight(rule[x] & 0xff, pos, limit, gain));
+}
+
+/* Alpha-blend a row of premultiplied pixels by weights from a rule row. */
+void image_rule_pm_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, const pixel_t * RESTRICT rule, int width, uint32_t pos, uint32_t limit, uint32_t gain)
+{
+	int x;
+
+	for (x = 0; x < width; x++)
+		dst[x] = image_alpha_pm_pixel(dst[x], src[x], image_rule_weight(rule[x] & 0xff, pos, limit, gain));
+}
+
+/* Composite a row on a premultiplied row. */
+void image_composite_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha, const struct image_pd *pd)
+{
+	int x;
+
+	for (x = 0; x < width; x++)
+		dst[x] = image_composite_pixel(dst[x], image_premultiply_alpha_pixel(src[x], alpha), pd);
+}
+
+/* Composite a row of premultiplied pixels on a premultiplied row. */
+void image_composite_pm_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha, const struct image_pd *pd)
+{
+	int x;
+
+	for (x = 0; x < width; x++)
+		dst[x] = image_composite_pixel(dst[x], image_scale_pixel(src[x], alpha), pd);
+}
+
+/* Check for draw_image_*() parameters. */
+static bool image_check_draw(struct image *dst_image, int *dst_left,
+			     int *dst_top, struct image *src_image,
+			     int *width, int *height, int *src_left,
+			     int *src_top, int alpha)
+{
+	assert(dst_image != NULL);
+	assert(dst_image != src_image);
+	assert(dst_image->width > 0 && dst_image->height > 0);
+	assert(dst_image->pixels != NULL);
+	assert(src_image != NULL);
+	assert(src_image->width > 0 && src_image->height > 0);
+	assert(src_image->pixels != NULL);
+
+	/* Return false if no need for a draw. */
+	if(alpha == 0 || *width == 0 || *height == 0)
+		return false;
+	if(!image_clip_by_source(src_image->width, src_image->height, width, height, dst_left, dst_top, src_left, src_top))
+		return false;
+	if(!image_clip_by_dest(dst_image->width, dst_image->height, width, height, dst_left, dst_top, src_left, src_top))
+		return false;
+
+	/* Need for a draw. */
+	return true;
+}
+
+/*
+ * Clip a transfer rectangle by a size of a source size.
+ */
+bool image_clip_by_source(int src_cx, int src_cy, int *cx, int *cy, int *dst_x,
+			  int *dst_y, int *src_x, int *src_y)
+{
+	/* If the rectangle is completely out-of-scope.*/
+	if(*src_x < 0 && -*src_x >= *cx)
+		return false;	/* Left. */
+	if(*src_y < 0 && -*src_y >= *cy)
+		return false;	/* Top. */
+	if(*src_x > 0 && *src_x >= src_cx)
+		return false;	/* Right. */
+	if(*src_y > 0 && *src_y >= src_cy)
+		return false;	/* Bottom. */
+
+	/* Cut by a left edge. */
+	if(*src_x < 0) {
+		*cx += *src_x;
 		*dst_x -= *src_x;
 		*src_x = 0;
 	}
 
-	/* Cut by a top edge. *.
-	if(*src_y < 0) {
-		*cy += *src_y;
-		*dst_y -= *src_y;
-		*src_y = 0;
+	/* Cut by a top edge. */
+	if(*src_y < 0) {
+		*cy += *src_y;
+		*dst_y -= *src_y;
+		*src_y = 0;
+	}
+
+	/* Cut by a right edge. */
+	if(*src_x + *cx > src_cx)
+		*cx = src_cx - *src_x;
+
+	/* Cut by a bottom edge. */
+	if(*src_y + *cy > src_cy)
+		*cy = src_cy - *src_y;
+
+	if (*cx <= 0 || *cy <= 0)
+		return false;
+
+	/* Need for a draw. */
+	return true;
+}
+
+/*
+ * Clip a transfer rectangle by a size of a destination size.
+ */
+bool image_clip_by_dest(int dst_cx, int dst_cy, int *cx, int *cy, int *dst_x,
+			int *dst_y, int *src_x, int *src_y)
+{
+	/* If completely out-of-scope. */
+	if(*dst_x < 0 && -*dst_x >= *cx)
+		return false;	/* Left. */
+	if(*dst_y < 0 && -*dst_y >= *cy)
+		return false;	/* Top. */
+	if(*dst_x > 0 && *dst_x >= dst_cx)
+		return false;	/* Right. */
+	if(*dst_y > 0 && *dst_y >= dst_cy)
+		return false;	/* Bottom. */
+
+	/* Cut by a left edge. */
+	if(*dst_x < 0) {
+		*cx += *dst_x;
+		*src_x -= *dst_x;
+		*dst_x = 0;
+	}
+
+	/* Cut by a top edge. */
+	if(*dst_y < 0) {
+		*cy += *dst_y;
+		*src_y -= *dst_y;
+		*dst_y = 0;
+	}
+
+	/* Cut by a right edge. */
+	if(*dst_x + *cx > dst_cx)
+		*cx = dst_cx - *dst_x;
+
+	/* Cut by a bottom edge. */
+	if(*dst_y + *cy > dst_cy)
+		*cy = dst_cy - *dst_y;
+
+	if (*cx <= 0 || *cy <= 0)
+		return false;
+
+	/* Need for a draw. */
+	return true;
+}
+
+/*
+ * PNG
+ */
+
+#define PNG_DEBUG 3
+#if defined(OPENNOVEL_TARGET_WASM) || defined(OPENNOVEL_TARGET_ANDROID) || defined(OPENNOVEL_TARGET_POSIX)
+#include <png.h>
+#else
+#include <png/png.h>
+#endif
+
+struct png_reader {
+	const uint8_t *data;
+	size_t size;
+	size_t pos;
+};
+
+/* A streaming PNG decoder. */
+struct image_png_stream {
+	png_structp png_ptr;
+	png_infop info_ptr;
+	image_rows_callback callback;
+	void *callback_arg;
+	struct image *img;	/* NULL until the header arrives. */
+	int done_rows;		/* Rows completed and premultiplied. */
+	int reported_rows;	/* Rows passed to the callback. */
+	bool is_interlaced;
+	bool is_complete;
+	bool is_failed;
+};
+
+static void image_png_read_callback(png_structp png_ptr, png_bytep buf, png_size_t len);
+static void image_png_set_transforms(png_structp png_ptr, png_infop info_ptr);
+static void image_png_info_callback(png_structp png_ptr, png_infop info_ptr);
+static void image_png_row_callback(png_structp png_ptr, png_bytep row, png_uint_32 y, int pass);
+static void image_png_end_callback(png_structp png_ptr, png_infop info_ptr);
+
+/*
+ * Create an image with a PNG file.
+ */
+bool image_create_with_png(const uint8_t *data, size_t size, struct image **img)
+{
+	struct png_reader reader;
+	png_structp png_ptr;
+	png_infop info_ptr;
+	png_bytep * volatile rows;
+	int width;
+	int height;
+	int y;
+	pixel_t *pixels;
+
+	/* The signature is checked below. */
+	reader.data = data;
+	reader.size = size;
+	reader.pos = 8;
+
+	*img = NULL;
+	rows = NULL;
+
+	/* Check a signature. */
+	if (size < 8)
+		return false;
+	if (png_sig_cmp(data, 0, 8))
+		return false;
+
+	/* Create a png read struct. */
+	png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	if (png_ptr == NULL)
+		return false;
+
+	/* Create a png info struct. */
+	info_ptr = png_create_info_struct(png_ptr);
+	if (info_ptr == NULL) {
+		png_destroy_read_struct(&png_ptr, NULL, NULL);
+		return false;
+	}
+
+	/* Return here if failed. */
+	if (setjmp(png_jmpbuf(png_ptr))) {
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		if (*img != NULL) {
+			image_destroy(*img);
+			*img = NULL;
+		}
+		if (rows != NULL)
+			free(rows);
+		return false;
+	}
+
+	/* Read a header. */
+	png_set_read_fn(png_ptr, &reader, image_png_read_callback);
+	png_set_sig_bytes(png_ptr, 8);
+	png_read_info(png_ptr, info_ptr);
+
+	/* Get metrics. */
+	width = (int)png_get_image_width(png_ptr, info_ptr);
+	height = (int)png_get_image_height(png_ptr, info_ptr);
+
+	/* Convert to 8-bit RGBA. */
+	image_png_set_transforms(png_ptr, info_ptr);
+	if (png_get_rowbytes(png_ptr, info_ptr) != (size_t)width * 4) {
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		return false;
+	}
+
+	/* Allocate an image. */
+	if (!image_create(width, height, img)) {
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		return false;
+	}
+
+	pixels = (*img)->pixels;
+	if (png_get_interlace_type(png_ptr, info_ptr) == PNG_INTERLACE_NONE) {
+		/* Premultiply each row while it is still in the cache. */
+		for (y = 0; y < height; y++) {
+			png_read_row(png_ptr, (png_bytep)&pixels[(*img)->stride * y], NULL);
+			image_premultiply_rows(*img, y, 1);
+		}
+	} else {
+		/* Allocate a rows buffer. */
+		rows = malloc(sizeof(png_bytep) * (size_t)height);
+		if (rows == NULL) {
+			png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+			image_destroy(*img);
+			*img = NULL;
+			sys_out_of_memory();
+			return false;
+		}
+
+		/* Interlaced rows complete at the last pass. */
+#ifdef _MSC_VER
+#pragma warning(disable:6386)
+#endif
+		for (y = 0; y < height; y++)
+			rows[y] = (png_bytep)&pixels[(*img)->stride * y];
+		png_read_image(png_ptr, rows);
+		free(rows);
+		rows = NULL;
+		image_premultiply_rows(*img, 0, height);
+	}
+	(*img)->is_premultiplied = true;
+
+	/* Cleanup. */
+	png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+
+	return true;
+}
+
+static void image_png_read_callback(png_structp png_ptr, png_bytep buf, png_size_t len)
+{
+	struct png_reader *reader;
+
+	reader = png_get_io_ptr(png_ptr);
+
+	if (reader->pos + len > reader->size)
+		png_error(png_ptr, "Truncated PNG data.");
+
+	memcpy(buf, reader->data + reader->pos, len);
+	reader->pos += len;
+}
+
+/* Set the transforms to 8-bit RGBA in the order of make_pixel(). */
+static void image_png_set_transforms(png_structp png_ptr, png_infop info_ptr)
+{
+	png_byte color_type;
+
+	color_type = png_get_color_type(png_ptr, info_ptr);
+
+	/* Palette and low bit depth gray to 8-bit, and tRNS to alpha. */
+	png_set_expand(png_ptr);
+	png_set_strip_16(png_ptr);
+	if (color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
+		png_set_gray_to_rgb(png_ptr);
+	if ((color_type & PNG_COLOR_MASK_ALPHA) == 0 &&
+	    !png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS))
+		png_set_add_alpha(png_ptr, 0xff, PNG_FILLER_AFTER);
+	if (make_pixel(0, 1, 0, 0) != 1)
+		png_set_bgr(png_ptr);
+	png_set_interlace_handling(png_ptr);
+
+	png_read_update_info(png_ptr, info_ptr);
+}
+
+/*
+ * Start a streaming PNG decode.
+ */
+bool image_create_png_stream(image_rows_callback callback, void *arg, struct image_png_stream **ret)
+{
+	struct image_png_stream *stream;
+
+	assert(ret != NULL);
+
+	stream = malloc(sizeof(struct image_png_stream));
+	if (stream == NULL) {
+		sys_out_of_memory();
+		return false;
+	}
+	stream->callback = callback;
+	stream->callback_arg = arg;
+	stream->img = NULL;
+	stream->done_rows = 0;
+	stream->reported_rows = 0;
+	stream->is_interlaced = false;
+	stream->is_complete = false;
+	stream->is_failed = false;
+
+	stream->png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	if (stream->png_ptr == NULL) {
+		free(stream);
+		return false;
+	}
+	stream->info_ptr = png_create_info_struct(stream->png_ptr);
+	if (stream->info_ptr == NULL) {
+		png_destroy_read_struct(&stream->png_ptr, NULL, NULL);
+		free(stream);
+		return false;
+	}
+	if (setjmp(png_jmpbuf(stream->png_ptr))) {
+		png_destroy_read_struct(&stream->png_ptr, &stream->info_ptr, NULL);
+		free(stream);
+		return false;
+	}
+	png_set_progressive_read_fn(stream->png_ptr, stream,
+				    image_png_info_callback,
+				    image_png_row_callback,
+				    image_png_end_callback);
+
+	*ret = stream;
+	return true;
+}
+
+/*
+ * Feed a chunk of a PNG file to a streaming decode.
+ */
+bool image_feed_png_stream(struct image_png_stream *stream, const uint8_t *data, size_t size)
+{
+	int top, count;
+
+	assert(stream != NULL);
+	assert(data != NULL || size == 0);
+
+	if (stream->is_failed)
+		return false;
+	if (stream->is_complete || size == 0)
+		return true;
+
+	if (setjmp(png_jmpbuf(stream->png_ptr))) {
+		stream->is_failed = true;
+		return false;
+	}
+	png_process_data(stream->png_ptr, stream->info_ptr, (png_bytep)data, size);
+
+	/* Report the rows completed by this chunk at once. */
+	if (stream->done_rows > stream->reported_rows) {
+		top = stream->reported_rows;
+		count = stream->done_rows - top;
+		stream->reported_rows = stream->done_rows;
+		if (stream->callback != NULL)
+			stream->callback(stream->callback_arg, stream->img, top, count);
+	}
+
+	return true;
+}
+
+/*
+ * Get the image of a streaming decode, or NULL before the header.
+ */
+struct image *image_get_png_stream_image(struct image_png_stream *stream)
+{
+	assert(stream != NULL);
+
+	return stream->img;
+}
+
+/*
+ * Finish a streaming decode and take the image if it is complete.
+ */
+bool image_finish_png_stream(struct image_png_stream *stream, struct image **img)
+{
+	bool is_complete;
+
+	assert(stream != NULL);
+	assert(img != NULL);
+
+	is_complete = stream->is_complete && !stream->is_failed;
+	if (is_complete) {
+		*img = stream->img;
+	} else {
+		*img = NULL;
+		if (stream->img != NULL)
+			image_destroy(stream->img);
+	}
+
+	png_destroy_read_struct(&stream->png_ptr, &stream->info_ptr, NULL);
+	free(stream);
+
+	return is_complete;
+}
+
+/* Allocate the image when the header arrives. */
+static void image_png_info_callback(png_structp png_ptr, png_infop info_ptr)
+{
+	struct image_png_stream *stream;
+	int width, height;
+
+	stream = png_get_progressive_ptr(png_ptr);
+
+	width = (int)png_get_image_width(png_ptr, info_ptr);
+	height = (int)png_get_image_height(png_ptr, info_ptr);
+	stream->is_interlaced = png_get_interlace_type(png_ptr, info_ptr) != PNG_INTERLACE_NONE;
+
+	image_png_set_transforms(png_ptr, info_ptr);
+	if (png_get_rowbytes(png_ptr, info_ptr) != (size_t)width * 4)
+		png_error(png_ptr, "Unsupported PNG format.");
+
+	if (!image_create(width, height, &stream->img))
+		png_error(png_ptr, "Cannot allocate an image.");
+
+	/* Combining interlaced passes needs cleared rows. */
+	if (stream->is_interlaced)
+		image_clear(stream->img, 0);
+}
+
+/* Store a row, and premultiply it if complete. */
+static void image_png_row_callback(png_structp png_ptr, png_bytep row, png_uint_32 y, int pass)
+{
+	struct image_png_stream *stream;
+	pixel_t *dst;
+
+	UNUSED_PARAMETER(pass);
+
+	stream = png_get_progressive_ptr(png_ptr);
+	if (row == NULL || (int)y >= stream->img->height)
+		return;
+
+	dst = stream->img->pixels + (size_t)stream->img->stride * y;
+	png_progressive_combine_row(png_ptr, (png_bytep)dst, row);
+
+	/* Interlaced rows complete at the end. */
+	if (!stream->is_interlaced) {
+		image_premultiply_rows(stream->img, (int)y, 1);
+		stream->done_rows = (int)y + 1;
+	}
+}
+
+/* Mark a streaming decode complete. */
+static void image_png_end_callback(png_structp png_ptr, png_infop info_ptr)
+{
+	struct image_png_stream *stream;
+
+	UNUSED_PARAMETER(info_ptr);
+
+	stream = png_get_progressive_ptr(png_ptr);
+	if (stream->is_interlaced) {
+		image_premultiply_rows(stream->img, 0, stream->img->height);
+		stream->done_rows = stream->img->height;
+	}
+	stream->img->is_premultiplied = true;
+	stream->is_complete = true;
+}
+
+/* Read the chunks before the pixels of a PNG file. */
+static bool image_probe_png(const uint8_t *data, size_t size, struct image_info *info)
+{
+	struct png_reader reader;
+	png_structp png_ptr;
+	png_infop info_ptr;
+
+	/* The signature is already checked. */
+	reader.data = data;
+	reader.size = size;
+	reader.pos = 8;
+
+	png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	if (png_ptr == NULL)
+		return false;
+	info_ptr = png_create_info_struct(png_ptr);
+	if (info_ptr == NULL) {
+		png_destroy_read_struct(&png_ptr, NULL, NULL);
+		return false;
+	}
+	if (setjmp(png_jmpbuf(png_ptr))) {
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		return false;
+	}
+
+	png_set_read_fn(png_ptr, &reader, image_png_read_callback);
+	png_set_sig_bytes(png_ptr, 8);
+	png_read_info(png_ptr, info_ptr);
+
+	info->width = (int)png_get_image_width(png_ptr, info_ptr);
+	info->height = (int)png_get_image_height(png_ptr, info_ptr);
+	info->has_alpha = (png_get_color_type(png_ptr, info_ptr) & PNG_COLOR_MASK_ALPHA) != 0 ||
+			  png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS) != 0;
+
+	png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+
+	return true;
+}
+
+/*
+ * JPEG
+ */
+
+#include <setjmp.h>
+
+#if __has_include(<jpeglib.h>)
+#include <jpeglib.h>
+#else
+#include <jpeg/jpeglib.h>
+#endif
+
+/* Scanlines to read at once. */
+#define JPEG_BATCH	(16)
+
+/* An error manager that returns to the caller instead of exiting. */
+struct jpeg_error {
+	struct jpeg_error_mgr pub;
+	jmp_buf env;
+};
+
+static void image_jpeg_error_exit(j_common_ptr jpeg);
+
+/*
+ * Create an image with a JPEG file.
+ */
+bool image_create_with_jpeg(const uint8_t *data, size_t size, struct image **img)
+{
+	return image_create_with_jpeg_scaled(data, size, 1, img);
+}
+
+/*
+ * Create an image with a JPEG file, scaled down by 1/2, 1/4 or 1/8 in
+ * the IDCT.
+ */
+bool image_create_with_jpeg_scaled(const uint8_t *data, size_t size, int denom, struct image **img)
+{
+	struct jpeg_decompress_struct jpeg;
+	struct jpeg_error err;
+	JSAMPROW rows[JPEG_BATCH];
+	unsigned char * volatile buf;
+	image_expand_func expand;
+	pixel_t *p;
+	int width, height, y, i, n;
+
+	*img = NULL;
+	buf = NULL;
+
+	/* Return here if failed. */
+	jpeg.err = jpeg_std_error(&err.pub);
+	err.pub.error_exit = image_jpeg_error_exit;
+	if (setjmp(err.env)) {
+		jpeg_destroy_decompress(&jpeg);
+		free(buf);
+		if (*img != NULL) {
+			image_destroy(*img);
+			*img = NULL;
+		}
+		return false;
+	}
+
+	assert(denom == 1 || denom == 2 || denom == 4 || denom == 8);
+
+	/* Start decoding, converting grayscale to RGB too. */
+	jpeg_create_decompress(&jpeg);
+	jpeg_mem_src(&jpeg, data, (unsigned long)size);
+	jpeg_read_header(&jpeg, TRUE);
+	jpeg.out_color_space = JCS_RGB;
+	jpeg.scale_num = 1;
+	jpeg.scale_denom = (unsigned int)denom;
+	jpeg_start_decompress(&jpeg);
+
+	/* Get metrics. */
+	width = (int)jpeg.output_width;
+	height = (int)jpeg.output_height;
+	if (jpeg.out_color_components != 3) {
+		jpeg_destroy_decompress(&jpeg);
+		return false;
 	}
 
-	/* Cut by a right edge. */
-	if(*src_x + *cx > src_cx)
-		*cx = src_cx - *src_x;
+	/* Create an image. */
+	if (!image_create(width, height, img)) {
+		jpeg_destroy_decompress(&jpeg);
+		return false;
+	}
 
-	/* Cut by a bottom edge. *.
-	if(*src_y + *cy > src_cy)
-		*cy = src_cy - *src_y;
+	/* Allocate a buffer of a few scanlines. */
+	buf = malloc((size_t)width * 3 * JPEG_BATCH);
+	if (buf == NULL) {
+		sys_out_of_memory();
+		jpeg_destroy_decompress(&jpeg);
+		image_destroy(*img);
+		*img = NULL;
+		return false;
+	}
+	for (i = 0; i < JPEG_BATCH; i++)
+		rows[i] = buf + (size_t)width * 3 * (size_t)i;
 
-	if (*cx <= 0 || *cy <= 0)
+	/* The decoder outputs R, G and B, so swap them if pixels are BGRA. */
+	expand = make_pixel(0, 1, 0, 0) == 1 ? kernels.expand_rgb_row : kernels.expand_bgr_row;
+
+	/* Decode and expand scanlines. */
+	p = (*img)->pixels;
+	for (y = 0; y < height; y += n) {
+		n = (int)jpeg_read_scanlines(&jpeg, rows, JPEG_BATCH);
+		if (n == 0)
+			break;
+		for (i = 0; i < n; i++)
+			expand(p + (size_t)(*img)->stride * (size_t)(y + i), rows[i], width);
+	}
+
+	/* Cleanup. */
+	free(buf);
+	jpeg_destroy_decompress(&jpeg);
+
+	/* Opaque pixels are premultiplied as is. */
+	(*img)->is_premultiplied = true;
+
+	return true;
+}
+
+/* Read the header of a JPEG file. */
+static bool image_probe_jpeg(const uint8_t *data, size_t size, struct image_info *info)
+{
+	struct jpeg_decompress_struct jpeg;
+	struct jpeg_error err;
+
+	jpeg.err = jpeg_std_error(&err.pub);
+	err.pub.error_exit = image_jpeg_error_exit;
+	if (setjmp(err.env)) {
+		jpeg_destroy_decompress(&jpeg);
 		return false;
+	}
+
+	jpeg_create_decompress(&jpeg);
+	jpeg_mem_src(&jpeg, data, (unsigned long)size);
+	jpeg_read_header(&jpeg, TRUE);
+
+	info->width = (int)jpeg.image_width;
+	info->height = (int)jpeg.image_height;
+	info->has_alpha = false;
+
+	jpeg_destroy_decompress(&jpeg);
 
-	/* Need for a draw. */
 	return true;
 }
 
+/* Return to the setjmp() point on a fatal error. */
+static void image_jpeg_error_exit(j_common_ptr jpeg)
+{
+	struct jpeg_error *err;
+
+	err = (struct jpeg_error *)jpeg->err;
+	longjmp(err->env, 1);
+}
+
 /*
- * Clip a transfer rectangle by a size of a destination size.
+ * WebP
  */
-bool image_clip_by_dest(int dst_cx, int dst_cy, int *cx, int *cy, int *dst_x,
-			int *dst_y, int *src_x, int *src_y)
+
+#include <webp/decode.h>
+
+/*
+ * Create an image with a WebP file.
+ */
+bool image_create_with_webp(const uint8_t *data, size_t size, struct image **img)
 {
-	/* If completely out-of-scope. */
-	if(*dst_x < 0 && -*dst_x >= *cx)
-		return false;	/* Left. */
-	if(*dst_y < 0 && -*dst_y >= *cy)
-		return false;	/* Top. */
-	if(*dst_x > 0 && *dst_x >= dst_cx)
-		return false;	/* Right. */
-	if(*dst_y > 0 && *dst_y >= dst_cy)
-		return false;	/* Bottom. */
+	WebPDecoderConfig config;
 
-	/* Cut by a left edge. */
-	if(*dst_x < 0) {
-		*cx += *dst_x;
-		*src_x -= *dst_x;
-		*dst_x = 0;
+	*img = NULL;
+
+	/* Get metrics. */
+	if (!WebPInitDecoderConfig(&config))
+		return false;
+	if (WebPGetFeatures(data, size, &config.input) != VP8_STATUS_OK)
+		return false;
+
+	/* Create an image. */
+	if (!image_create(config.input.width, config.input.height, img))
+		return false;
+
+	/* Decode into the image in the order of make_pixel(), without an intermediate buffer. */
+	config.output.colorspace = make_pixel(0, 1, 0, 0) == 1 ? MODE_RGBA : MODE_BGRA;
+	config.output.is_external_memory = 1;
+	config.output.u.RGBA.rgba = (uint8_t *)(*img)->pixels;
+	config.output.u.RGBA.stride = (*img)->stride * (int)sizeof(pixel_t);
+	config.output.u.RGBA.size = (size_t)config.output.u.RGBA.stride * (size_t)config.input.height;
+	config.options.use_threads = 1;
+	if (WebPDecode(data, size, &config) != VP8_STATUS_OK) {
+		WebPFreeDecBuffer(&config.output);
+		image_destroy(*img);
+		*img = NULL;
+		return false;
+	}
+	WebPFreeDecBuffer(&config.output);
+
+	/* Premultiply with the same rounding as the other decoders. */
+	image_premultiply(*img);
+
+	return true;
+}
+
+/* Read the header of a WebP file. */
+static bool image_probe_webp(const uint8_t *data, size_t size, struct image_info *info)
+{
+	WebPBitstreamFeatures features;
+
+	if (WebPGetFeatures(data, size, &features) != VP8_STATUS_OK)
+		return false;
+
+	info->width = features.width;
+	info->height = features.height;
+	info->has_alpha = features.has_alpha != 0;
+
+	return true;
+}
+
+/*
+ * Create an image with a PNG, JPEG or WebP file.
+ */
+bool image_create_with_data(const uint8_t *data, size_t size, struct image **img)
+{
+	assert(data != NULL);
+	assert(img != NULL);
+
+	switch (image_detect_format(data, size)) {
+	case IMAGE_FORMAT_PNG:
+		return image_create_with_png(data, size, img);
+	case IMAGE_FORMAT_JPEG:
+		return image_create_with_jpeg(data, size, img);
+	case IMAGE_FORMAT_WEBP:
+		return image_create_with_webp(data, size, img);
+	default:
+		break;
+	}
+
+	sys_error("Unknown image format.");
+	return false;
+}
+
+/*
+ * Create an image with an image file, through the disk cache if enabled.
+ */
+bool image_create_with_file(const char *path, struct image **img)
+{
+	uint8_t *data;
+	char *cache_path;
+	size_t size;
+	uint64_t path_hash, hash;
+
+	assert(path != NULL);
+	assert(img != NULL);
+
+	if (!image_read_file(path, &data, &size))
+		return false;
+
+	/* Take the decoded pixels from the cache if the file is unchanged. */
+	path_hash = image_hash(path, strlen(path));
+	cache_path = image_make_cache_path(path_hash);
+	if (cache_path != NULL) {
+		hash = image_hash(data, size);
+		if (image_load_cache(cache_path, path_hash, size, hash, img)) {
+			free(cache_path);
+			free(data);
+			return true;
+		}
+	}
+
+	if (!image_create_with_data(data, size, img)) {
+		free(cache_path);
+		free(data);
+		return false;
+	}
+	free(data);
+
+	if (cache_path != NULL) {
+		image_save_cache(cache_path, path_hash, size, hash, *img);
+		free(cache_path);
+	}
+
+	return true;
+}
+
+/*
+ * Set the directory of the disk cache, or disable the cache with NULL.
+ */
+bool image_set_disk_cache(const char *dir)
+{
+	char *s, *old;
+
+	s = NULL;
+	if (dir != NULL) {
+		s = strdup(dir);
+		if (s == NULL) {
+			sys_out_of_memory();
+			return false;
+		}
+	}
+
+	/* The decoding threads copy the directory under the lock. */
+#ifdef USE_THREADS
+	pthread_mutex_lock(&decode_mutex);
+#endif
+	old = cache_dir;
+	cache_dir = s;
+#ifdef USE_THREADS
+	pthread_mutex_unlock(&decode_mutex);
+#endif
+	free(old);
+
+	return true;
+}
+
+/*
+ * Get a shared image of a file, loading it if not cached.
+ */
+bool image_acquire(const char *path, struct image **img)
+{
+	struct image_entry *entry, **bucket;
+	uint64_t path_hash;
+
+	assert(path != NULL);
+	assert(img != NULL);
+
+	path_hash = image_hash(path, strlen(path));
+	bucket = &entry_bucket[path_hash & (ENTRY_BUCKETS - 1)];
+
+	/* Share a cached image. */
+	for (entry = *bucket; entry != NULL; entry = entry->next) {
+		if (entry->path_hash == path_hash && strcmp(entry->path, path) == 0) {
+			if (entry->ref_count++ == 0) {
+				image_unlink_lru(entry);
+				cache_stats.unused_count--;
+				cache_stats.unused_bytes -= entry->size;
+			}
+			cache_stats.hits++;
+			*img = entry->img;
+			return true;
+		}
+	}
+
+	/* Load and add an image. */
+	entry = malloc(sizeof(struct image_entry));
+	if (entry == NULL) {
+		sys_out_of_memory();
+		return false;
+	}
+	entry->path = strdup(path);
+	if (entry->path == NULL) {
+		sys_out_of_memory();
+		free(entry);
+		return false;
+	}
+	if (!image_create_with_file(path, &entry->img)) {
+		free(entry->path);
+		free(entry);
+		return false;
+	}
+	entry->path_hash = path_hash;
+	entry->size = (size_t)entry->img->stride * (size_t)entry->img->height * sizeof(pixel_t);
+	entry->ref_count = 1;
+	entry->lru_prev = NULL;
+	entry->lru_next = NULL;
+	entry->img->entry = entry;
+	entry->next = *bucket;
+	*bucket = entry;
+
+	cache_stats.misses++;
+	cache_stats.count++;
+	cache_stats.bytes += entry->size;
+
+	/* Make room for the new image. */
+	image_evict_entries(cache_budget);
+
+	*img = entry->img;
+	return true;
+}
+
+/*
+ * Release a reference to a shared image.
+ */
+void image_release(struct image *img)
+{
+	struct image_entry *entry;
+
+	assert(img != NULL);
+	assert(img->entry != NULL);
+	assert(img->entry->ref_count > 0);
+
+	entry = img->entry;
+	if (--entry->ref_count > 0)
+		return;
+
+	/* Keep the image as the most recently released. */
+	entry->lru_prev = lru_tail;
+	entry->lru_next = NULL;
+	if (lru_tail != NULL)
+		lru_tail->lru_next = entry;
+	else
+		lru_head = entry;
+	lru_tail = entry;
+	cache_stats.unused_count++;
+	cache_stats.unused_bytes += entry->size;
+
+	image_evict_entries(cache_budget);
+}
+
+/*
+ * Set the budget of the bytes kept in the image cache.
+ */
+void image_set_cache_budget(size_t bytes)
+{
+	cache_budget = bytes;
+
+	image_evict_entries(cache_budget);
+}
+
+/*
+ * Free all the cached images without a reference.
+ */
+void image_purge_cache(void)
+{
+	image_evict_entries(0);
+}
+
+/*
+ * Get the statistics of the image cache.
+ */
+void image_get_cache_stats(struct image_cache_stats *stats)
+{
+	assert(stats != NULL);
+
+	*stats = cache_stats;
+}
+
+/* Remove an entry from the LRU list. */
+static void image_unlink_lru(struct image_entry *entry)
+{
+	if (entry->lru_prev != NULL)
+		entry->lru_prev->lru_next = entry->lru_next;
+	else
+		lru_head = entry->lru_next;
+	if (entry->lru_next != NULL)
+		entry->lru_next->lru_prev = entry->lru_prev;
+	else
+		lru_tail = entry->lru_prev;
+	entry->lru_prev = NULL;
+	entry->lru_next = NULL;
+}
+
+/* Free unreferenced images from the least recently released, until the cache fits in a budget. */
+static void image_evict_entries(size_t budget)
+{
+	struct image_entry *entry, **p;
+
+	while (cache_stats.bytes > budget && lru_head != NULL) {
+		entry = lru_head;
+		image_unlink_lru(entry);
+
+		/* Remove from the bucket. */
+		p = &entry_bucket[entry->path_hash & (ENTRY_BUCKETS - 1)];
+		while (*p != entry)
+			p = &(*p)->next;
+		*p = entry->next;
+
+		cache_stats.count--;
+		cache_stats.unused_count--;
+		cache_stats.bytes -= entry->size;
+		cache_stats.unused_bytes -= entry->size;
+		cache_stats.evictions++;
+
+		entry->img->entry = NULL;
+		image_destroy(entry->img);
+		free(entry->path);
+		free(entry);
+	}
+}
+
+/*
+ * Get the format and the metrics of an image file without decoding.
+ */
+bool image_probe(const uint8_t *data, size_t size, struct image_info *info)
+{
+	assert(data != NULL);
+	assert(info != NULL);
+
+	info->format = image_detect_format(data, size);
+	info->width = 0;
+	info->height = 0;
+	info->has_alpha = false;
+
+	switch (info->format) {
+	case IMAGE_FORMAT_PNG:
+		return image_probe_png(data, size, info);
+	case IMAGE_FORMAT_JPEG:
+		return image_probe_jpeg(data, size, info);
+	case IMAGE_FORMAT_WEBP:
+		return image_probe_webp(data, size, info);
+	default:
+		break;
+	}
+
+	return false;
+}
+
+/* Tell the format of an image file by the signature. */
+static int image_detect_format(const uint8_t *data, size_t size)
+{
+	if (size >= 8 && memcmp(data, "\x89PNG\r\n\x1a\n", 8) == 0)
+		return IMAGE_FORMAT_PNG;
+	if (size >= 3 && data[0] == 0xff && data[1] == 0xd8 && data[2] == 0xff)
+		return IMAGE_FORMAT_JPEG;
+	if (size >= 12 && memcmp(data, "RIFF", 4) == 0 && memcmp(data + 8, "WEBP", 4) == 0)
+		return IMAGE_FORMAT_WEBP;
+
+	return IMAGE_FORMAT_UNKNOWN;
+}
+
+/*
+ * Set the number of the decoding threads.
+ */
+void image_set_decode_threads(int threads)
+{
+	if (threads < 1)
+		threads = 1;
+	if (threads > DECODE_THREAD_MAX)
+		threads = DECODE_THREAD_MAX;
+
+#ifdef USE_THREADS
+	/* The new count takes effect on the next request. */
+	image_stop_decoders();
+#endif
+	decode_thread_count = threads;
+}
+
+/*
+ * Decode an image file in memory on a decoding thread.
+ */
+bool image_decode_async(const uint8_t *data, size_t size,
+			image_decode_callback callback, void *arg,
+			struct image_decode **ret)
+{
+	struct image_decode *req;
+
+	assert(data != NULL);
+	assert(callback != NULL || ret != NULL);
+
+	req = malloc(sizeof(struct image_decode));
+	if (req == NULL) {
+		sys_out_of_memory();
+		return false;
 	}
+	req->data = data;
+	req->size = size;
+	req->path = NULL;
+	req->callback = callback;
+	req->callback_arg = arg;
+	req->img = NULL;
+	req->is_done = false;
+	req->next = NULL;
+
+	if (ret != NULL)
+		*ret = callback == NULL ? req : NULL;
+
+	return image_queue_decode(req);
+}
 
-	/* Cut by a top edge. */
-	if(*dst_y < 0) {
-		*cy += *dst_y;
-		*src_y -= *dst_y;
-		*dst_y = 0;
+/*
+ * Read and decode an image file on a decoding thread.
+ */
+bool image_decode_file_async(const char *path,
+			     image_decode_callback callback, void *arg,
+			     struct image_decode **ret)
+{
+	struct image_decode *req;
+
+	assert(path != NULL);
+	assert(callback != NULL || ret != NULL);
+
+	req = malloc(sizeof(struct image_decode));
+	if (req == NULL) {
+		sys_out_of_memory();
+		return false;
+	}
+	req->path = strdup(path);
+	if (req->path == NULL) {
+		sys_out_of_memory();
+		free(req);
+		return false;
 	}
+	req->data = NULL;
+	req->size = 0;
+	req->callback = callback;
+	req->callback_arg = arg;
+	req->img = NULL;
+	req->is_done = false;
+	req->next = NULL;
+
+	if (ret != NULL)
+		*ret = callback == NULL ? req : NULL;
+
+	return image_queue_decode(req);
+}
 
-	/* Cut by a right edge. */
-	if(*dst_x + *cx > dst_cx)
-		*cx = dst_cx - *dst_x;
+/*
+ * Check whether a decode request without a callback has completed.
+ */
+bool image_is_decode_done(struct image_decode *req)
+{
+	bool is_done;
 
-	/* Cut by a bottom edge. */
-	if(*dst_y + *cy > dst_cy)
-		*cy = dst_cy - *dst_y;
+	assert(req != NULL);
+	assert(req->callback == NULL);
 
-	if (*cx <= 0 || *cy <= 0)
-		return false;
+#ifdef USE_THREADS
+	pthread_mutex_lock(&decode_mutex);
+#endif
+	is_done = req->is_done;
+#ifdef USE_THREADS
+	pthread_mutex_unlock(&decode_mutex);
+#endif
 
-	/* Need for a draw. */
-	return true;
+	return is_done;
 }
 
 /*
- * PNG
+ * Wait for a decode request without a callback, take the image and free
+ * the request.
  */
+bool image_finish_decode(struct image_decode *req, struct image **img)
+{
+	assert(req != NULL);
+	assert(req->callback == NULL);
+	assert(img != NULL);
 
-#define PNG_DEBUG 3
-#if defined(OPENNOVEL_TARGET_WASM) || defined(OPENNOVEL_TARGET_ANDROID) || defined(OPENNOVEL_TARGET_POSIX)
-#include <png.h>
-#else
-#include <png/png.h>
+#ifdef USE_THREADS
+	pthread_mutex_lock(&decode_mutex);
+	while (!req->is_done)
+		pthread_cond_wait(&finish_cond, &decode_mutex);
+	pthread_mutex_unlock(&decode_mutex);
 #endif
+	assert(req->is_done);
 
-struct png_reader {
-	const uint8_t *data;
-	size_t size;
-	size_t pos;
-};
+	*img = req->img;
+	free(req);
 
-static void image_png_read_callback(png_structp png_ptr, png_bytep buf, png_size_t len);
+	return *img != NULL;
+}
 
 /*
- * Create an image with a PNG file.
+ * Call the callbacks of the completed decode requests.
  */
-bool image_create_with_png(const uint8_t *data, size_t size, struct image **img)
+void image_dispatch_decodes(void)
 {
-	struct png_reader reader;
-	png_structp png_ptr;
-	png_byte color_type, bit_depth;
-	png_infop info_ptr;
-	png_bytep *rows;
-	int width;
-	int height;
-	int y;
-	pixel_t *pixels;
-
-	reader.data = data;
-	reader.size = size;
-	reader.pos = 0;
+	struct image_decode *list, *req;
 
-	/* Check a signature. */
-	if (size < 8)
-		return false;
-	if (png_sig_cmp(data, 0, 8))
-		return false;
+	/* Take the done list. */
+#ifdef USE_THREADS
+	pthread_mutex_lock(&decode_mutex);
+#endif
+	list = done_head;
+	done_head = done_tail = NULL;
+#ifdef USE_THREADS
+	pthread_mutex_unlock(&decode_mutex);
+#endif
 
-	/* Create a png read struct. */
-	png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-	if (png_ptr == NULL)
-		return false;
+	/* Call the callbacks outside of the lock. */
+	while (list != NULL) {
+		req = list;
+		list = req->next;
+		req->callback(req->callback_arg, req->img);
+		free(req);
+	}
+}
 
-	/* Create a png info struct. */
-	info_ptr = png_create_info_struct(png_ptr);
-	if (info_ptr == NULL) {
-		png_destroy_read_struct(&png_ptr, NULL, NULL);
-		return false;
+/* Queue a decode request, or decode it now without threads. */
+static bool image_queue_decode(struct image_decode *req)
+{
+#ifdef USE_THREADS
+	pthread_mutex_lock(&decode_mutex);
+	if (image_start_decoders()) {
+		if (decode_tail != NULL)
+			decode_tail->next = req;
+		else
+			decode_head = req;
+		decode_tail = req;
+		pthread_cond_signal(&decode_cond);
+		pthread_mutex_unlock(&decode_mutex);
+		return true;
 	}
+	pthread_mutex_unlock(&decode_mutex);
+#endif
 
-	/* Return here if failed. */
-	if (setjmp(png_jmpbuf(png_ptr))) {
-		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-		if (*img != NULL) {
-			image_destroy(*img);
-			*img = NULL;
-		}
-		if (rows != NULL)
-			free(rows);
-		return false;
+	/* Decode on the calling thread. */
+	image_run_decode(req);
+#ifdef USE_THREADS
+	pthread_mutex_lock(&decode_mutex);
+#endif
+	image_complete_decode(req);
+#ifdef USE_THREADS
+	pthread_mutex_unlock(&decode_mutex);
+#endif
+
+	return true;
+}
+
+/* Decode a request. */
+static void image_run_decode(struct image_decode *req)
+{
+	if (req->path == NULL) {
+		if (!image_create_with_data(req->data, req->size, &req->img))
+			req->img = NULL;
+		return;
 	}
 
-	/* Read a header. */
-	png_set_read_fn(png_ptr, &reader, image_png_read_callback);
-	png_set_sig_bytes(png_ptr, 8);
-	png_read_info(png_ptr, info_ptr);
+	if (!image_create_with_file(req->path, &req->img))
+		req->img = NULL;
+	free(req->path);
+	req->path = NULL;
+}
 
-	/* Get metrics. */
-	width = (int)png_get_image_width(png_ptr, info_ptr);
-	height = (int)png_get_image_height(png_ptr, info_ptr);
-	color_type = png_get_color_type(png_ptr, info_ptr);
-	bit_depth = png_get_bit_depth(png_ptr, info_ptr);
+/* Mark a request completed. (with the decode mutex locked) */
+static void image_complete_decode(struct image_decode *req)
+{
+	req->is_done = true;
+	req->next = NULL;
+
+	if (req->callback != NULL) {
+		if (done_tail != NULL)
+			done_tail->next = req;
+		else
+			done_head = req;
+		done_tail = req;
+		return;
+	}
 
-	/* Convert palette to RGBA. */
-	switch(color_type) {
-	case PNG_COLOR_TYPE_GRAY:
-		png_set_gray_to_rgb(png_ptr);
-		png_set_add_alpha(png_ptr, 0xff, PNG_FILLER_AFTER);
-		png_read_update_info(png_ptr, info_ptr);
-		break;
-	case PNG_COLOR_TYPE_PALETTE:
-#if defined(TARGET_WINDOWS)
-		png_set_bgr(png_ptr);
-#endif
-		png_set_palette_to_rgb(png_ptr);
-		png_set_add_alpha(png_ptr, 0xff, PNG_FILLER_AFTER);
-		png_read_update_info(png_ptr, info_ptr);
-		break;
-	case PNG_COLOR_TYPE_RGB:
-#if defined(TARGET_WINDOWS)
-		png_set_bgr(png_ptr);
+#ifdef USE_THREADS
+	pthread_cond_broadcast(&finish_cond);
 #endif
-		if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS)) {
-			png_set_tRNS_to_alpha(png_ptr);
-		} else {
-			png_set_add_alpha(png_ptr, 0xff, PNG_FILLER_AFTER);
-			png_read_update_info(png_ptr, info_ptr);
-		}
-		break;
-	case PNG_COLOR_TYPE_RGB_ALPHA:
-#if defined(TARGET_WINDOWS)
-		png_set_bgr(png_ptr);
-#endif
-		break;
-	case PNG_COLOR_TYPE_GRAY_ALPHA:
-		png_set_gray_to_rgb(png_ptr);
-		png_set_add_alpha(png_ptr, 0xff, PNG_FILLER_AFTER);
-		png_read_update_info(png_ptr, info_ptr);
-		break;
-	default:
-		return false;
-	}
+}
 
-	/* 16-bit to 8-bit. */
-	if (bit_depth == 16)
-		png_set_strip_16(png_ptr);
+/* Read a whole file. */
+static bool image_read_file(const char *path, uint8_t **data, size_t *size)
+{
+	struct file *f;
+	size_t total, len;
 
-	/* Allocate an image. */
-	if (!image_create(width, height, img))
+	if (!file_open(path, &f)) {
+		sys_error("Cannot open file \"%s\".", path);
 		return false;
+	}
+	if (!file_get_size(f, size) || *size == 0) {
+		sys_error("Cannot read file \"%s\".", path);
+		file_close(f);
+		return false;
+	}
 
-	/* Allocate a rows buffer. */
-	rows = malloc(sizeof(png_bytep) * (size_t)height);
-	if (rows == NULL) {
-		image_destroy(*img);
+	*data = malloc(*size);
+	if (*data == NULL) {
 		sys_out_of_memory();
+		file_close(f);
 		return false;
 	}
-	assert(png_get_rowbytes(png_ptr, info_ptr) == (size_t)(width*4));
-
-	/* Read an image. */
-#ifdef _MSC_VER
-#pragma warning(disable:6386)
-#endif
-	pixels = (*img)->pixels;
-	for (y = 0; y < height; y++)
-		rows[y] = (png_bytep)&pixels[width * y];
-	png_read_image(png_ptr, rows);
 
-	/* Cleanup. */
-	png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+	for (total = 0; total < *size; total += len) {
+		if (!file_read(f, *data + total, *size - total, &len)) {
+			sys_error("Cannot read file \"%s\".", path);
+			free(*data);
+			file_close(f);
+			return false;
+		}
+	}
+	file_close(f);
 
 	return true;
 }
 
-static void image_png_read_callback(png_structp png_ptr, png_bytep buf, png_size_t len)
+/* Hash bytes. (64-bit MurmurHash2) */
+static uint64_t image_hash(const void *data, size_t size)
 {
-	struct png_reader *reader;
+	const uint64_t m = 0xc6a4a7935bd1e995ull;
+	const uint8_t *p;
+	uint64_t h, k;
+	size_t i;
+
+	h = 0x9e3779b97f4a7c15ull ^ ((uint64_t)size * m);
+
+	/* 8 bytes at a time. */
+	p = data;
+	for (i = 0; i + 8 <= size; i += 8) {
+		memcpy(&k, p + i, 8);
+		k *= m;
+		k ^= k >> 47;
+		k *= m;
+		h ^= k;
+		h *= m;
+	}
 
-	reader = png_get_io_ptr(png_ptr);
+	/* The remaining bytes. */
+	if (i < size) {
+		for (k = 0; i < size; i++)
+			k = (k << 8) | p[i];
+		h ^= k;
+		h *= m;
+	}
 
-	if (reader->pos + len > reader->size)
-		len = reader->size - reader->pos;
+	h ^= h >> 47;
+	h *= m;
+	h ^= h >> 47;
 
-	memcpy(buf, reader->data + reader->pos, len);
+	return h;
 }
 
-/*
- * JPEG
- */
+/* Make the path of the cache file for an asset path. (NULL if the cache is disabled) */
+static char *image_make_cache_path(uint64_t path_hash)
+{
+	char *path;
+	size_t len;
+	bool is_enabled;
 
-#if __has_include(<jpeglib.h>)
-#include <jpeglib.h>
-#else
-#include <jpeg/jpeglib.h>
+	path = NULL;
+#ifdef USE_THREADS
+	pthread_mutex_lock(&decode_mutex);
 #endif
+	is_enabled = cache_dir != NULL;
+	if (is_enabled) {
+		len = strlen(cache_dir) + 32;
+		path = malloc(len);
+		if (path != NULL)
+			snprintf(path, len, "%s/%016llx.mkic", cache_dir, (unsigned long long)path_hash);
+	}
+#ifdef USE_THREADS
+	pthread_mutex_unlock(&decode_mutex);
+#endif
+	if (is_enabled && path == NULL)
+		sys_out_of_memory();
 
-/*
- * Create an image with a JPEG file.
- */
-bool image_create_with_jpeg(const uint8_t *data, size_t size, struct image **img)
+	return path;
+}
+
+/* Load an image from the cache if there is a valid entry. */
+static bool image_load_cache(const char *path, uint64_t path_hash, size_t size, uint64_t hash, struct image **img)
 {
-	struct jpeg_decompress_struct jpeg;
-	struct jpeg_error_mgr jerr;
-	pixel_t *p;
-	unsigned char *raw_data;
-	unsigned char *line;
-	unsigned int width, height, x, y;
-	int components;
+	struct image_cache_header h;
+	struct image *im;
+	FILE *fp;
+	long file_size;
+	uint64_t pixel_size;
+#ifndef USE_MMAP
+	int y;
+#endif
 
-	/* Start decoding. */
-	jpeg_create_decompress(&jpeg);
-	jpeg_mem_src(&jpeg, data, size);
-	jpeg.err = jpeg_std_error(&jerr);
-	jpeg_read_header(&jpeg, TRUE);
-	jpeg_start_decompress(&jpeg);
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+		return false;
 
-	/* Get metrics. */
-	width = jpeg.output_width;
-	height = jpeg.output_height;
-	components = jpeg.out_color_components;
-	if (components != 3) {
-		jpeg_destroy_decompress(&jpeg);
+	/* Check the header against the asset. */
+	if (fread(&h, sizeof(h), 1, fp) != 1 ||
+	    memcmp(h.magic, CACHE_MAGIC, 4) != 0 ||
+	    h.version != CACHE_VERSION ||
+	    h.pixel_order != make_pixel(1, 2, 3, 4) ||
+	    h.width == 0 || h.width > CACHE_SIZE_MAX ||
+	    h.height == 0 || h.height > CACHE_SIZE_MAX ||
+	    h.path_hash != path_hash ||
+	    h.source_size != size ||
+	    h.source_hash != hash) {
+		fclose(fp);
 		return false;
 	}
 
-	/* Create an image. */
-	if (!image_create(width, height, img)) {
-		jpeg_destroy_decompress(&jpeg);
+	/* Check that the pixels are all there. */
+	pixel_size = (uint64_t)h.width * h.height * sizeof(pixel_t);
+	if (fseek(fp, 0, SEEK_END) != 0 ||
+	    (file_size = ftell(fp)) < 0 ||
+	    (uint64_t)file_size != CACHE_HEADER_SIZE + pixel_size) {
+		fclose(fp);
 		return false;
 	}
 
-	/* Allocate a line buffer. */
-	line = malloc(width * height * 3);
-	if (line == NULL) {
+#ifdef USE_MMAP
+	im = malloc(sizeof(struct image));
+	if (im == NULL) {
 		sys_out_of_memory();
-		jpeg_destroy_decompress(&jpeg);
-		image_destroy(*img);
-		*img = NULL;
+		fclose(fp);
 		return false;
 	}
 
-	/* Decode each line. */
-	p = (*img)->pixels;
-#if defined(TARGET_WINDOWS)
-	for (y = 0; y < height; y++) {
-		jpeg_read_scanlines(&jpeg, &line, 1);
-		for (x = 0; x < width; x++) {
-			*p++ = make_pixel(255, line[x * 3 + 2], line[x * 3 + 1], line[x * 3 + 0]);
-		}
+	/* A private mapping, so that a draw doesn't write to the file. */
+	im->map_size = (size_t)file_size;
+	im->map = mmap(NULL, im->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(fp), 0);
+	fclose(fp);
+	if (im->map == MAP_FAILED) {
+		free(im);
+		return false;
 	}
+
+	im->width = (int)h.width;
+	im->height = (int)h.height;
+	im->stride = (int)h.width;
+	im->pixels = (pixel_t *)((uint8_t *)im->map + CACHE_HEADER_SIZE);
+	im->is_premultiplied = h.is_premultiplied != 0;
+	im->parent = NULL;
+	im->parent_x = 0;
+	im->parent_y = 0;
+	im->dirty[0].x = 0;
+	im->dirty[0].y = 0;
+	im->dirty[0].w = im->width;
+	im->dirty[0].h = im->height;
+	im->dirty_count = 1;
+	im->buffer_size = 0;
+	im->next_free = NULL;
+	im->entry = NULL;
 #else
-	for (y = 0; y < height; y++) {
-		jpeg_read_scanlines(&jpeg, &line, 1);
-		for (x = 0; x < width; x++) {
-			*p++ = make_pixel(255, line[x * 3], line[x * 3 + 1], line[x * 3 + 2]);
+	/* Read the pixels into a new image. */
+	if (!image_create((int)h.width, (int)h.height, &im)) {
+		fclose(fp);
+		return false;
+	}
+	if (fseek(fp, CACHE_HEADER_SIZE, SEEK_SET) != 0) {
+		image_destroy(im);
+		fclose(fp);
+		return false;
+	}
+	for (y = 0; y < im->height; y++) {
+		if (fread(im->pixels + im->stride * y, sizeof(pixel_t), (size_t)im->width, fp) != (size_t)im->width) {
+			image_destroy(im);
+			fclose(fp);
+			return false;
 		}
 	}
+	fclose(fp);
+	im->is_premultiplied = h.is_premultiplied != 0;
 #endif
 
-	/* Cleanup. */
-	free(line);
-	jpeg_destroy_decompress(&jpeg);
-
+	*img = im;
 	return true;
 }
 
-/*
- * WebP
- */
+/* Write an image to the cache. A failure only leaves no entry. */
+static void image_save_cache(const char *path, uint64_t path_hash, size_t size, uint64_t hash, struct image *img)
+{
+	static const uint8_t zero[256];
+	struct image_cache_header h;
+	char *tmp_path;
+	FILE *fp;
+	size_t len, pad;
+	int y;
+	bool is_written;
 
-#include <webp/decode.h>
+	/* Write to a temporary file, which is unique in the process. */
+	len = strlen(path) + 32;
+	tmp_path = malloc(len);
+	if (tmp_path == NULL) {
+		sys_out_of_memory();
+		return;
+	}
+	snprintf(tmp_path, len, "%s.%p.tmp", path, (void *)img);
+	fp = fopen(tmp_path, "wb");
+	if (fp == NULL) {
+		sys_log("Cannot write the image cache \"%s\".\n", tmp_path);
+		free(tmp_path);
+		return;
+	}
 
-/*
- * Create an image with a WebP file.
- */
-bool image_create_with_webp(const uint8_t *data, size_t size, struct image **img)
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, CACHE_MAGIC, 4);
+	h.version = CACHE_VERSION;
+	h.pixel_order = make_pixel(1, 2, 3, 4);
+	h.width = (uint32_t)img->width;
+	h.height = (uint32_t)img->height;
+	h.is_premultiplied = image_is_premultiplied(img) ? 1 : 0;
+	h.path_hash = path_hash;
+	h.source_size = size;
+	h.source_hash = hash;
+
+	is_written = fwrite(&h, sizeof(h), 1, fp) == 1;
+	for (pad = CACHE_HEADER_SIZE - sizeof(h); is_written && pad > 0; pad -= len) {
+		len = pad < sizeof(zero) ? pad : sizeof(zero);
+		is_written = fwrite(zero, 1, len, fp) == len;
+	}
+	for (y = 0; is_written && y < img->height; y++)
+		is_written = fwrite(img->pixels + img->stride * y, sizeof(pixel_t), (size_t)img->width, fp) == (size_t)img->width;
+	if (fclose(fp) != 0)
+		is_written = false;
+
+	/*
+	 * Replace the entry at once, so that a reader never sees a partial
+	 * file.  A mapping of the old file stays valid.
+	 */
+	if (is_written) {
+#if defined(TARGET_WINDOWS)
+		/* rename() doesn't replace an existing file. */
+		remove(path);
+#endif
+		is_written = rename(tmp_path, path) == 0;
+	}
+	if (!is_written) {
+		sys_log("Cannot write the image cache \"%s\".\n", path);
+		remove(tmp_path);
+	}
+
+	free(tmp_path);
+}
+
+#ifdef USE_THREADS
+/* Start the decoding threads if not yet. (with the decode mutex locked) */
+static bool image_start_decoders(void)
 {
-	pixel_t *p;
-	uint8_t *pixels;
-	size_t file_size;
-	int width, height;
-	int x, y;
+	while (decoder_count < decode_thread_count) {
+		if (pthread_create(&decoder[decoder_count], NULL, image_decoder_main, NULL) != 0)
+			break;
+		decoder_count++;
+	}
 
-	/* Get metrics. */
-	if (!WebPGetInfo(data, size, &width, &height))
-		return false;
+	return decoder_count > 0;
+}
 
-	/* Create an image. */
-	if (!image_create(width, height, img))
-		return false;
+/* Stop the decoding threads after the queued requests. */
+static void image_stop_decoders(void)
+{
+	int i;
 
-	/* Do decoding. */
-	pixels = WebPDecodeRGBA(data, size, &width, &height);
-	if (pixels == NULL) {
-		image_destroy(*img);
-		*img = NULL;
-		return false;
-	}
+	pthread_mutex_lock(&decode_mutex);
+	is_decode_quitting = true;
+	pthread_cond_broadcast(&decode_cond);
+	pthread_mutex_unlock(&decode_mutex);
 
-	/* Copy pixels. */
-	p = (*img)->pixels;
-#if defined(ORDER_RGBA)
-	/* Use RGBA as is. */
-	for (y = 0; y < height; y++) {
-		for (x = 0; x < width; x++) {
-			*p++ = make_pixel(pixels[y * width * 4 + x * 4 + 3],
-					  pixels[y * width * 4 + x * 4 + 0],
-					  pixels[y * width * 4 + x * 4 + 1],
-					  pixels[y * width * 4 + x * 4 + 2]);
-		}
-	}
-#else
-	/* Reverse the pixel order for OpenGL. (RGB -> BGR) */
-	for (y = 0; y < height; y++) {
-		for (x = 0; x < width; x++) {
-			*p++ = make_pixel(pixels[y * width * 4 + x * 4 + 3],
-					  pixels[y * width * 4 + x * 4 + 2],
-					  pixels[y * width * 4 + x * 4 + 1],
-					  pixels[y * width * 4 + x * 4 + 0]);
-		}
-	}
-#endif
+	for (i = 0; i < decoder_count; i++)
+		pthread_join(decoder[i], NULL);
+	decoder_count = 0;
+	is_decode_quitting = false;
+}
 
-	/* Cleanup. */
-	WebPFree(pixels);
+/* The main function of a decoding thread. */
+static void *image_decoder_main(void *arg)
+{
+	struct image_decode *req;
 
-	return true;
+	UNUSED_PARAMETER(arg);
+
+	pthread_mutex_lock(&decode_mutex);
+	for (;;) {
+		while (decode_head == NULL && !is_decode_quitting)
+			pthread_cond_wait(&decode_cond, &decode_mutex);
+		if (decode_head == NULL)
+			break;
+
+		/* Take a request. */
+		req = decode_head;
+		decode_head = req->next;
+		if (decode_head == NULL)
+			decode_tail = NULL;
+		pthread_mutex_unlock(&decode_mutex);
+
+		image_run_decode(req);
+
+		pthread_mutex_lock(&decode_mutex);
+		image_complete_decode(req);
+	}
+	pthread_mutex_unlock(&decode_mutex);
+
+	return NULL;
 }
+#endif
@@ -0,0 +1,407 @@
+/* -*- coding: utf-8; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * MediaKit
+ * Copyright (c) 2025, Tamako Mori. All rights reserved.
+ */
+
+/*
+ * imagekernel.h: Pixel kernels of the image component.
+ *
+ * A kernel processes one row of pixels.  All kernels use 8.8 fixed-point
+ * math and the SIMD versions produce exactly the same pixels as the
+ * scalar ones in this header, which also process the tail of a row.
+ *
+ * The "pm" kernels take premultiplied source pixels.  They scale all four
+ * channels by the constant alpha, so the per-pixel broadcast of the source
+ * alpha is only needed for the destination factor of the alpha blending.
+ * The "pm_opaque" kernel is the alpha blending at alpha=255, without the
+ * scaling, and stores opaque and clear runs of the source as they are.
+ */
+
+#ifndef MEDIAKIT_IMAGEKERNEL_H
+#define MEDIAKIT_IMAGEKERNEL_H
+
+#include "mediakit/compat.h"
+#include "mediakit/image.h"
+
+/* Mark a function to be compiled for an instruction set extension. */
+#if defined(__GNUC__)
+#define TARGET_SSE2	__attribute__((target("sse2")))
+#define TARGET_AVX2	__attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+/*
+ * Per-pixel math
+ */
+
+/* Divide by 255 with rounding. Exact for x <= 255 * 255. */
+static INLINE uint32_t image_div255(uint32_t x)
+{
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+/* Blend a pixel. (alpha-blending, dst_alpha=255) */
+static INLINE pixel_t image_alpha_pixel(pixel_t d, pixel_t s, uint32_t alpha)
+{
+	uint32_t a, na;
+
+	a = image_div255(alpha * (s >> 24));
+	na = 255 - a;
+
+	return 0xff000000 |
+	       image_div255((s & 0xff) * a + (d & 0xff) * na) |
+	       (image_div255(((s >> 8) & 0xff) * a + ((d >> 8) & 0xff) * na) << 8) |
+	       (image_div255(((s >> 16) & 0xff) * a + ((d >> 16) & 0xff) * na) << 16);
+}
+
+/* Blend a pixel. (add-blending) */
+static INLINE pixel_t image_add_pixel(pixel_t d, pixel_t s, uint32_t alpha)
+{
+	uint32_t a, c0, c1, c2;
+
+	a = image_div255(alpha * (s >> 24));
+
+	c0 = (d & 0xff) + image_div255((s & 0xff) * a);
+	c1 = ((d >> 8) & 0xff) + image_div255(((s >> 8) & 0xff) * a);
+	c2 = ((d >> 16) & 0xff) + image_div255(((s >> 16) & 0xff) * a);
+	if (c0 > 255)
+		c0 = 255;
+	if (c1 > 255)
+		c1 = 255;
+	if (c2 > 255)
+		c2 = 255;
+
+	return 0xff000000 | c0 | (c1 << 8) | (c2 << 16);
+}
+
+/* Blend a pixel. (sub-blending) */
+static INLINE pixel_t image_sub_pixel(pixel_t d, pixel_t s, uint32_t alpha)
+{
+	int32_t a, c0, c1, c2;
+
+	a = (int32_t)image_div255(alpha * (s >> 24));
+
+	c0 = (int32_t)(d & 0xff) - (int32_t)image_div255((s & 0xff) * (uint32_t)a);
+	c1 = (int32_t)((d >> 8) & 0xff) - (int32_t)image_div255(((s >> 8) & 0xff) * (uint32_t)a);
+	c2 = (int32_t)((d >> 16) & 0xff) - (int32_t)image_div255(((s >> 16) & 0xff) * (uint32_t)a);
+	if (c0 < 0)
+		c0 = 0;
+	if (c1 < 0)
+		c1 = 0;
+	if (c2 < 0)
+		c2 = 0;
+
+	return 0xff000000 | (uint32_t)c0 | ((uint32_t)c1 << 8) | ((uint32_t)c2 << 16);
+}
+
+/* Multiply all channels of a pixel by alpha. */
+static INLINE pixel_t image_scale_pixel(pixel_t s, uint32_t alpha)
+{
+	return image_div255((s & 0xff) * alpha) |
+	       (image_div255(((s >> 8) & 0xff) * alpha) << 8) |
+	       (image_div255(((s >> 16) & 0xff) * alpha) << 16) |
+	       (image_div255((s >> 24) * alpha) << 24);
+}
+
+/* Premultiply a pixel by its alpha. */
+static INLINE pixel_t image_premultiply_pixel(pixel_t s)
+{
+	uint32_t a;
+
+	a = s >> 24;
+
+	return (a << 24) |
+	       image_div255((s & 0xff) * a) |
+	       (image_div255(((s >> 8) & 0xff) * a) << 8) |
+	       (image_div255(((s >> 16) & 0xff) * a) << 16);
+}
+
+/* Blend a premultiplied pixel at alpha=255. (alpha-blending, dst_alpha=255) */
+static INLINE pixel_t image_alpha_pm_opaque_pixel(pixel_t d, pixel_t s)
+{
+	uint32_t na, c0, c1, c2;
+
+	na = 255 - (s >> 24);
+
+	c0 = (s & 0xff) + image_div255((d & 0xff) * na);
+	c1 = ((s >> 8) & 0xff) + image_div255(((d >> 8) & 0xff) * na);
+	c2 = ((s >> 16) & 0xff) + image_div255(((d >> 16) & 0xff) * na);
+	if (c0 > 255)
+		c0 = 255;
+	if (c1 > 255)
+		c1 = 255;
+	if (c2 > 255)
+		c2 = 255;
+
+	return 0xff000000 | c0 | (c1 << 8) | (c2 << 16);
+}
+
+/* Blend a premultiplied pixel. (alpha-blending, dst_alpha=255) */
+static INLINE pixel_t image_alpha_pm_pixel(pixel_t d, pixel_t s, uint32_t alpha)
+{
+	return image_alpha_pm_opaque_pixel(d, image_scale_pixel(s, alpha));
+}
+
+/* Blend a premultiplied pixel. (add-blending) */
+static INLINE pixel_t image_add_pm_pixel(pixel_t d, pixel_t s, uint32_t alpha)
+{
+	uint32_t c0, c1, c2;
+
+	s = image_scale_pixel(s, alpha);
+
+	c0 = (d & 0xff) + (s & 0xff);
+	c1 = ((d >> 8) & 0xff) + ((s >> 8) & 0xff);
+	c2 = ((d >> 16) & 0xff) + ((s >> 16) & 0xff);
+	if (c0 > 255)
+		c0 = 255;
+	if (c1 > 255)
+		c1 = 255;
+	if (c2 > 255)
+		c2 = 255;
+
+	return 0xff000000 | c0 | (c1 << 8) | (c2 << 16);
+}
+
+/* Blend a premultiplied pixel. (sub-blending) */
+static INLINE pixel_t image_sub_pm_pixel(pixel_t d, pixel_t s, uint32_t alpha)
+{
+	int32_t c0, c1, c2;
+
+	s = image_scale_pixel(s, alpha);
+
+	c0 = (int32_t)(d & 0xff) - (int32_t)(s & 0xff);
+	c1 = (int32_t)((d >> 8) & 0xff) - (int32_t)((s >> 8) & 0xff);
+	c2 = (int32_t)((d >> 16) & 0xff) - (int32_t)((s >> 16) & 0xff);
+	if (c0 < 0)
+		c0 = 0;
+	if (c1 < 0)
+		c1 = 0;
+	if (c2 < 0)
+		c2 = 0;
+
+	return 0xff000000 | (uint32_t)c0 | ((uint32_t)c1 << 8) | ((uint32_t)c2 << 16);
+}
+
+/*
+ * Porter-Duff factors, where 255 is one:
+ *     Fs = src_base + src_scale * Da
+ *     Fd = dst_base + dst_scale * Sa
+ *  - The bases are 0 or 255, and the scales are -1, 0 or 1.
+ */
+struct image_pd {
+	int32_t src_base;
+	int32_t src_scale;
+	int32_t dst_base;
+	int32_t dst_scale;
+};
+
+/* Premultiply a straight pixel, scaled by a constant alpha. */
+static INLINE pixel_t image_premultiply_alpha_pixel(pixel_t s, uint32_t alpha)
+{
+	return image_scale_pixel(s | 0xff000000, image_div255(alpha * (s >> 24)));
+}
+
+/* Composite a premultiplied pixel on a premultiplied pixel. (R = S * Fs + D * Fd) */
+static INLINE pixel_t image_composite_pixel(pixel_t d, pixel_t s, const struct image_pd *pd)
+{
+	uint32_t fs, fd, c, r;
+	int i;
+
+	fs = (uint32_t)(pd->src_base + pd->src_scale * (int32_t)(d >> 24));
+	fd = (uint32_t)(pd->dst_base + pd->dst_scale * (int32_t)(s >> 24));
+
+	r = 0;
+	for (i = 0; i < 32; i += 8) {
+		c = image_div255(((s >> i) & 0xff) * fs) + image_div255(((d >> i) & 0xff) * fd);
+		if (c > 255)
+			c = 255;
+		r |= c << i;
+	}
+
+	return r;
+}
+
+/* Interpolate two pixels by an 8-bit weight of the second one. */
+static INLINE pixel_t image_lerp_pixel(pixel_t a, pixel_t b, uint32_t w)
+{
+	uint32_t nw;
+
+	nw = 256 - w;
+
+	return (((a & 0xff) * nw + (b & 0xff) * w + 128) >> 8) |
+	       (((((a >> 8) & 0xff) * nw + ((b >> 8) & 0xff) * w + 128) >> 8) << 8) |
+	       (((((a >> 16) & 0xff) * nw + ((b >> 16) & 0xff) * w + 128) >> 8) << 16) |
+	       ((((a >> 24) * nw + (b >> 24) * w + 128) >> 8) << 24);
+}
+
+/*
+ * Get the 8-bit weight of a rule value.
+ *  - The weight ramps from 0 to 255 while the rule value goes down from
+ *    pos to pos - limit.
+ *  - gain is ceil(255 * 256 / limit), so that the top of the ramp is
+ *    exactly 255 and a product fits in 16 bits.
+ */
+static INLINE uint32_t image_rule_weight(uint32_t rule, uint32_t pos, uint32_t limit, uint32_t gain)
+{
+	int32_t d;
+
+	d = (int32_t)pos - (int32_t)rule;
+	if (d < 0)
+		d = 0;
+	if (d > (int32_t)limit)
+		d = (int32_t)limit;
+
+	return ((uint32_t)d * gain) >> 8;
+}
+
+/*
+ * Get a sample position from a 16.16 coordinate.
+ *  - The left and right edges are clamped and get the weight zero.
+ */
+static INLINE void image_sample_pos(int32_t f, int max, int *pos, uint32_t *w)
+{
+	if (f <= 0) {
+		*pos = 0;
+		*w = 0;
+		return;
+	}
+	*pos = f >> 16;
+	*w = ((uint32_t)f >> 8) & 0xff;
+	if (*pos >= max) {
+		*pos = max;
+		*w = 0;
+	}
+}
+
+/* Interpolate four pixels by 8-bit weights. (the same math as two passes) */
+static INLINE pixel_t image_bilinear_pixel(const pixel_t *p, int pitch, int i, uint32_t wx, int j, uint32_t wy)
+{
+	const pixel_t *r0, *r1;
+	pixel_t top, bottom;
+
+	/* Don't touch the neighbors of weight zero, they may be outside. */
+	r0 = p + pitch * j;
+	r1 = wy != 0 ? r0 + pitch : r0;
+	top = image_lerp_pixel(r0[i], r0[i + (wx != 0)], wx);
+	bottom = image_lerp_pixel(r1[i], r1[i + (wx != 0)], wx);
+
+	return image_lerp_pixel(top, bottom, wy);
+}
+
+/*
+ * Row kernels
+ */
+
+/* Type of a row kernel. */
+typedef void (*image_row_func)(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+
+/* Type of a kernel to interpolate two rows. (a and b may be the same) */
+typedef void (*image_lerp_func)(pixel_t * RESTRICT dst, const pixel_t *a, const pixel_t *b, int width, uint32_t w);
+
+/*
+ * Type of a kernel to resample a row by 16.16 stepping.
+ *  - src[max_x + 1] must be readable for the bilinear kernels.
+ */
+typedef void (*image_resample_func)(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, int32_t fx, int32_t step, int max_x);
+
+/*
+ * Type of a kernel to sample a row along a line in a source rectangle.
+ *  - (fu, fv) is a 16.16 position, stepped by (du, dv) for each pixel.
+ */
+typedef void (*image_affine_func)(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int pitch, int width, int32_t fu, int32_t fv, int32_t du, int32_t dv, int max_u, int max_v);
+
+/*
+ * Type of a kernel to expand packed 3-byte pixels to opaque pixels.
+ * The rgb kernels keep the byte order and the bgr ones swap the first
+ * and the third bytes.
+ */
+typedef void (*image_expand_func)(pixel_t * RESTRICT dst, const uint8_t * RESTRICT src, int width);
+
+/*
+ * Type of a kernel to alpha-blend a row by weights from a rule row.
+ *  - The weight of a pixel is image_rule_weight() of the low byte of
+ *    the rule pixel.
+ */
+typedef void (*image_rule_func)(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, const pixel_t * RESTRICT rule, int width, uint32_t pos, uint32_t limit, uint32_t gain);
+
+/* Type of a kernel to composite a row by Porter-Duff factors on a premultiplied row. */
+typedef void (*image_composite_func)(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha, const struct image_pd *pd);
+
+/* Scalar */
+void image_alpha_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+void image_add_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+void image_sub_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+void image_alpha_pm_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+void image_alpha_pm_opaque_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+void image_add_pm_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+void image_sub_pm_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+void image_lerp_row_c(pixel_t * RESTRICT dst, const pixel_t *a, const pixel_t *b, int width, uint32_t w);
+void image_bilinear_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, int32_t fx, int32_t step, int max_x);
+void image_nearest_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, int32_t fx, int32_t step, int max_x);
+void image_affine_nearest_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int pitch, int width, int32_t fu, int32_t fv, int32_t du, int32_t dv, int max_u, int max_v);
+void image_affine_bilinear_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int pitch, int width, int32_t fu, int32_t fv, int32_t du, int32_t dv, int max_u, int max_v);
+void image_expand_rgb_row_c(pixel_t * RESTRICT dst, const uint8_t * RESTRICT src, int width);
+void image_expand_bgr_row_c(pixel_t * RESTRICT dst, const uint8_t * RESTRICT src, int width);
+void image_rule_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, const pixel_t * RESTRICT rule, int width, uint32_t pos, uint32_t limit, uint32_t gain);
+void image_rule_pm_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, const pixel_t * RESTRICT rule, int width, uint32_t pos, uint32_t limit, uint32_t gain);
+void image_composite_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha, const struct image_pd *pd);
+void image_composite_pm_row_c(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha, const struct image_pd *pd);
+
+/* x86 SSE2 and AVX2 */
+#if defined(ARCH_X86) || defined(ARCH_X86_64)
+void image_alpha_row_sse2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+void image_add_row_sse2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+void image_sub_row_sse2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+void image_alpha_row_avx2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+void image_add_row_avx2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+void image_sub_row_avx2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+void image_alpha_pm_row_sse2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+void image_alpha_pm_opaque_row_sse2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+void image_add_pm_row_sse2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+void image_sub_pm_row_sse2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+void image_lerp_row_sse2(pixel_t * RESTRICT dst, const pixel_t *a, const pixel_t *b, int width, uint32_t w);
+void image_bilinear_row_sse2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, int32_t fx, int32_t step, int max_x);
+void image_affine_bilinear_row_sse2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int pitch, int width, int32_t fu, int32_t fv, int32_t du, int32_t dv, int max_u, int max_v);
+void image_alpha_pm_row_avx2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+void image_alpha_pm_opaque_row_avx2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+void image_add_pm_row_avx2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+void image_sub_pm_row_avx2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+void image_lerp_row_avx2(pixel_t * RESTRICT dst, const pixel_t *a, const pixel_t *b, int width, uint32_t w);
+void image_expand_rgb_row_avx2(pixel_t * RESTRICT dst, const uint8_t * RESTRICT src, int width);
+void image_expand_bgr_row_avx2(pixel_t * RESTRICT dst, const uint8_t * RESTRICT src, int width);
+void image_rule_row_sse2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, const pixel_t * RESTRICT rule, int width, uint32_t pos, uint32_t limit, uint32_t gain);
+void image_rule_pm_row_sse2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, const pixel_t * RESTRICT rule, int width, uint32_t pos, uint32_t limit, uint32_t gain);
+void image_rule_row_avx2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, const pixel_t * RESTRICT rule, int width, uint32_t pos, uint32_t limit, uint32_t gain);
+void image_rule_pm_row_avx2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, const pixel_t * RESTRICT rule, int width, uint32_t pos, uint32_t limit, uint32_t gain);
+void image_composite_row_sse2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha, const struct image_pd *pd);
+void image_composite_pm_row_sse2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha, const struct image_pd *pd);
+void image_composite_row_avx2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha, const struct image_pd *pd);
+void image_composite_pm_row_avx2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha, const struct image_pd *pd);
+#endif
+
+/* Arm NEON */
+#if defined(ARCH_ARM64)
+void image_alpha_row_neon(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+void image_add_row_neon(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+void image_sub_row_neon(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+void image_alpha_pm_row_neon(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+void image_alpha_pm_opaque_row_neon(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+void image_add_pm_row_neon(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+void image_sub_pm_row_neon(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha);
+void image_lerp_row_neon(pixel_t * RESTRICT dst, const pixel_t *a, const pixel_t *b, int width, uint32_t w);
+void image_bilinear_row_neon(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, int32_t fx, int32_t step, int max_x);
+void image_affine_bilinear_row_neon(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int pitch, int width, int32_t fu, int32_t fv, int32_t du, int32_t dv, int max_u, int max_v);
+void image_expand_rgb_row_neon(pixel_t * RESTRICT dst, const uint8_t * RESTRICT src, int width);
+void image_expand_bgr_row_neon(pixel_t * RESTRICT dst, const uint8_t * RESTRICT src, int width);
+void image_rule_row_neon(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, const pixel_t * RESTRICT rule, int width, uint32_t pos, uint32_t limit, uint32_t gain);
+void image_rule_pm_row_neon(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, const pixel_t * RESTRICT rule, int width, uint32_t pos, uint32_t limit, uint32_t gain);
+void image_composite_row_neon(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha, const struct image_pd *pd);
+void image_composite_pm_row_neon(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha, const struct image_pd *pd);
+#endif
+
+#endif
@@ -0,0 +1,523 @@
+/* -*- coding: utf-8; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * MediaKit
+ * Copyright (c) 2025, Tamako Mori. All rights reserved.
+ */
+
+/*
+ * imageneon.c: Arm NEON kernels of the image component.
+ *
+ * Four pixels are loaded at once and widened to two vectors of 16-bit
+ * lanes, the same math as imagex86.c.
+ */
+
+#include "mediakit/mediakit.h"
+#include "imagekernel.h"
+
+#if defined(ARCH_ARM64)
+
+#include <arm_neon.h>
+
+/* Table to broadcast the alpha byte of each pixel. */
+static const uint8_t alpha_index[16] = {
+	3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15,
+};
+
+/* Table to spread the weight byte of each pixel. */
+static const uint8_t weight_index[16] = {
+	0, 0, 0, 0, 4, 4, 4, 4, 8, 8, 8, 8, 12, 12, 12, 12,
+};
+
+/* Divide 16-bit lanes by 255 with rounding. */
+static INLINE uint16x8_t div255_neon(uint16x8_t x)
+{
+	x = vaddq_u16(x, vdupq_n_u16(128));
+	return vshrq_n_u16(vsraq_n_u16(x, x, 8), 8);
+}
+
+/* Get effective alphas of four source pixels. */
+static INLINE void alpha_neon(uint8x16_t s, uint16x8_t alpha, uint16x8_t *lo, uint16x8_t *hi)
+{
+	uint8x16_t a;
+
+	a = vqtbl1q_u8(s, vld1q_u8(alpha_index));
+	*lo = div255_neon(vmulq_u16(vmovl_u8(vget_low_u8(a)), alpha));
+	*hi = div255_neon(vmulq_u16(vmovl_u8(vget_high_u8(a)), alpha));
+}
+
+/* Multiply all channels of four pixels by a constant alpha. */
+static INLINE uint8x16_t mul_neon(uint8x16_t s, uint16x8_t alpha)
+{
+	uint16x8_t lo, hi;
+
+	lo = div255_neon(vmulq_u16(vmovl_u8(vget_low_u8(s)), alpha));
+	hi = div255_neon(vmulq_u16(vmovl_u8(vget_high_u8(s)), alpha));
+
+	return vcombine_u8(vmovn_u16(lo), vmovn_u16(hi));
+}
+
+/* Multiply four source pixels by their effective alphas. */
+static INLINE uint8x16_t scale_neon(uint8x16_t s, uint16x8_t alpha)
+{
+	uint16x8_t alo, ahi, lo, hi;
+
+	alpha_neon(s, alpha, &alo, &ahi);
+	lo = div255_neon(vmulq_u16(vmovl_u8(vget_low_u8(s)), alo));
+	hi = div255_neon(vmulq_u16(vmovl_u8(vget_high_u8(s)), ahi));
+
+	return vcombine_u8(vmovn_u16(lo), vmovn_u16(hi));
+}
+
+/* Alpha-blend a row. */
+void image_alpha_row_neon(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	uint16x8_t va, c255, alo, ahi, lo, hi;
+	uint8x16_t s, d;
+	uint32x4_t opaque;
+	int x;
+
+	va = vdupq_n_u16((uint16_t)alpha);
+	c255 = vdupq_n_u16(255);
+	opaque = vdupq_n_u32(0xff000000);
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		s = vreinterpretq_u8_u32(vld1q_u32(src + x));
+		d = vreinterpretq_u8_u32(vld1q_u32(dst + x));
+		alpha_neon(s, va, &alo, &ahi);
+		lo = vmlaq_u16(vmulq_u16(vmovl_u8(vget_low_u8(s)), alo),
+			       vmovl_u8(vget_low_u8(d)), vsubq_u16(c255, alo));
+		hi = vmlaq_u16(vmulq_u16(vmovl_u8(vget_high_u8(s)), ahi),
+			       vmovl_u8(vget_high_u8(d)), vsubq_u16(c255, ahi));
+		d = vcombine_u8(vmovn_u16(div255_neon(lo)), vmovn_u16(div255_neon(hi)));
+		vst1q_u32(dst + x, vorrq_u32(vreinterpretq_u32_u8(d), opaque));
+	}
+	for (; x < width; x++)
+		dst[x] = image_alpha_pixel(dst[x], src[x], alpha);
+}
+
+/* Add-blend a row. */
+void image_add_row_neon(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	uint16x8_t va;
+	uint8x16_t s, d;
+	uint32x4_t opaque;
+	int x;
+
+	va = vdupq_n_u16((uint16_t)alpha);
+	opaque = vdupq_n_u32(0xff000000);
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		s = scale_neon(vreinterpretq_u8_u32(vld1q_u32(src + x)), va);
+		d = vqaddq_u8(vreinterpretq_u8_u32(vld1q_u32(dst + x)), s);
+		vst1q_u32(dst + x, vorrq_u32(vreinterpretq_u32_u8(d), opaque));
+	}
+	for (; x < width; x++)
+		dst[x] = image_add_pixel(dst[x], src[x], alpha);
+}
+
+/* Sub-blend a row. */
+void image_sub_row_neon(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	uint16x8_t va;
+	uint8x16_t s, d;
+	uint32x4_t opaque;
+	int x;
+
+	va = vdupq_n_u16((uint16_t)alpha);
+	opaque = vdupq_n_u32(0xff000000);
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		s = scale_neon(vreinterpretq_u8_u32(vld1q_u32(src + x)), va);
+		d = vqsubq_u8(vreinterpretq_u8_u32(vld1q_u32(dst + x)), s);
+		vst1q_u32(dst + x, vorrq_u32(vreinterpretq_u32_u8(d), opaque));
+	}
+	for (; x < width; x++)
+		dst[x] = image_sub_pixel(dst[x], src[x], alpha);
+}
+
+/* Alpha-blend a row of premultiplied pixels. */
+void image_alpha_pm_row_neon(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	uint16x8_t va, lo, hi;
+	uint8x16_t s, d, na;
+	uint32x4_t opaque;
+	int x;
+
+	va = vdupq_n_u16((uint16_t)alpha);
+	opaque = vdupq_n_u32(0xff000000);
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		s = mul_neon(vreinterpretq_u8_u32(vld1q_u32(src + x)), va);
+		d = vreinterpretq_u8_u32(vld1q_u32(dst + x));
+		na = vmvnq_u8(vqtbl1q_u8(s, vld1q_u8(alpha_index)));
+		lo = div255_neon(vmull_u8(vget_low_u8(d), vget_low_u8(na)));
+		hi = div255_neon(vmull_u8(vget_high_u8(d), vget_high_u8(na)));
+		d = vqaddq_u8(vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)), s);
+		vst1q_u32(dst + x, vorrq_u32(vreinterpretq_u32_u8(d), opaque));
+	}
+	for (; x < width; x++)
+		dst[x] = image_alpha_pm_pixel(dst[x], src[x], alpha);
+}
+
+/* Alpha-blend a row of premultiplied pixels at alpha=255. */
+void image_alpha_pm_opaque_row_neon(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	uint16x8_t lo, hi;
+	uint32x4_t sv, opaque;
+	uint8x16_t s, d, na;
+	int x;
+
+	UNUSED_PARAMETER(alpha);
+
+	opaque = vdupq_n_u32(0xff000000);
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		sv = vld1q_u32(src + x);
+
+		/* Four opaque pixels replace the destination. */
+		if (vminvq_u32(sv) >= 0xff000000) {
+			vst1q_u32(dst + x, sv);
+			continue;
+		}
+
+		d = vreinterpretq_u8_u32(vld1q_u32(dst + x));
+
+		/* Four clear pixels leave it. */
+		if (vmaxvq_u32(sv) != 0) {
+			s = vreinterpretq_u8_u32(sv);
+			na = vmvnq_u8(vqtbl1q_u8(s, vld1q_u8(alpha_index)));
+			lo = div255_neon(vmull_u8(vget_low_u8(d), vget_low_u8(na)));
+			hi = div255_neon(vmull_u8(vget_high_u8(d), vget_high_u8(na)));
+			d = vqaddq_u8(vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)), s);
+		}
+		vst1q_u32(dst + x, vorrq_u32(vreinterpretq_u32_u8(d), opaque));
+	}
+	for (; x < width; x++)
+		dst[x] = image_alpha_pm_opaque_pixel(dst[x], src[x]);
+}
+
+/* Add-blend a row of premultiplied pixels. */
+void image_add_pm_row_neon(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	uint16x8_t va;
+	uint8x16_t s, d;
+	uint32x4_t opaque;
+	int x;
+
+	va = vdupq_n_u16((uint16_t)alpha);
+	opaque = vdupq_n_u32(0xff000000);
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		s = mul_neon(vreinterpretq_u8_u32(vld1q_u32(src + x)), va);
+		d = vqaddq_u8(vreinterpretq_u8_u32(vld1q_u32(dst + x)), s);
+		vst1q_u32(dst + x, vorrq_u32(vreinterpretq_u32_u8(d), opaque));
+	}
+	for (; x < width; x++)
+		dst[x] = image_add_pm_pixel(dst[x], src[x], alpha);
+}
+
+/* Sub-blend a row of premultiplied pixels. */
+void image_sub_pm_row_neon(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	uint16x8_t va;
+	uint8x16_t s, d;
+	uint32x4_t opaque;
+	int x;
+
+	va = vdupq_n_u16((uint16_t)alpha);
+	opaque = vdupq_n_u32(0xff000000);
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		s = mul_neon(vreinterpretq_u8_u32(vld1q_u32(src + x)), va);
+		d = vqsubq_u8(vreinterpretq_u8_u32(vld1q_u32(dst + x)), s);
+		vst1q_u32(dst + x, vorrq_u32(vreinterpretq_u32_u8(d), opaque));
+	}
+	for (; x < width; x++)
+		dst[x] = image_sub_pm_pixel(dst[x], src[x], alpha);
+}
+
+/* Interpolate two rows. */
+void image_lerp_row_neon(pixel_t * RESTRICT dst, const pixel_t *a, const pixel_t *b, int width, uint32_t w)
+{
+	uint16x8_t vw, vnw, lo, hi;
+	uint8x16_t va, vb;
+	int x;
+
+	vw = vdupq_n_u16((uint16_t)w);
+	vnw = vdupq_n_u16((uint16_t)(256 - w));
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		va = vreinterpretq_u8_u32(vld1q_u32(a + x));
+		vb = vreinterpretq_u8_u32(vld1q_u32(b + x));
+		lo = vmlaq_u16(vmulq_u16(vmovl_u8(vget_low_u8(va)), vnw), vmovl_u8(vget_low_u8(vb)), vw);
+		hi = vmlaq_u16(vmulq_u16(vmovl_u8(vget_high_u8(va)), vnw), vmovl_u8(vget_high_u8(vb)), vw);
+		va = vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8));
+		vst1q_u32(dst + x, vreinterpretq_u32_u8(va));
+	}
+	for (; x < width; x++)
+		dst[x] = image_lerp_pixel(a[x], b[x], w);
+}
+
+/* Resample a row with bilinear filtering. */
+void image_bilinear_row_neon(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, int32_t fx, int32_t step, int max_x)
+{
+	uint16x8_t p0, p1;
+	uint16x4_t r0, r1;
+	uint32_t w0, w1;
+	int x, i0, i1;
+
+	for (x = 0; x + 2 <= width; x += 2) {
+		image_sample_pos(fx, max_x, &i0, &w0);
+		fx += step;
+		image_sample_pos(fx, max_x, &i1, &w1);
+		fx += step;
+
+		/* Load the neighbor pairs and weight them. */
+		p0 = vmovl_u8(vreinterpret_u8_u32(vld1_u32(src + i0)));
+		p1 = vmovl_u8(vreinterpret_u8_u32(vld1_u32(src + i1)));
+		p0 = vmulq_u16(p0, vcombine_u16(vdup_n_u16((uint16_t)(256 - w0)), vdup_n_u16((uint16_t)w0)));
+		p1 = vmulq_u16(p1, vcombine_u16(vdup_n_u16((uint16_t)(256 - w1)), vdup_n_u16((uint16_t)w1)));
+
+		/* Add the left and right halves. */
+		r0 = vadd_u16(vget_low_u16(p0), vget_high_u16(p0));
+		r1 = vadd_u16(vget_low_u16(p1), vget_high_u16(p1));
+		vst1_u32(dst + x, vreinterpret_u32_u8(vrshrn_n_u16(vcombine_u16(r0, r1), 8)));
+	}
+	for (; x < width; x++) {
+		image_sample_pos(fx, max_x, &i0, &w0);
+		fx += step;
+		dst[x] = image_lerp_pixel(src[i0], src[i0 + 1], w0);
+	}
+}
+
+/* Sample a row along a line with bilinear filtering. */
+void image_affine_bilinear_row_neon(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int pitch, int width, int32_t fu, int32_t fv, int32_t du, int32_t dv, int max_u, int max_v)
+{
+	const pixel_t *r0, *r1;
+	uint16x8_t top, bottom;
+	uint16x4_t t, b;
+	uint8x8_t r;
+	uint32x2_t p0, p1;
+	uint32_t wx, wy;
+	int x, i, j, i1;
+
+	for (x = 0; x < width; x++) {
+		image_sample_pos(fu, max_u, &i, &wx);
+		image_sample_pos(fv, max_v, &j, &wy);
+		fu += du;
+		fv += dv;
+
+		/* Load the four neighbors, not touching ones of weight zero. */
+		r0 = src + pitch * j;
+		r1 = wy != 0 ? r0 + pitch : r0;
+		i1 = i + (wx != 0);
+		p0 = vset_lane_u32(r0[i1], vdup_n_u32(r0[i]), 1);
+		p1 = vset_lane_u32(r1[i1], vdup_n_u32(r1[i]), 1);
+
+		/* Interpolate columns of the two rows. */
+		top = vmulq_u16(vmovl_u8(vreinterpret_u8_u32(p0)), vcombine_u16(vdup_n_u16((uint16_t)(256 - wx)), vdup_n_u16((uint16_t)wx)));
+		bottom = vmulq_u16(vmovl_u8(vreinterpret_u8_u32(p1)), vcombine_u16(vdup_n_u16((uint16_t)(256 - wx)), vdup_n_u16((uint16_t)wx)));
+		t = vrshr_n_u16(vadd_u16(vget_low_u16(top), vget_high_u16(top)), 8);
+		b = vrshr_n_u16(vadd_u16(vget_low_u16(bottom), vget_high_u16(bottom)), 8);
+
+		/* Interpolate the rows. */
+		t = vmla_u16(vmul_u16(t, vdup_n_u16((uint16_t)(256 - wy))), b, vdup_n_u16((uint16_t)wy));
+		r = vrshrn_n_u16(vcombine_u16(t, t), 8);
+		dst[x] = vget_lane_u32(vreinterpret_u32_u8(r), 0);
+	}
+}
+
+/* Expand a row of 3-byte pixels, keeping the byte order. */
+void image_expand_rgb_row_neon(pixel_t * RESTRICT dst, const uint8_t * RESTRICT src, int width)
+{
+	uint8x16x3_t s;
+	uint8x16x4_t d;
+	int x;
+
+	d.val[3] = vdupq_n_u8(0xff);
+	for (x = 0; x + 16 <= width; x += 16) {
+		s = vld3q_u8(src + x * 3);
+		d.val[0] = s.val[0];
+		d.val[1] = s.val[1];
+		d.val[2] = s.val[2];
+		vst4q_u8((uint8_t *)(dst + x), d);
+	}
+	image_expand_rgb_row_c(dst + x, src + x * 3, width - x);
+}
+
+/* Expand a row of 3-byte pixels, swapping the first and the third bytes. */
+void image_expand_bgr_row_neon(pixel_t * RESTRICT dst, const uint8_t * RESTRICT src, int width)
+{
+	uint8x16x3_t s;
+	uint8x16x4_t d;
+	int x;
+
+	d.val[3] = vdupq_n_u8(0xff);
+	for (x = 0; x + 16 <= width; x += 16) {
+		s = vld3q_u8(src + x * 3);
+		d.val[0] = s.val[2];
+		d.val[1] = s.val[1];
+		d.val[2] = s.val[0];
+		vst4q_u8((uint8_t *)(dst + x), d);
+	}
+	image_expand_bgr_row_c(dst + x, src + x * 3, width - x);
+}
+
+/* Get the weights of four rule pixels, spread to all the bytes of each pixel. */
+static INLINE uint8x16_t rule_weight_neon(uint32x4_t r, int32x4_t pos, int32x4_t limit, uint32x4_t gain)
+{
+	int32x4_t d;
+	uint32x4_t w;
+
+	d = vsubq_s32(pos, vreinterpretq_s32_u32(vandq_u32(r, vdupq_n_u32(0xff))));
+	d = vminq_s32(vmaxq_s32(d, vdupq_n_s32(0)), limit);
+	w = vshrq_n_u32(vmulq_u32(vreinterpretq_u32_s32(d), gain), 8);
+
+	return vqtbl1q_u8(vreinterpretq_u8_u32(w), vld1q_u8(weight_index));
+}
+
+/* Alpha-blend a row by weights from a rule row. */
+void image_rule_row_neon(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, const pixel_t * RESTRICT rule, int width, uint32_t pos, uint32_t limit, uint32_t gain)
+{
+	int32x4_t vpos, vlimit;
+	uint32x4_t vgain, opaque;
+	uint16x8_t c255, alo, ahi, lo, hi;
+	uint8x16_t s, d, w, a;
+	int x;
+
+	vpos = vdupq_n_s32((int32_t)pos);
+	vlimit = vdupq_n_s32((int32_t)limit);
+	vgain = vdupq_n_u32(gain);
+	c255 = vdupq_n_u16(255);
+	opaque = vdupq_n_u32(0xff000000);
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		s = vreinterpretq_u8_u32(vld1q_u32(src + x));
+		d = vreinterpretq_u8_u32(vld1q_u32(dst + x));
+		w = rule_weight_neon(vld1q_u32(rule + x), vpos, vlimit, vgain);
+		a = vqtbl1q_u8(s, vld1q_u8(alpha_index));
+		alo = div255_neon(vmull_u8(vget_low_u8(a), vget_low_u8(w)));
+		ahi = div255_neon(vmull_u8(vget_high_u8(a), vget_high_u8(w)));
+		lo = vmlaq_u16(vmulq_u16(vmovl_u8(vget_low_u8(s)), alo),
+			       vmovl_u8(vget_low_u8(d)), vsubq_u16(c255, alo));
+		hi = vmlaq_u16(vmulq_u16(vmovl_u8(vget_high_u8(s)), ahi),
+			       vmovl_u8(vget_high_u8(d)), vsubq_u16(c255, ahi));
+		d = vcombine_u8(vmovn_u16(div255_neon(lo)), vmovn_u16(div255_neon(hi)));
+		vst1q_u32(dst + x, vorrq_u32(vreinterpretq_u32_u8(d), opaque));
+	}
+	for (; x < width; x++)
+		dst[x] = image_alpha_pixel(dst[x], src[x], image_rule_weight(rule[x] & 0xff, pos, limit, gain));
+}
+
+/* Alpha-blend a row of premultiplied pixels by weights from a rule row. */
+void image_rule_pm_row_neon(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, const pixel_t * RESTRICT rule, int width, uint32_t pos, uint32_t limit, uint32_t gain)
+{
+	int32x4_t vpos, vlimit;
+	uint32x4_t vgain, opaque;
+	uint16x8_t lo, hi;
+	uint8x16_t s, d, w, na;
+	int x;
+
+	vpos = vdupq_n_s32((int32_t)pos);
+	vlimit = vdupq_n_s32((int32_t)limit);
+	vgain = vdupq_n_u32(gain);
+	opaque = vdupq_n_u32(0xff000000);
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		s = vreinterpretq_u8_u32(vld1q_u32(src + x));
+		d = vreinterpretq_u8_u32(vld1q_u32(dst + x));
+		w = rule_weight_neon(vld1q_u32(rule + x), vpos, vlimit, vgain);
+		lo = div255_neon(vmull_u8(vget_low_u8(s), vget_low_u8(w)));
+		hi = div255_neon(vmull_u8(vget_high_u8(s), vget_high_u8(w)));
+		s = vcombine_u8(vmovn_u16(lo), vmovn_u16(hi));
+		na = vmvnq_u8(vqtbl1q_u8(s, vld1q_u8(alpha_index)));
+		lo = div255_neon(vmull_u8(vget_low_u8(d), vget_low_u8(na)));
+		hi = div255_neon(vmull_u8(vget_high_u8(d), vget_high_u8(na)));
+		d = vqaddq_u8(vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)), s);
+		vst1q_u32(dst + x, vorrq_u32(vreinterpretq_u32_u8(d), opaque));
+	}
+	for (; x < width; x++)
+		dst[x] = image_alpha_pm_pixel(dst[x], src[x], image_rule_weight(rule[x] & 0xff, pos, limit, gain));
+}
+
+/* Composite four premultiplied pixels by Porter-Duff factors. (sb, ss, db, ds in f) */
+static INLINE uint8x16_t composite_neon(uint8x16_t d, uint8x16_t s, const uint16x8_t *f)
+{
+	uint8x16_t da, sa;
+	uint16x8_t fs, fd, lo, hi;
+
+	/* A scale of -1 wraps around in 16 bits. */
+	da = vqtbl1q_u8(d, vld1q_u8(alpha_index));
+	sa = vqtbl1q_u8(s, vld1q_u8(alpha_index));
+
+	fs = vmlaq_u16(f[0], f[1], vmovl_u8(vget_low_u8(da)));
+	fd = vmlaq_u16(f[2], f[3], vmovl_u8(vget_low_u8(sa)));
+	lo = vaddq_u16(div255_neon(vmulq_u16(vmovl_u8(vget_low_u8(s)), fs)),
+		       div255_neon(vmulq_u16(vmovl_u8(vget_low_u8(d)), fd)));
+
+	fs = vmlaq_u16(f[0], f[1], vmovl_u8(vget_high_u8(da)));
+	fd = vmlaq_u16(f[2], f[3], vmovl_u8(vget_high_u8(sa)));
+	hi = vaddq_u16(div255_neon(vmulq_u16(vmovl_u8(vget_high_u8(s)), fs)),
+		       div255_neon(vmulq_u16(vmovl_u8(vget_high_u8(d)), fd)));
+
+	return vcombine_u8(vqmovn_u16(lo), vqmovn_u16(hi));
+}
+
+/* Composite a row on a premultiplied row. */
+void image_composite_row_neon(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha, const struct image_pd *pd)
+{
+	uint16x8_t f[4], va, alo, ahi, lo, hi;
+	uint8x16_t s, d;
+	uint32x4_t a255;
+	int x;
+
+	f[0] = vdupq_n_u16((uint16_t)pd->src_base);
+	f[1] = vdupq_n_u16((uint16_t)pd->src_scale);
+	f[2] = vdupq_n_u16((uint16_t)pd->dst_base);
+	f[3] = vdupq_n_u16((uint16_t)pd->dst_scale);
+	va = vdupq_n_u16((uint16_t)alpha);
+	a255 = vdupq_n_u32(0xff000000);
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		s = vreinterpretq_u8_u32(vld1q_u32(src + x));
+		d = vreinterpretq_u8_u32(vld1q_u32(dst + x));
+
+		/* Premultiply the source, making the alpha bytes the effective alphas. */
+		alpha_neon(s, va, &alo, &ahi);
+		s = vreinterpretq_u8_u32(vorrq_u32(vreinterpretq_u32_u8(s), a255));
+		lo = div255_neon(vmulq_u16(vmovl_u8(vget_low_u8(s)), alo));
+		hi = div255_neon(vmulq_u16(vmovl_u8(vget_high_u8(s)), ahi));
+		s = vcombine_u8(vmovn_u16(lo), vmovn_u16(hi));
+
+		d = composite_neon(d, s, f);
+		vst1q_u32(dst + x, vreinterpretq_u32_u8(d));
+	}
+	for (; x < width; x++)
+		dst[x] = image_composite_pixel(dst[x], image_premultiply_alpha_pixel(src[x], alpha), pd);
+}
+
+/* Composite a row of premultiplied pixels on a premultiplied row. */
+void image_composite_pm_row_neon(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha, const struct image_pd *pd)
+{
+	uint16x8_t f[4], va;
+	uint8x16_t s, d;
+	int x;
+
+	f[0] = vdupq_n_u16((uint16_t)pd->src_base);
+	f[1] = vdupq_n_u16((uint16_t)pd->src_scale);
+	f[2] = vdupq_n_u16((uint16_t)pd->dst_base);
+	f[3] = vdupq_n_u16((uint16_t)pd->dst_scale);
+	va = vdupq_n_u16((uint16_t)alpha);
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		s = mul_neon(vreinterpretq_u8_u32(vld1q_u32(src + x)), va);
+		d = vreinterpretq_u8_u32(vld1q_u32(dst + x));
+		d = composite_neon(d, s, f);
+		vst1q_u32(dst + x, vreinterpretq_u32_u8(d));
+	}
+	for (; x < width; x++)
+		dst[x] = image_composite_pixel(dst[x], image_scale_pixel(src[x], alpha), pd);
+}
+
+#endif /* defined(ARCH_ARM64) */
@@ -0,0 +1,914 @@
+/* -*- coding: utf-8; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * MediaKit
+ * Copyright (c) 2025, Tamako Mori. All rights reserved.
+ */
+
+/*
+ * imagex86.c: SSE2 and AVX2 kernels of the image component.
+ *
+ * Pixels are unpacked to 16-bit lanes, so that a 128-bit register holds
+ * two pixels and a product of two 8-bit values fits in a lane.  The
+ * order of channels doesn't matter as long as the alpha is the top byte.
+ */
+
+#include "mediakit/mediakit.h"
+#include "imagekernel.h"
+
+#if defined(ARCH_X86) || defined(ARCH_X86_64)
+
+#include <emmintrin.h>	/* SSE2 */
+#include <immintrin.h>	/* AVX2 */
+
+/*
+ * SSE2
+ */
+
+/* Divide 16-bit lanes by 255 with rounding. */
+static INLINE TARGET_SSE2 __m128i div255_sse2(__m128i x)
+{
+	x = _mm_add_epi16(x, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+/* Broadcast the alpha lanes of two unpacked pixels to the color lanes. */
+static INLINE TARGET_SSE2 __m128i broadcast_alpha_sse2(__m128i s)
+{
+	s = _mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3));
+	return _mm_shufflehi_epi16(s, _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+/* Get effective alphas of two unpacked source pixels. */
+static INLINE TARGET_SSE2 __m128i alpha_sse2(__m128i s, __m128i alpha)
+{
+	return div255_sse2(_mm_mullo_epi16(broadcast_alpha_sse2(s), alpha));
+}
+
+/* Alpha-blend two unpacked pixels. */
+static INLINE TARGET_SSE2 __m128i blend_alpha_sse2(__m128i d, __m128i s, __m128i alpha)
+{
+	__m128i a, na;
+
+	a = alpha_sse2(s, alpha);
+	na = _mm_sub_epi16(_mm_set1_epi16(255), a);
+
+	return div255_sse2(_mm_add_epi16(_mm_mullo_epi16(s, a), _mm_mullo_epi16(d, na)));
+}
+
+/* Multiply two unpacked source pixels by their effective alphas. */
+static INLINE TARGET_SSE2 __m128i scale_sse2(__m128i s, __m128i alpha)
+{
+	return div255_sse2(_mm_mullo_epi16(s, alpha_sse2(s, alpha)));
+}
+
+/* Alpha-blend a row. */
+TARGET_SSE2
+void image_alpha_row_sse2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	__m128i zero, va, opaque, s, d, lo, hi;
+	int x;
+
+	zero = _mm_setzero_si128();
+	va = _mm_set1_epi16((short)alpha);
+	opaque = _mm_set1_epi32((int)0xff000000);
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		s = _mm_loadu_si128((const __m128i *)(src + x));
+		d = _mm_loadu_si128((const __m128i *)(dst + x));
+		lo = blend_alpha_sse2(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(s, zero), va);
+		hi = blend_alpha_sse2(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(s, zero), va);
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_or_si128(_mm_packus_epi16(lo, hi), opaque));
+	}
+	for (; x < width; x++)
+		dst[x] = image_alpha_pixel(dst[x], src[x], alpha);
+}
+
+/* Add-blend a row. */
+TARGET_SSE2
+void image_add_row_sse2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	__m128i zero, va, opaque, s, lo, hi;
+	int x;
+
+	zero = _mm_setzero_si128();
+	va = _mm_set1_epi16((short)alpha);
+	opaque = _mm_set1_epi32((int)0xff000000);
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		s = _mm_loadu_si128((const __m128i *)(src + x));
+		lo = scale_sse2(_mm_unpacklo_epi8(s, zero), va);
+		hi = scale_sse2(_mm_unpackhi_epi8(s, zero), va);
+		s = _mm_adds_epu8(_mm_loadu_si128((const __m128i *)(dst + x)), _mm_packus_epi16(lo, hi));
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_or_si128(s, opaque));
+	}
+	for (; x < width; x++)
+		dst[x] = image_add_pixel(dst[x], src[x], alpha);
+}
+
+/* Sub-blend a row. */
+TARGET_SSE2
+void image_sub_row_sse2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	__m128i zero, va, opaque, s, lo, hi;
+	int x;
+
+	zero = _mm_setzero_si128();
+	va = _mm_set1_epi16((short)alpha);
+	opaque = _mm_set1_epi32((int)0xff000000);
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		s = _mm_loadu_si128((const __m128i *)(src + x));
+		lo = scale_sse2(_mm_unpacklo_epi8(s, zero), va);
+		hi = scale_sse2(_mm_unpackhi_epi8(s, zero), va);
+		s = _mm_subs_epu8(_mm_loadu_si128((const __m128i *)(dst + x)), _mm_packus_epi16(lo, hi));
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_or_si128(s, opaque));
+	}
+	for (; x < width; x++)
+		dst[x] = image_sub_pixel(dst[x], src[x], alpha);
+}
+
+/* Alpha-blend a row of premultiplied pixels. */
+TARGET_SSE2
+void image_alpha_pm_row_sse2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	__m128i zero, va, c255, opaque, s, d, lo, hi, dlo, dhi;
+	int x;
+
+	zero = _mm_setzero_si128();
+	va = _mm_set1_epi16((short)alpha);
+	c255 = _mm_set1_epi16(255);
+	opaque = _mm_set1_epi32((int)0xff000000);
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		s = _mm_loadu_si128((const __m128i *)(src + x));
+		d = _mm_loadu_si128((const __m128i *)(dst + x));
+		lo = div255_sse2(_mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), va));
+		hi = div255_sse2(_mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), va));
+		dlo = div255_sse2(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(c255, broadcast_alpha_sse2(lo))));
+		dhi = div255_sse2(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(c255, broadcast_alpha_sse2(hi))));
+		s = _mm_adds_epu8(_mm_packus_epi16(dlo, dhi), _mm_packus_epi16(lo, hi));
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_or_si128(s, opaque));
+	}
+	for (; x < width; x++)
+		dst[x] = image_alpha_pm_pixel(dst[x], src[x], alpha);
+}
+
+/* Alpha-blend a row of premultiplied pixels at alpha=255. */
+TARGET_SSE2
+void image_alpha_pm_opaque_row_sse2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	__m128i zero, c255, opaque, s, d, lo, hi;
+	int x;
+
+	UNUSED_PARAMETER(alpha);
+
+	zero = _mm_setzero_si128();
+	c255 = _mm_set1_epi16(255);
+	opaque = _mm_set1_epi32((int)0xff000000);
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		s = _mm_loadu_si128((const __m128i *)(src + x));
+
+		/* Four opaque pixels replace the destination. */
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(s, opaque), opaque)) == 0xffff) {
+			_mm_storeu_si128((__m128i *)(dst + x), s);
+			continue;
+		}
+
+		d = _mm_loadu_si128((const __m128i *)(dst + x));
+
+		/* Four clear pixels leave it. */
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(s, zero)) != 0xffff) {
+			lo = div255_sse2(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(c255, broadcast_alpha_sse2(_mm_unpacklo_epi8(s, zero)))));
+			hi = div255_sse2(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(c255, broadcast_alpha_sse2(_mm_unpackhi_epi8(s, zero)))));
+			d = _mm_adds_epu8(_mm_packus_epi16(lo, hi), s);
+		}
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_or_si128(d, opaque));
+	}
+	for (; x < width; x++)
+		dst[x] = image_alpha_pm_opaque_pixel(dst[x], src[x]);
+}
+
+/* Add-blend a row of premultiplied pixels. */
+TARGET_SSE2
+void image_add_pm_row_sse2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	__m128i zero, va, opaque, s, lo, hi;
+	int x;
+
+	zero = _mm_setzero_si128();
+	va = _mm_set1_epi16((short)alpha);
+	opaque = _mm_set1_epi32((int)0xff000000);
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		s = _mm_loadu_si128((const __m128i *)(src + x));
+		lo = div255_sse2(_mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), va));
+		hi = div255_sse2(_mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), va));
+		s = _mm_adds_epu8(_mm_loadu_si128((const __m128i *)(dst + x)), _mm_packus_epi16(lo, hi));
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_or_si128(s, opaque));
+	}
+	for (; x < width; x++)
+		dst[x] = image_add_pm_pixel(dst[x], src[x], alpha);
+}
+
+/* Sub-blend a row of premultiplied pixels. */
+TARGET_SSE2
+void image_sub_pm_row_sse2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	__m128i zero, va, opaque, s, lo, hi;
+	int x;
+
+	zero = _mm_setzero_si128();
+	va = _mm_set1_epi16((short)alpha);
+	opaque = _mm_set1_epi32((int)0xff000000);
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		s = _mm_loadu_si128((const __m128i *)(src + x));
+		lo = div255_sse2(_mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), va));
+		hi = div255_sse2(_mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), va));
+		s = _mm_subs_epu8(_mm_loadu_si128((const __m128i *)(dst + x)), _mm_packus_epi16(lo, hi));
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_or_si128(s, opaque));
+	}
+	for (; x < width; x++)
+		dst[x] = image_sub_pm_pixel(dst[x], src[x], alpha);
+}
+
+/* Interpolate two rows. */
+TARGET_SSE2
+void image_lerp_row_sse2(pixel_t * RESTRICT dst, const pixel_t *a, const pixel_t *b, int width, uint32_t w)
+{
+	__m128i zero, vw, vnw, round, va, vb, lo, hi;
+	int x;
+
+	zero = _mm_setzero_si128();
+	vw = _mm_set1_epi16((short)w);
+	vnw = _mm_set1_epi16((short)(256 - w));
+	round = _mm_set1_epi16(128);
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		va = _mm_loadu_si128((const __m128i *)(a + x));
+		vb = _mm_loadu_si128((const __m128i *)(b + x));
+		lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), vnw),
+				   _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), vw));
+		hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), vnw),
+				   _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), vw));
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 8);
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(lo, hi));
+	}
+	for (; x < width; x++)
+		dst[x] = image_lerp_pixel(a[x], b[x], w);
+}
+
+/* Resample a row with bilinear filtering. */
+TARGET_SSE2
+void image_bilinear_row_sse2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, int32_t fx, int32_t step, int max_x)
+{
+	__m128i zero, round, p0, p1, r;
+	uint32_t w0, w1;
+	int x, i0, i1;
+
+	zero = _mm_setzero_si128();
+	round = _mm_set1_epi16(128);
+
+	for (x = 0; x + 2 <= width; x += 2) {
+		image_sample_pos(fx, max_x, &i0, &w0);
+		fx += step;
+		image_sample_pos(fx, max_x, &i1, &w1);
+		fx += step;
+
+		/* Load the neighbor pairs and weight them. */
+		p0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(src + i0)), zero);
+		p1 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(src + i1)), zero);
+		p0 = _mm_mullo_epi16(p0, _mm_set_epi16((short)w0, (short)w0, (short)w0, (short)w0,
+						       (short)(256 - w0), (short)(256 - w0), (short)(256 - w0), (short)(256 - w0)));
+		p1 = _mm_mullo_epi16(p1, _mm_set_epi16((short)w1, (short)w1, (short)w1, (short)w1,
+						       (short)(256 - w1), (short)(256 - w1), (short)(256 - w1), (short)(256 - w1)));
+
+		/* Add the left and right halves. */
+		r = _mm_add_epi16(_mm_unpacklo_epi64(p0, p1), _mm_unpackhi_epi64(p0, p1));
+		r = _mm_srli_epi16(_mm_add_epi16(r, round), 8);
+		_mm_storel_epi64((__m128i *)(dst + x), _mm_packus_epi16(r, r));
+	}
+	for (; x < width; x++) {
+		image_sample_pos(fx, max_x, &i0, &w0);
+		fx += step;
+		dst[x] = image_lerp_pixel(src[i0], src[i0 + 1], w0);
+	}
+}
+
+/* Sample a row along a line with bilinear filtering. */
+TARGET_SSE2
+void image_affine_bilinear_row_sse2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int pitch, int width, int32_t fu, int32_t fv, int32_t du, int32_t dv, int max_u, int max_v)
+{
+	const pixel_t *r0, *r1;
+	__m128i zero, round, p, lo, hi, r;
+	uint32_t wx, wy;
+	int x, i, j, i1;
+
+	zero = _mm_setzero_si128();
+	round = _mm_set1_epi16(128);
+
+	for (x = 0; x < width; x++) {
+		image_sample_pos(fu, max_u, &i, &wx);
+		image_sample_pos(fv, max_v, &j, &wy);
+		fu += du;
+		fv += dv;
+
+		/* Load the four neighbors, not touching ones of weight zero. */
+		r0 = src + pitch * j;
+		r1 = wy != 0 ? r0 + pitch : r0;
+		i1 = i + (wx != 0);
+		p = _mm_unpacklo_epi64(_mm_unpacklo_epi32(_mm_cvtsi32_si128((int)r0[i]), _mm_cvtsi32_si128((int)r0[i1])),
+				       _mm_unpacklo_epi32(_mm_cvtsi32_si128((int)r1[i]), _mm_cvtsi32_si128((int)r1[i1])));
+
+		/* Interpolate columns of the two rows. */
+		lo = _mm_set_epi16((short)wx, (short)wx, (short)wx, (short)wx,
+				   (short)(256 - wx), (short)(256 - wx), (short)(256 - wx), (short)(256 - wx));
+		hi = _mm_mullo_epi16(_mm_unpackhi_epi8(p, zero), lo);
+		lo = _mm_mullo_epi16(_mm_unpacklo_epi8(p, zero), lo);
+		r = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+		r = _mm_srli_epi16(_mm_add_epi16(r, round), 8);
+
+		/* Interpolate the rows. */
+		r = _mm_mullo_epi16(r, _mm_set_epi16((short)wy, (short)wy, (short)wy, (short)wy,
+						     (short)(256 - wy), (short)(256 - wy), (short)(256 - wy), (short)(256 - wy)));
+		r = _mm_add_epi16(r, _mm_unpackhi_epi64(r, r));
+		r = _mm_srli_epi16(_mm_add_epi16(r, round), 8);
+		dst[x] = (pixel_t)_mm_cvtsi128_si32(_mm_packus_epi16(r, r));
+	}
+}
+
+/* Get the weights of four rule pixels, in the low 16-bit lane of each pixel. */
+static INLINE TARGET_SSE2 __m128i rule_weight_sse2(__m128i r, __m128i pos, __m128i limit, __m128i gain)
+{
+	__m128i d;
+
+	d = _mm_sub_epi16(pos, _mm_and_si128(r, _mm_set1_epi32(0xff)));
+	d = _mm_min_epi16(_mm_max_epi16(d, _mm_setzero_si128()), limit);
+	return _mm_srli_epi16(_mm_mullo_epi16(d, gain), 8);
+}
+
+/* Spread the weights of two pixels from _mm_unpack*_epi32(w, w) to the unpacked lanes. */
+static INLINE TARGET_SSE2 __m128i spread_weight_sse2(__m128i w)
+{
+	w = _mm_shufflelo_epi16(w, _MM_SHUFFLE(0, 0, 0, 0));
+	return _mm_shufflehi_epi16(w, _MM_SHUFFLE(0, 0, 0, 0));
+}
+
+/* Alpha-blend a row by weights from a rule row. */
+TARGET_SSE2
+void image_rule_row_sse2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, const pixel_t * RESTRICT rule, int width, uint32_t pos, uint32_t limit, uint32_t gain)
+{
+	__m128i zero, vpos, vlimit, vgain, opaque, s, d, w, lo, hi;
+	int x;
+
+	zero = _mm_setzero_si128();
+	vpos = _mm_set1_epi32((int)pos);
+	vlimit = _mm_set1_epi32((int)limit);
+	vgain = _mm_set1_epi32((int)gain);
+	opaque = _mm_set1_epi32((int)0xff000000);
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		s = _mm_loadu_si128((const __m128i *)(src + x));
+		d = _mm_loadu_si128((const __m128i *)(dst + x));
+		w = rule_weight_sse2(_mm_loadu_si128((const __m128i *)(rule + x)), vpos, vlimit, vgain);
+		lo = blend_alpha_sse2(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(s, zero), spread_weight_sse2(_mm_unpacklo_epi32(w, w)));
+		hi = blend_alpha_sse2(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(s, zero), spread_weight_sse2(_mm_unpackhi_epi32(w, w)));
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_or_si128(_mm_packus_epi16(lo, hi), opaque));
+	}
+	for (; x < width; x++)
+		dst[x] = image_alpha_pixel(dst[x], src[x], image_rule_weight(rule[x] & 0xff, pos, limit, gain));
+}
+
+/* Alpha-blend a row of premultiplied pixels by weights from a rule row. */
+TARGET_SSE2
+void image_rule_pm_row_sse2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, const pixel_t * RESTRICT rule, int width, uint32_t pos, uint32_t limit, uint32_t gain)
+{
+	__m128i zero, vpos, vlimit, vgain, c255, opaque, s, d, w, lo, hi, dlo, dhi;
+	int x;
+
+	zero = _mm_setzero_si128();
+	vpos = _mm_set1_epi32((int)pos);
+	vlimit = _mm_set1_epi32((int)limit);
+	vgain = _mm_set1_epi32((int)gain);
+	c255 = _mm_set1_epi16(255);
+	opaque = _mm_set1_epi32((int)0xff000000);
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		s = _mm_loadu_si128((const __m128i *)(src + x));
+		d = _mm_loadu_si128((const __m128i *)(dst + x));
+		w = rule_weight_sse2(_mm_loadu_si128((const __m128i *)(rule + x)), vpos, vlimit, vgain);
+		lo = div255_sse2(_mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), spread_weight_sse2(_mm_unpacklo_epi32(w, w))));
+		hi = div255_sse2(_mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), spread_weight_sse2(_mm_unpackhi_epi32(w, w))));
+		dlo = div255_sse2(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(c255, broadcast_alpha_sse2(lo))));
+		dhi = div255_sse2(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(c255, broadcast_alpha_sse2(hi))));
+		s = _mm_adds_epu8(_mm_packus_epi16(dlo, dhi), _mm_packus_epi16(lo, hi));
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_or_si128(s, opaque));
+	}
+	for (; x < width; x++)
+		dst[x] = image_alpha_pm_pixel(dst[x], src[x], image_rule_weight(rule[x] & 0xff, pos, limit, gain));
+}
+
+/* Composite two unpacked premultiplied pixels by Porter-Duff factors. */
+static INLINE TARGET_SSE2 __m128i composite_sse2(__m128i d, __m128i s, __m128i sb, __m128i ss, __m128i db, __m128i ds)
+{
+	__m128i fs, fd;
+
+	fs = _mm_add_epi16(sb, _mm_mullo_epi16(ss, broadcast_alpha_sse2(d)));
+	fd = _mm_add_epi16(db, _mm_mullo_epi16(ds, broadcast_alpha_sse2(s)));
+
+	return _mm_add_epi16(div255_sse2(_mm_mullo_epi16(s, fs)), div255_sse2(_mm_mullo_epi16(d, fd)));
+}
+
+/* Composite a row on a premultiplied row. */
+TARGET_SSE2
+void image_composite_row_sse2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha, const struct image_pd *pd)
+{
+	__m128i zero, va, a255, sb, ss, db, ds, s, d, lo, hi;
+	int x;
+
+	zero = _mm_setzero_si128();
+	va = _mm_set1_epi16((short)alpha);
+	a255 = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+	sb = _mm_set1_epi16((short)pd->src_base);
+	ss = _mm_set1_epi16((short)pd->src_scale);
+	db = _mm_set1_epi16((short)pd->dst_base);
+	ds = _mm_set1_epi16((short)pd->dst_scale);
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		s = _mm_loadu_si128((const __m128i *)(src + x));
+		d = _mm_loadu_si128((const __m128i *)(dst + x));
+
+		/* Premultiply the source, making the alpha lanes the effective alphas. */
+		lo = _mm_unpacklo_epi8(s, zero);
+		hi = _mm_unpackhi_epi8(s, zero);
+		lo = div255_sse2(_mm_mullo_epi16(_mm_or_si128(lo, a255), alpha_sse2(lo, va)));
+		hi = div255_sse2(_mm_mullo_epi16(_mm_or_si128(hi, a255), alpha_sse2(hi, va)));
+
+		lo = composite_sse2(_mm_unpacklo_epi8(d, zero), lo, sb, ss, db, ds);
+		hi = composite_sse2(_mm_unpackhi_epi8(d, zero), hi, sb, ss, db, ds);
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(lo, hi));
+	}
+	for (; x < width; x++)
+		dst[x] = image_composite_pixel(dst[x], image_premultiply_alpha_pixel(src[x], alpha), pd);
+}
+
+/* Composite a row of premultiplied pixels on a premultiplied row. */
+TARGET_SSE2
+void image_composite_pm_row_sse2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha, const struct image_pd *pd)
+{
+	__m128i zero, va, sb, ss, db, ds, s, d, lo, hi;
+	int x;
+
+	zero = _mm_setzero_si128();
+	va = _mm_set1_epi16((short)alpha);
+	sb = _mm_set1_epi16((short)pd->src_base);
+	ss = _mm_set1_epi16((short)pd->src_scale);
+	db = _mm_set1_epi16((short)pd->dst_base);
+	ds = _mm_set1_epi16((short)pd->dst_scale);
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		s = _mm_loadu_si128((const __m128i *)(src + x));
+		d = _mm_loadu_si128((const __m128i *)(dst + x));
+		lo = div255_sse2(_mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), va));
+		hi = div255_sse2(_mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), va));
+		lo = composite_sse2(_mm_unpacklo_epi8(d, zero), lo, sb, ss, db, ds);
+		hi = composite_sse2(_mm_unpackhi_epi8(d, zero), hi, sb, ss, db, ds);
+		_mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(lo, hi));
+	}
+	for (; x < width; x++)
+		dst[x] = image_composite_pixel(dst[x], image_scale_pixel(src[x], alpha), pd);
+}
+
+/*
+ * AVX2
+ *
+ * The unpack and pack instructions work within 128-bit halves, so the
+ * pixel order is kept as is.
+ */
+
+/* Divide 16-bit lanes by 255 with rounding. */
+static INLINE TARGET_AVX2 __m256i div255_avx2(__m256i x)
+{
+	x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+	return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+/* Broadcast the alpha lanes of four unpacked pixels to the color lanes. */
+static INLINE TARGET_AVX2 __m256i broadcast_alpha_avx2(__m256i s)
+{
+	s = _mm256_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3));
+	return _mm256_shufflehi_epi16(s, _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+/* Get effective alphas of four unpacked source pixels. */
+static INLINE TARGET_AVX2 __m256i alpha_avx2(__m256i s, __m256i alpha)
+{
+	return div255_avx2(_mm256_mullo_epi16(broadcast_alpha_avx2(s), alpha));
+}
+
+/* Alpha-blend four unpacked pixels. */
+static INLINE TARGET_AVX2 __m256i blend_alpha_avx2(__m256i d, __m256i s, __m256i alpha)
+{
+	__m256i a, na;
+
+	a = alpha_avx2(s, alpha);
+	na = _mm256_sub_epi16(_mm256_set1_epi16(255), a);
+
+	return div255_avx2(_mm256_add_epi16(_mm256_mullo_epi16(s, a), _mm256_mullo_epi16(d, na)));
+}
+
+/* Multiply four unpacked source pixels by their effective alphas. */
+static INLINE TARGET_AVX2 __m256i scale_avx2(__m256i s, __m256i alpha)
+{
+	return div255_avx2(_mm256_mullo_epi16(s, alpha_avx2(s, alpha)));
+}
+
+/* Alpha-blend a row. */
+TARGET_AVX2
+void image_alpha_row_avx2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	__m256i zero, va, opaque, s, d, lo, hi;
+	int x;
+
+	zero = _mm256_setzero_si256();
+	va = _mm256_set1_epi16((short)alpha);
+	opaque = _mm256_set1_epi32((int)0xff000000);
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		s = _mm256_loadu_si256((const __m256i *)(src + x));
+		d = _mm256_loadu_si256((const __m256i *)(dst + x));
+		lo = blend_alpha_avx2(_mm256_unpacklo_epi8(d, zero), _mm256_unpacklo_epi8(s, zero), va);
+		hi = blend_alpha_avx2(_mm256_unpackhi_epi8(d, zero), _mm256_unpackhi_epi8(s, zero), va);
+		_mm256_storeu_si256((__m256i *)(dst + x), _mm256_or_si256(_mm256_packus_epi16(lo, hi), opaque));
+	}
+	for (; x < width; x++)
+		dst[x] = image_alpha_pixel(dst[x], src[x], alpha);
+}
+
+/* Add-blend a row. */
+TARGET_AVX2
+void image_add_row_avx2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	__m256i zero, va, opaque, s, lo, hi;
+	int x;
+
+	zero = _mm256_setzero_si256();
+	va = _mm256_set1_epi16((short)alpha);
+	opaque = _mm256_set1_epi32((int)0xff000000);
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		s = _mm256_loadu_si256((const __m256i *)(src + x));
+		lo = scale_avx2(_mm256_unpacklo_epi8(s, zero), va);
+		hi = scale_avx2(_mm256_unpackhi_epi8(s, zero), va);
+		s = _mm256_adds_epu8(_mm256_loadu_si256((const __m256i *)(dst + x)), _mm256_packus_epi16(lo, hi));
+		_mm256_storeu_si256((__m256i *)(dst + x), _mm256_or_si256(s, opaque));
+	}
+	for (; x < width; x++)
+		dst[x] = image_add_pixel(dst[x], src[x], alpha);
+}
+
+/* Sub-blend a row. */
+TARGET_AVX2
+void image_sub_row_avx2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	__m256i zero, va, opaque, s, lo, hi;
+	int x;
+
+	zero = _mm256_setzero_si256();
+	va = _mm256_set1_epi16((short)alpha);
+	opaque = _mm256_set1_epi32((int)0xff000000);
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		s = _mm256_loadu_si256((const __m256i *)(src + x));
+		lo = scale_avx2(_mm256_unpacklo_epi8(s, zero), va);
+		hi = scale_avx2(_mm256_unpackhi_epi8(s, zero), va);
+		s = _mm256_subs_epu8(_mm256_loadu_si256((const __m256i *)(dst + x)), _mm256_packus_epi16(lo, hi));
+		_mm256_storeu_si256((__m256i *)(dst + x), _mm256_or_si256(s, opaque));
+	}
+	for (; x < width; x++)
+		dst[x] = image_sub_pixel(dst[x], src[x], alpha);
+}
+
+/* Alpha-blend a row of premultiplied pixels. */
+TARGET_AVX2
+void image_alpha_pm_row_avx2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	__m256i zero, va, c255, opaque, s, d, lo, hi, dlo, dhi;
+	int x;
+
+	zero = _mm256_setzero_si256();
+	va = _mm256_set1_epi16((short)alpha);
+	c255 = _mm256_set1_epi16(255);
+	opaque = _mm256_set1_epi32((int)0xff000000);
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		s = _mm256_loadu_si256((const __m256i *)(src + x));
+		d = _mm256_loadu_si256((const __m256i *)(dst + x));
+		lo = div255_avx2(_mm256_mullo_epi16(_mm256_unpacklo_epi8(s, zero), va));
+		hi = div255_avx2(_mm256_mullo_epi16(_mm256_unpackhi_epi8(s, zero), va));
+		dlo = div255_avx2(_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), _mm256_sub_epi16(c255, broadcast_alpha_avx2(lo))));
+		dhi = div255_avx2(_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), _mm256_sub_epi16(c255, broadcast_alpha_avx2(hi))));
+		s = _mm256_adds_epu8(_mm256_packus_epi16(dlo, dhi), _mm256_packus_epi16(lo, hi));
+		_mm256_storeu_si256((__m256i *)(dst + x), _mm256_or_si256(s, opaque));
+	}
+	for (; x < width; x++)
+		dst[x] = image_alpha_pm_pixel(dst[x], src[x], alpha);
+}
+
+/* Alpha-blend a row of premultiplied pixels at alpha=255. */
+TARGET_AVX2
+void image_alpha_pm_opaque_row_avx2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	__m256i zero, c255, opaque, s, d, lo, hi;
+	int x;
+
+	UNUSED_PARAMETER(alpha);
+
+	zero = _mm256_setzero_si256();
+	c255 = _mm256_set1_epi16(255);
+	opaque = _mm256_set1_epi32((int)0xff000000);
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		s = _mm256_loadu_si256((const __m256i *)(src + x));
+
+		/* Eight opaque pixels replace the destination. */
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(s, opaque), opaque)) == -1) {
+			_mm256_storeu_si256((__m256i *)(dst + x), s);
+			continue;
+		}
+
+		d = _mm256_loadu_si256((const __m256i *)(dst + x));
+
+		/* Eight clear pixels leave it. */
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(s, zero)) != -1) {
+			lo = div255_avx2(_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), _mm256_sub_epi16(c255, broadcast_alpha_avx2(_mm256_unpacklo_epi8(s, zero)))));
+			hi = div255_avx2(_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), _mm256_sub_epi16(c255, broadcast_alpha_avx2(_mm256_unpackhi_epi8(s, zero)))));
+			d = _mm256_adds_epu8(_mm256_packus_epi16(lo, hi), s);
+		}
+		_mm256_storeu_si256((__m256i *)(dst + x), _mm256_or_si256(d, opaque));
+	}
+	for (; x < width; x++)
+		dst[x] = image_alpha_pm_opaque_pixel(dst[x], src[x]);
+}
+
+/* Add-blend a row of premultiplied pixels. */
+TARGET_AVX2
+void image_add_pm_row_avx2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	__m256i zero, va, opaque, s, lo, hi;
+	int x;
+
+	zero = _mm256_setzero_si256();
+	va = _mm256_set1_epi16((short)alpha);
+	opaque = _mm256_set1_epi32((int)0xff000000);
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		s = _mm256_loadu_si256((const __m256i *)(src + x));
+		lo = div255_avx2(_mm256_mullo_epi16(_mm256_unpacklo_epi8(s, zero), va));
+		hi = div255_avx2(_mm256_mullo_epi16(_mm256_unpackhi_epi8(s, zero), va));
+		s = _mm256_adds_epu8(_mm256_loadu_si256((const __m256i *)(dst + x)), _mm256_packus_epi16(lo, hi));
+		_mm256_storeu_si256((__m256i *)(dst + x), _mm256_or_si256(s, opaque));
+	}
+	for (; x < width; x++)
+		dst[x] = image_add_pm_pixel(dst[x], src[x], alpha);
+}
+
+/* Sub-blend a row of premultiplied pixels. */
+TARGET_AVX2
+void image_sub_pm_row_avx2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha)
+{
+	__m256i zero, va, opaque, s, lo, hi;
+	int x;
+
+	zero = _mm256_setzero_si256();
+	va = _mm256_set1_epi16((short)alpha);
+	opaque = _mm256_set1_epi32((int)0xff000000);
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		s = _mm256_loadu_si256((const __m256i *)(src + x));
+		lo = div255_avx2(_mm256_mullo_epi16(_mm256_unpacklo_epi8(s, zero), va));
+		hi = div255_avx2(_mm256_mullo_epi16(_mm256_unpackhi_epi8(s, zero), va));
+		s = _mm256_subs_epu8(_mm256_loadu_si256((const __m256i *)(dst + x)), _mm256_packus_epi16(lo, hi));
+		_mm256_storeu_si256((__m256i *)(dst + x), _mm256_or_si256(s, opaque));
+	}
+	for (; x < width; x++)
+		dst[x] = image_sub_pm_pixel(dst[x], src[x], alpha);
+}
+
+/* Interpolate two rows. */
+TARGET_AVX2
+void image_lerp_row_avx2(pixel_t * RESTRICT dst, const pixel_t *a, const pixel_t *b, int width, uint32_t w)
+{
+	__m256i zero, vw, vnw, round, va, vb, lo, hi;
+	int x;
+
+	zero = _mm256_setzero_si256();
+	vw = _mm256_set1_epi16((short)w);
+	vnw = _mm256_set1_epi16((short)(256 - w));
+	round = _mm256_set1_epi16(128);
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		va = _mm256_loadu_si256((const __m256i *)(a + x));
+		vb = _mm256_loadu_si256((const __m256i *)(b + x));
+		lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(va, zero), vnw),
+				      _mm256_mullo_epi16(_mm256_unpacklo_epi8(vb, zero), vw));
+		hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(va, zero), vnw),
+				      _mm256_mullo_epi16(_mm256_unpackhi_epi8(vb, zero), vw));
+		lo = _mm256_srli_epi16(_mm256_add_epi16(lo, round), 8);
+		hi = _mm256_srli_epi16(_mm256_add_epi16(hi, round), 8);
+		_mm256_storeu_si256((__m256i *)(dst + x), _mm256_packus_epi16(lo, hi));
+	}
+	for (; x < width; x++)
+		dst[x] = image_lerp_pixel(a[x], b[x], w);
+}
+
+/*
+ * Expand 16 packed 3-byte pixels with a byte shuffle. (SSSE3, which the
+ * AVX2 level implies)  The three loads cover exactly 48 bytes.
+ */
+static INLINE TARGET_AVX2 void expand_16_avx2(pixel_t *dst, const uint8_t *src, __m128i mask)
+{
+	__m128i a, b, c, alpha;
+
+	alpha = _mm_set1_epi32((int)0xff000000);
+	a = _mm_loadu_si128((const __m128i *)src);
+	b = _mm_loadu_si128((const __m128i *)(src + 16));
+	c = _mm_loadu_si128((const __m128i *)(src + 32));
+	_mm_storeu_si128((__m128i *)dst, _mm_or_si128(_mm_shuffle_epi8(a, mask), alpha));
+	_mm_storeu_si128((__m128i *)(dst + 4), _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), mask), alpha));
+	_mm_storeu_si128((__m128i *)(dst + 8), _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(c, b, 8), mask), alpha));
+	_mm_storeu_si128((__m128i *)(dst + 12), _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(c, 4), mask), alpha));
+}
+
+/* Expand a row of 3-byte pixels, keeping the byte order. */
+TARGET_AVX2
+void image_expand_rgb_row_avx2(pixel_t * RESTRICT dst, const uint8_t * RESTRICT src, int width)
+{
+	__m128i mask;
+	int x;
+
+	mask = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	for (x = 0; x + 16 <= width; x += 16)
+		expand_16_avx2(dst + x, src + x * 3, mask);
+	image_expand_rgb_row_c(dst + x, src + x * 3, width - x);
+}
+
+/* Expand a row of 3-byte pixels, swapping the first and the third bytes. */
+TARGET_AVX2
+void image_expand_bgr_row_avx2(pixel_t * RESTRICT dst, const uint8_t * RESTRICT src, int width)
+{
+	__m128i mask;
+	int x;
+
+	mask = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+	for (x = 0; x + 16 <= width; x += 16)
+		expand_16_avx2(dst + x, src + x * 3, mask);
+	image_expand_bgr_row_c(dst + x, src + x * 3, width - x);
+}
+
+/* Get the weights of eight rule pixels, in the low 16-bit lane of each pixel. */
+static INLINE TARGET_AVX2 __m256i rule_weight_avx2(__m256i r, __m256i pos, __m256i limit, __m256i gain)
+{
+	__m256i d;
+
+	d = _mm256_sub_epi16(pos, _mm256_and_si256(r, _mm256_set1_epi32(0xff)));
+	d = _mm256_min_epi16(_mm256_max_epi16(d, _mm256_setzero_si256()), limit);
+	return _mm256_srli_epi16(_mm256_mullo_epi16(d, gain), 8);
+}
+
+/* Spread the weights of four pixels from _mm256_unpack*_epi32(w, w) to the unpacked lanes. */
+static INLINE TARGET_AVX2 __m256i spread_weight_avx2(__m256i w)
+{
+	w = _mm256_shufflelo_epi16(w, _MM_SHUFFLE(0, 0, 0, 0));
+	return _mm256_shufflehi_epi16(w, _MM_SHUFFLE(0, 0, 0, 0));
+}
+
+/* Alpha-blend a row by weights from a rule row. */
+TARGET_AVX2
+void image_rule_row_avx2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, const pixel_t * RESTRICT rule, int width, uint32_t pos, uint32_t limit, uint32_t gain)
+{
+	__m256i zero, vpos, vlimit, vgain, opaque, s, d, w, lo, hi;
+	int x;
+
+	zero = _mm256_setzero_si256();
+	vpos = _mm256_set1_epi32((int)pos);
+	vlimit = _mm256_set1_epi32((int)limit);
+	vgain = _mm256_set1_epi32((int)gain);
+	opaque = _mm256_set1_epi32((int)0xff000000);
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		s = _mm256_loadu_si256((const __m256i *)(src + x));
+		d = _mm256_loadu_si256((const __m256i *)(dst + x));
+		w = rule_weight_avx2(_mm256_loadu_si256((const __m256i *)(rule + x)), vpos, vlimit, vgain);
+		lo = blend_alpha_avx2(_mm256_unpacklo_epi8(d, zero), _mm256_unpacklo_epi8(s, zero), spread_weight_avx2(_mm256_unpacklo_epi32(w, w)));
+		hi = blend_alpha_avx2(_mm256_unpackhi_epi8(d, zero), _mm256_unpackhi_epi8(s, zero), spread_weight_avx2(_mm256_unpackhi_epi32(w, w)));
+		_mm256_storeu_si256((__m256i *)(dst + x), _mm256_or_si256(_mm256_packus_epi16(lo, hi), opaque));
+	}
+	for (; x < width; x++)
+		dst[x] = image_alpha_pixel(dst[x], src[x], image_rule_weight(rule[x] & 0xff, pos, limit, gain));
+}
+
+/* Alpha-blend a row of premultiplied pixels by weights from a rule row. */
+TARGET_AVX2
+void image_rule_pm_row_avx2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, const pixel_t * RESTRICT rule, int width, uint32_t pos, uint32_t limit, uint32_t gain)
+{
+	__m256i zero, vpos, vlimit, vgain, c255, opaque, s, d, w, lo, hi, dlo, dhi;
+	int x;
+
+	zero = _mm256_setzero_si256();
+	vpos = _mm256_set1_epi32((int)pos);
+	vlimit = _mm256_set1_epi32((int)limit);
+	vgain = _mm256_set1_epi32((int)gain);
+	c255 = _mm256_set1_epi16(255);
+	opaque = _mm256_set1_epi32((int)0xff000000);
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		s = _mm256_loadu_si256((const __m256i *)(src + x));
+		d = _mm256_loadu_si256((const __m256i *)(dst + x));
+		w = rule_weight_avx2(_mm256_loadu_si256((const __m256i *)(rule + x)), vpos, vlimit, vgain);
+		lo = div255_avx2(_mm256_mullo_epi16(_mm256_unpacklo_epi8(s, zero), spread_weight_avx2(_mm256_unpacklo_epi32(w, w))));
+		hi = div255_avx2(_mm256_mullo_epi16(_mm256_unpackhi_epi8(s, zero), spread_weight_avx2(_mm256_unpackhi_epi32(w, w))));
+		dlo = div255_avx2(_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), _mm256_sub_epi16(c255, broadcast_alpha_avx2(lo))));
+		dhi = div255_avx2(_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), _mm256_sub_epi16(c255, broadcast_alpha_avx2(hi))));
+		s = _mm256_adds_epu8(_mm256_packus_epi16(dlo, dhi), _mm256_packus_epi16(lo, hi));
+		_mm256_storeu_si256((__m256i *)(dst + x), _mm256_or_si256(s, opaque));
+	}
+	for (; x < width; x++)
+		dst[x] = image_alpha_pm_pixel(dst[x], src[x], image_rule_weight(rule[x] & 0xff, pos, limit, gain));
+}
+
+/* Composite four unpacked premultiplied pixels by Porter-Duff factors. */
+static INLINE TARGET_AVX2 __m256i composite_avx2(__m256i d, __m256i s, __m256i sb, __m256i ss, __m256i db, __m256i ds)
+{
+	__m256i fs, fd;
+
+	fs = _mm256_add_epi16(sb, _mm256_mullo_epi16(ss, broadcast_alpha_avx2(d)));
+	fd = _mm256_add_epi16(db, _mm256_mullo_epi16(ds, broadcast_alpha_avx2(s)));
+
+	return _mm256_add_epi16(div255_avx2(_mm256_mullo_epi16(s, fs)), div255_avx2(_mm256_mullo_epi16(d, fd)));
+}
+
+/* Composite a row on a premultiplied row. */
+TARGET_AVX2
+void image_composite_row_avx2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha, const struct image_pd *pd)
+{
+	__m256i zero, va, a255, sb, ss, db, ds, s, d, lo, hi;
+	int x;
+
+	zero = _mm256_setzero_si256();
+	va = _mm256_set1_epi16((short)alpha);
+	a255 = _mm256_set1_epi64x((long long)0x00ff000000000000);
+	sb = _mm256_set1_epi16((short)pd->src_base);
+	ss = _mm256_set1_epi16((short)pd->src_scale);
+	db = _mm256_set1_epi16((short)pd->dst_base);
+	ds = _mm256_set1_epi16((short)pd->dst_scale);
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		s = _mm256_loadu_si256((const __m256i *)(src + x));
+		d = _mm256_loadu_si256((const __m256i *)(dst + x));
+
+		/* Premultiply the source, making the alpha lanes the effective alphas. */
+		lo = _mm256_unpacklo_epi8(s, zero);
+		hi = _mm256_unpackhi_epi8(s, zero);
+		lo = div255_avx2(_mm256_mullo_epi16(_mm256_or_si256(lo, a255), alpha_avx2(lo, va)));
+		hi = div255_avx2(_mm256_mullo_epi16(_mm256_or_si256(hi, a255), alpha_avx2(hi, va)));
+
+		lo = composite_avx2(_mm256_unpacklo_epi8(d, zero), lo, sb, ss, db, ds);
+		hi = composite_avx2(_mm256_unpackhi_epi8(d, zero), hi, sb, ss, db, ds);
+		_mm256_storeu_si256((__m256i *)(dst + x), _mm256_packus_epi16(lo, hi));
+	}
+	for (; x < width; x++)
+		dst[x] = image_composite_pixel(dst[x], image_premultiply_alpha_pixel(src[x], alpha), pd);
+}
+
+/* Composite a row of premultiplied pixels on a premultiplied row. */
+TARGET_AVX2
+void image_composite_pm_row_avx2(pixel_t * RESTRICT dst, const pixel_t * RESTRICT src, int width, uint32_t alpha, const struct image_pd *pd)
+{
+	__m256i zero, va, sb, ss, db, ds, s, d, lo, hi;
+	int x;
+
+	zero = _mm256_setzero_si256();
+	va = _mm256_set1_epi16((short)alpha);
+	sb = _mm256_set1_epi16((short)pd->src_base);
+	ss = _mm256_set1_epi16((short)pd->src_scale);
+	db = _mm256_set1_epi16((short)pd->dst_base);
+	ds = _mm256_set1_epi16((short)pd->dst_scale);
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		s = _mm256_loadu_si256((const __m256i *)(src + x));
+		d = _mm256_loadu_si256((const __m256i *)(dst + x));
+		lo = div255_avx2(_mm256_mullo_epi16(_mm256_unpacklo_epi8(s, zero), va));
+		hi = div255_avx2(_mm256_mullo_epi16(_mm256_unpackhi_epi8(s, zero), va));
+		lo = composite_avx2(_mm256_unpacklo_epi8(d, zero), lo, sb, ss, db, ds);
+		hi = composite_avx2(_mm256_unpackhi_epi8(d, zero), hi, sb, ss, db, ds);
+		_mm256_storeu_si256((__m256i *)(dst + x), _mm256_packus_epi16(lo, hi));
+	}
+	for (; x < width; x++)
+		dst[x] = image_composite_pixel(dst[x], image_scale_pixel(src[x], alpha), pd);
+}
+
+#endif /* defined(ARCH_X86) || defined(ARCH_X86_64) */
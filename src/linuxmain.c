@@ -12,6 +12,7 @@
 #include "mediakit/mediakit.h"
 
 #include "stdfile.h"
+#include "stdstor.h"
 #include "glrender.h"
 
 /* X11 */
@@ -187,6 +188,10 @@ int main(int argc, char *argv[])
 	if (!stdfile_init(make_path))
 		return 1;
 
+	/* Initialize the stdstor module. */
+	if (!stdstor_init(make_path))
+		return 1;
+
 	/* Tell application that HAL is going to initialize the "render" module. */
 	if (!on_hal_init_render(&window_title, &window_width, &window_height))
 		return 1;
@@ -212,6 +217,9 @@ int main(int argc, char *argv[])
 	/* Cleanup the stdimage module. */
 	stdfile_cleanup();
 
+	/* Cleanup the stdstor module. */
+	stdstor_cleanup();
+
 	/* Cleanup the stdfile module. */
 	stdfile_cleanup();
 
@@ -770,7 +778,7 @@ const char *sys_get_language(void)
 }
 
 /*
- * For the stdfile module.
+ * For the stdfile and stdstor modules.
  */
 static char *make_path(const char *path)
 {
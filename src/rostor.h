@@ -0,0 +1,83 @@
+/* -*- coding: utf-8; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * MediaKit
+ * Copyright (c) 2025, Tamako Mori. All rights reserved.
+ */
+
+/*
+ * rostor.h: The read-only storage format shared by stdstor.c and the
+ *           mkrostor tool.
+ */
+
+/*
+ * [Read-only Storage File Format]
+ *
+ * struct header {
+ *     u8  magic[4];                  // "MKRO"
+ *     u32 item_count;
+ *     u32 bucket_count;
+ *     u32 pool_size;
+ * };
+ * u32 displacement[bucket_count];
+ * struct slot {
+ *     u32 key_offset;                // To a NUL-terminated key in the pool.
+ *     u32 value;                     // Pool offset, or an int/float/bool.
+ *     u32 value_size;                // For a string (with the NUL) or a blob.
+ *     u32 type;                      // STOR_TYPE_*
+ * } [item_count];
+ * u32 order[item_count];             // Slot indices in the key order.
+ * u8  pool[pool_size];
+ *
+ * All integers are little-endian.  The slots form a minimal perfect
+ * hash table built offline by the "hash and displace" method:
+ *
+ *     d = displacement[rostor_hash(key, 0) % bucket_count]
+ *     slot = rostor_hash(key, d) % item_count
+ *
+ * A lookup compares the key of the slot since an unknown key also
+ * lands on some slot.
+ */
+
+#ifndef MEDIAKIT_ROSTOR_H
+#define MEDIAKIT_ROSTOR_H
+
+#include "mediakit/compat.h"
+
+/* File magic. */
+#define ROSTOR_MAGIC		"MKRO"
+
+/* Sizes of the fixed parts. */
+#define ROSTOR_HEADER_SIZE	(16)
+#define ROSTOR_SLOT_SIZE	(16)
+
+/* Hash a key with a seed. (FNV-1a with the murmur3 finalizer) */
+static INLINE uint32_t rostor_hash(const char *key, uint32_t seed)
+{
+	uint32_t h;
+
+	h = 2166136261u ^ (seed * 0x9e3779b9u);
+	while (*key != '\0') {
+		h ^= (uint8_t)*key++;
+		h *= 16777619u;
+	}
+
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+
+	return h;
+}
+
+/* Read a little-endian u32 from a byte array. */
+static INLINE uint32_t rostor_u32(const uint8_t *p)
+{
+	return (uint32_t)p[0] |
+	       ((uint32_t)p[1] << 8) |
+	       ((uint32_t)p[2] << 16) |
+	       ((uint32_t)p[3] << 24);
+}
+
+#endif
@@ -9,37 +9,182 @@
  * stdstor.c: The standard C implementation for stor component.
  */
 
+/*
+ * [Storage File Format]
+ *
+ * struct header {
+ *     u8  magic[4];        // "MKST"
+ *     u32 flags;           // STOR_FLAG_*
+ * };
+ * // Compressed by zlib if STOR_FLAG_DEFLATE is set:
+ * u32 item_count;
+ * struct item {
+ *     u8  type;            // STOR_TYPE_*
+ *     u32 key_size;        // Including the terminating NUL.
+ *     u8  key[key_size];
+ *     u32 value_size;
+ *     u8  value[value_size];
+ * } [item_count];
+ *
+ * The value of a string item includes the terminating NUL, an int is
+ * a little-endian s32, a float is a little-endian IEEE 754 binary32,
+ * a bool is a u8, and a blob is stored as is.
+ *
+ * The compressed body is encoded and decoded incrementally through a
+ * small stream buffer, so that a large storage is never buffered as a
+ * whole.
+ *
+ * Items are written in the key order.
+ *
+ * A file without the magic is read as the legacy format, a sequence
+ * of NUL-terminated key and string value pairs.
+ *
+ * A file with the "MKRO" magic is a read-only storage built offline
+ * by the mkrostor tool. (See rostor.h) It is mapped into memory as is
+ * and serves lookups by a perfect hash without any allocation.
+ */
+
 #include "mediakit/mediakit.h"
+#include "stdstor.h"
+#include "rostor.h"
+
+/* zlib */
+#include <zlib.h>
+
+/* Win32 */
+#ifdef TARGET_WIN32
+#include <fcntl.h>
+#endif
+
+/* POSIX */
+#if defined(TARGET_LINUX) || defined(TARGET_MACOS) || defined(TARGET_IOS) || defined(TARGET_ANDROID)
+#define USE_MMAP
+#include <sys/mman.h>	/* mmap() */
+#endif
 
+/* Maximum items in a storage. */
 #define KEY_MAX		(8192)
 
+/* Maximum size of a key. */
+#define KEY_SIZE	(4096)
+
+/* File magic. */
+#define STOR_MAGIC	"MKST"
+
+/* Header flags. */
+#define STOR_FLAG_DEFLATE	(1 << 0)
+
+/* Stream buffer size. */
+#define STREAM_BUF_SIZE	(16384)
+
+/* Storage item. */
+struct stor_item {
+	/* Key string. */
+	char *key;
+
+	/* Value type. */
+	int type;
+
+	/* Value. */
+	union {
+		char *s;
+		int i;
+		float f;
+		bool b;
+		struct {
+			void *data;
+			size_t size;
+		} blob;
+	} val;
+};
+
+/* Read-only storage. */
+struct stor_ro {
+	/* The whole file. */
+	const uint8_t *data;
+	size_t size;
+	bool is_mapped;
+
+	/* Sections in the file. */
+	uint32_t item_count;
+	uint32_t bucket_count;
+	const uint8_t *disp;
+	const uint8_t *slot;
+	const uint8_t *order;
+	const char *pool;
+	uint32_t pool_size;
+};
+
+/*
+ * Items are kept packed in item[0..item_count), and sorted[] holds
+ * pointers to them in the strcmp() order of the keys, so that a
+ * lookup is a binary search and a prefix is a contiguous range.
+ *
+ * A read-only storage is allocated without the arrays.
+ */
 struct stor {
 	char *file_name;
-	char *key[KEY_MAX];
-	char *value[KEY_MAX];
+	bool is_compressed;
+	bool is_readonly;
+	struct stor_ro ro;
+	int item_count;
+	struct stor_item item[KEY_MAX];
+	struct stor_item *sorted[KEY_MAX];
+};
+
+/* File stream with an optional zlib layer. */
+struct stor_stream {
+	FILE *fp;
+	bool is_compressed;
+	bool is_writing;
+	z_stream z;
+	uint8_t buf[STREAM_BUF_SIZE];
 };
 
 /*
  * "stor_make_path()" makes a real path to a specified file.
  * This function is implemented in the "sys" module.
  */
-bool (*stor_make_path)(const char *file);
+char *(*stor_make_path)(const char *file);
 
 /* Forward declaration. */
-static void stor_free(struct stor *s)
+static bool stor_load(struct stor *s, FILE *fp);
+static bool stor_load_items(struct stor *s, struct stor_stream *st);
+static bool stor_load_legacy(struct stor *s, FILE *fp);
+static bool stor_gets(FILE *fp, char *buf, size_t size);
+static bool stor_save(struct stor *s, FILE *fp);
+static bool stor_write_item(struct stor_stream *st, struct stor_item *item);
+static bool stor_stream_begin(struct stor_stream *st, FILE *fp, bool is_compressed, bool is_writing);
+static bool stor_stream_read(struct stor_stream *st, void *buf, size_t size);
+static bool stor_stream_read_u32(struct stor_stream *st, uint32_t *data);
+static bool stor_stream_write(struct stor_stream *st, const void *buf, size_t size);
+static bool stor_stream_write_u32(struct stor_stream *st, uint32_t data);
+static bool stor_stream_finish(struct stor_stream *st);
+static void stor_stream_end(struct stor_stream *st);
+static struct stor_item *stor_find(struct stor *s, const char *key);
+static bool stor_search(struct stor *s, int lo, const char *key, int *pos);
+static struct stor_item *stor_prepare_put(struct stor *s, const char *key);
+static void stor_clear_value(struct stor_item *item);
+static void stor_free(struct stor *s);
+static bool stor_ro_load(struct stor *s, FILE *fp);
+static const uint8_t *stor_ro_find(struct stor *s, const char *key, int type);
+static bool stor_ro_iterate_prefix(struct stor *s, const char *prefix, bool (*callback)(void *arg, const char *key, int type), void *arg);
 
 /*
- * Initialize the "stor" module.
+ * Initialize the stdstor module.
  */
-bool stor_init_module(void)
+bool stdstor_init(char *(*make_path_func)(const char *))
 {
+	/* Save a function pointer. */
+	stor_make_path = make_path_func;
+
 	return true;
 }
 
 /*
- * Cleanup the "stor" module.
+ * Cleanup the stdstor module.
  */
-void stor_cleanup_module(void)
+void stdstor_cleanup(void)
 {
 }
 
@@ -48,115 +193,655 @@ void stor_cleanup_module(void)
  */
 bool stor_open(const char *file_name, struct stor **s)
 {
-	char key[4096];
-	char value[4096];
+	char magic[4];
 	struct stor *st;
+	char *path;
+	size_t size;
 	FILE *fp;
+	bool is_readonly;
 
-	/* Allocate a memory for struct stor. */
-	st = malloc(sizeof(struct stor));
-	if (st == NULL) {
-		sys_out_of_memory();
+	/* Make a real path. */
+	path = stor_make_path(file_name);
+	if (path == NULL)
 		return false;
-	}
-	memset(st, 0, sizeof(struct stor));
 
 	/* Open a file. */
-	st->file_name = stor_make_path(file_name);
 #ifdef TARGET_WIN32
 	_fmode = _O_BINARY;
-	fp = _wfopen(win32_utf8_to_utf16(st->file_name), L"r");
+	fp = _wfopen(win32_utf8_to_utf16(path), L"rb");
 #else
-	fp = fopen(st->file_name, "r");
+	fp = fopen(path, "rb");
 #endif
+
+	/* Check for a read-only storage. */
+	is_readonly = false;
+	if (fp != NULL) {
+		if (fread(magic, sizeof(magic), 1, fp) == 1 &&
+		    memcmp(magic, ROSTOR_MAGIC, sizeof(magic)) == 0)
+			is_readonly = true;
+		rewind(fp);
+	}
+
+	/* Allocate a memory for struct stor. */
+	size = is_readonly ? offsetof(struct stor, item) : sizeof(struct stor);
+	st = malloc(size);
+	if (st == NULL) {
+		sys_out_of_memory();
+		if (fp != NULL)
+			fclose(fp);
+		free(path);
+		return false;
+	}
+	memset(st, 0, size);
+	st->file_name = path;
+	st->is_readonly = is_readonly;
+
 	if (fp == NULL) {
-		sys_error("Cannot open file \"%s\".", path);
+		/* A storage that has not been saved yet is empty. */
+		*s = st;
+		return true;
+	}
+
+	/* Read items. */
+	if (is_readonly ? !stor_ro_load(st, fp) : !stor_load(st, fp)) {
+		sys_error("Corrupted storage file \"%s\".", st->file_name);
+		fclose(fp);
 		stor_free(st);
 		return false;
 	}
-	free(path);
 
-	/* Read key-value pairs. */
-	for (i = 0; i < KEY_MAX; i++) {
-		if (!stor_gets(st, key, sizeof(key)))
+	fclose(fp);
+	*s = st;
+	return true;
+}
+
+/* Read items from a storage file. */
+static bool stor_load(struct stor *s, FILE *fp)
+{
+	struct stor_stream *st;
+	char magic[4];
+	uint8_t b[4];
+	uint32_t flags;
+	bool ret;
+
+	/* Check for the magic. */
+	if (fread(magic, sizeof(magic), 1, fp) != 1) {
+		/* Empty file. */
+		return true;
+	}
+	if (memcmp(magic, STOR_MAGIC, sizeof(magic)) != 0) {
+		rewind(fp);
+		return stor_load_legacy(s, fp);
+	}
+
+	/* Read the flags. */
+	if (fread(b, sizeof(b), 1, fp) != 1)
+		return false;
+	flags = (uint32_t)b[0] |
+		((uint32_t)b[1] << 8) |
+		((uint32_t)b[2] << 16) |
+		((uint32_t)b[3] << 24);
+	if ((flags & ~(uint32_t)STOR_FLAG_DEFLATE) != 0)
+		return false;
+	s->is_compressed = (flags & STOR_FLAG_DEFLATE) != 0;
+
+	/* Allocate a stream. */
+	st = malloc(sizeof(struct stor_stream));
+	if (st == NULL) {
+		sys_out_of_memory();
+		return false;
+	}
+
+	/* Read the body. */
+	ret = false;
+	if (stor_stream_begin(st, fp, s->is_compressed, false)) {
+		ret = stor_load_items(s, st);
+		stor_stream_end(st);
+	}
+	free(st);
+
+	return ret;
+}
+
+/* Read items from a stream. */
+static bool stor_load_items(struct stor *s, struct stor_stream *st)
+{
+	char key[KEY_SIZE];
+	struct stor_item *item;
+	uint32_t count, key_size, value_size, i, u;
+	uint8_t type;
+
+	/* Read the item count. */
+	if (!stor_stream_read_u32(st, &count))
+		return false;
+	if (count > KEY_MAX)
+		return false;
+
+	/* Read items. */
+	for (i = 0; i < count; i++) {
+		/* Read a type. */
+		if (!stor_stream_read(st, &type, 1))
+			return false;
+		if (type > STOR_TYPE_BLOB)
+			return false;
+
+		/* Read a key. */
+		if (!stor_stream_read_u32(st, &key_size))
+			return false;
+		if (key_size == 0 || key_size > KEY_SIZE)
+			return false;
+		if (!stor_stream_read(st, key, key_size))
+			return false;
+		if (key[key_size - 1] != '\0')
+			return false;
+
+		/* Add an item. (Appending is fast as the file is sorted.) */
+		item = stor_prepare_put(s, key);
+		if (item == NULL)
+			return false;
+		item->type = type;
+
+		/* Read a value. */
+		if (!stor_stream_read_u32(st, &value_size))
+			return false;
+		switch (type) {
+		case STOR_TYPE_STRING:
+			if (value_size == 0)
+				return false;
+			item->val.s = malloc(value_size);
+			if (item->val.s == NULL) {
+				sys_out_of_memory();
+				return false;
+			}
+			if (!stor_stream_read(st, item->val.s, value_size))
+				return false;
+			if (item->val.s[value_size - 1] != '\0')
+				return false;
+			break;
+		case STOR_TYPE_INT:
+			if (value_size != 4 || !stor_stream_read_u32(st, &u))
+				return false;
+			item->val.i = (int)(int32_t)u;
+			break;
+		case STOR_TYPE_FLOAT:
+			if (value_size != 4 || !stor_stream_read_u32(st, &u))
+				return false;
+			memcpy(&item->val.f, &u, sizeof(float));
 			break;
-		if (!stor_gets(st, value, sizeof(value)))
+		case STOR_TYPE_BOOL:
+			if (value_size != 1 || !stor_stream_read(st, &type, 1))
+				return false;
+			item->val.b = type != 0;
 			break;
+		case STOR_TYPE_BLOB:
+			item->val.blob.size = value_size;
+			if (value_size == 0)
+				break;
+			item->val.blob.data = malloc(value_size);
+			if (item->val.blob.data == NULL) {
+				sys_out_of_memory();
+				return false;
+			}
+			if (!stor_stream_read(st, item->val.blob.data, value_size))
+				return false;
+			break;
+		}
+	}
 
-		st->key[i] = strdup(key);
-		if (st->key[i] == NULL) {
-			sys_out_of_memory();
-			fclose(fp);
-			stor_free(st);
+	return true;
+}
+
+/* Read items from a legacy storage file. */
+static bool stor_load_legacy(struct stor *s, FILE *fp)
+{
+	char key[KEY_SIZE];
+	char value[4096];
+	int i;
+
+	for (i = 0; i < KEY_MAX; i++) {
+		/* Read a key and a value. */
+		if (!stor_gets(fp, key, sizeof(key)))
+			break;
+		if (!stor_gets(fp, value, sizeof(value)))
 			return false;
-		}
 
-		st->value[i] = strdup(value);
-		if (st->value[i] == NULL) {
-			sys_out_of_memory();
-			fclose(fp);
-			stor_free(st);
+		/* Store as a string item. */
+		if (!stor_put(s, key, value))
 			return false;
-		}
 	}
 
-	fclose(fp);
-	*s = st;
 	return true;
 }
 
+/* Read a NUL-terminated string. */
+static bool stor_gets(FILE *fp, char *buf, size_t size)
+{
+	size_t len;
+	int c;
+
+	for (len = 0; len < size; len++) {
+		c = fgetc(fp);
+		if (c == EOF)
+			return false;
+		buf[len] = (char)c;
+		if (c == '\0')
+			return true;
+	}
+
+	/* Too long. */
+	return false;
+}
+
 /*
- * Put an data item.
+ * Put a string item.
  */
 bool stor_put(struct stor *s, const char *key, const char *value)
 {
-	int i;
+	struct stor_item *item;
+	char *dup;
 
-	for (i = 0; i < KEY_MAX; i++) {
-		if (st->key[i] == NULL)
-			continue;
-		if (stcmp(st->key[i], key) == 0) {
-			assert(st->value[i] != NULL);
-			free(st->value[i]);
-			st->value[i] = strdup(value);
-			if (st->value[i] == NULL) {
-				sys_out_of_memory();
-				return false;
-			}
-			return true;
+	assert(s != NULL);
+	assert(key != NULL);
+	assert(value != NULL);
+
+	dup = strdup(value);
+	if (dup == NULL) {
+		sys_out_of_memory();
+		return false;
+	}
+
+	item = stor_prepare_put(s, key);
+	if (item == NULL) {
+		free(dup);
+		return false;
+	}
+	item->type = STOR_TYPE_STRING;
+	item->val.s = dup;
+
+	return true;
+}
+
+/*
+ * Put an int item.
+ */
+bool stor_put_int(struct stor *s, const char *key, int value)
+{
+	struct stor_item *item;
+
+	assert(s != NULL);
+	assert(key != NULL);
+
+	item = stor_prepare_put(s, key);
+	if (item == NULL)
+		return false;
+	item->type = STOR_TYPE_INT;
+	item->val.i = value;
+
+	return true;
+}
+
+/*
+ * Put a float item.
+ */
+bool stor_put_float(struct stor *s, const char *key, float value)
+{
+	struct stor_item *item;
+
+	assert(s != NULL);
+	assert(key != NULL);
+
+	item = stor_prepare_put(s, key);
+	if (item == NULL)
+		return false;
+	item->type = STOR_TYPE_FLOAT;
+	item->val.f = value;
+
+	return true;
+}
+
+/*
+ * Put a bool item.
+ */
+bool stor_put_bool(struct stor *s, const char *key, bool value)
+{
+	struct stor_item *item;
+
+	assert(s != NULL);
+	assert(key != NULL);
+
+	item = stor_prepare_put(s, key);
+	if (item == NULL)
+		return false;
+	item->type = STOR_TYPE_BOOL;
+	item->val.b = value;
+
+	return true;
+}
+
+/*
+ * Put a blob item.
+ */
+bool stor_put_blob(struct stor *s, const char *key, const void *data, size_t size)
+{
+	struct stor_item *item;
+	void *dup;
+
+	assert(s != NULL);
+	assert(key != NULL);
+	assert(data != NULL || size == 0);
+
+	if (size > UINT32_MAX) {
+		sys_error("Too large blob.");
+		return false;
+	}
+
+	dup = NULL;
+	if (size > 0) {
+		dup = malloc(size);
+		if (dup == NULL) {
+			sys_out_of_memory();
+			return false;
 		}
+		memcpy(dup, data, size);
 	}
 
-	for (i = 0; i < KEY_MAX; i++) {
-		if (st->key[i] == NULL) {
-			assert(st->value[i] == NULL);
-			st->value[i] = strdup(value);
-			if (st->value[i] == NULL) {
-				sys_out_of_memory();
-				return false;
-			}
+	item = stor_prepare_put(s, key);
+	if (item == NULL) {
+		free(dup);
+		return false;
+	}
+	item->type = STOR_TYPE_BLOB;
+	item->val.blob.data = dup;
+	item->val.blob.size = size;
+
+	return true;
+}
+
+/* Get an item slot to put a value, with the old value cleared. */
+static struct stor_item *stor_prepare_put(struct stor *s, const char *key)
+{
+	struct stor_item *item;
+	int pos;
+
+	if (s->is_readonly) {
+		sys_error("Storage \"%s\" is read-only.", s->file_name);
+		return NULL;
+	}
+
+	/* Overwrite an existing item. */
+	if (stor_search(s, 0, key, &pos)) {
+		item = s->sorted[pos];
+		stor_clear_value(item);
+		return item;
+	}
+
+	/* Append an item. */
+	if (s->item_count == KEY_MAX) {
+		sys_error("Too many keys.");
+		return NULL;
+	}
+	if (strlen(key) + 1 > KEY_SIZE) {
+		sys_error("Too long key.");
+		return NULL;
+	}
+	item = &s->item[s->item_count];
+	item->key = strdup(key);
+	if (item->key == NULL) {
+		sys_out_of_memory();
+		return NULL;
+	}
+
+	/* Insert to the sorted index. */
+	memmove(&s->sorted[pos + 1], &s->sorted[pos],
+		sizeof(struct stor_item *) * (size_t)(s->item_count - pos));
+	s->sorted[pos] = item;
+	s->item_count++;
+
+	return item;
+}
+
+/*
+ * Get a string item.
+ */
+bool stor_get(struct stor *s, const char *key, const char **value)
+{
+	struct stor_item *item;
+	const uint8_t *slot;
+
+	if (s->is_readonly) {
+		slot = stor_ro_find(s, key, STOR_TYPE_STRING);
+		if (slot == NULL)
+			return false;
+		*value = s->ro.pool + rostor_u32(slot + 4);
+		return true;
+	}
+
+	item = stor_find(s, key);
+	if (item == NULL || item->type != STOR_TYPE_STRING)
+		return false;
+
+	*value = item->val.s;
+	return true;
+}
+
+/*
+ * Get an int item.
+ */
+bool stor_get_int(struct stor *s, const char *key, int *value)
+{
+	struct stor_item *item;
+	const uint8_t *slot;
+
+	if (s->is_readonly) {
+		slot = stor_ro_find(s, key, STOR_TYPE_INT);
+		if (slot == NULL)
+			return false;
+		*value = (int)(int32_t)rostor_u32(slot + 4);
+		return true;
+	}
+
+	item = stor_find(s, key);
+	if (item == NULL || item->type != STOR_TYPE_INT)
+		return false;
+
+	*value = item->val.i;
+	return true;
+}
+
+/*
+ * Get a float item.
+ */
+bool stor_get_float(struct stor *s, const char *key, float *value)
+{
+	struct stor_item *item;
+	const uint8_t *slot;
+	uint32_t u;
+
+	if (s->is_readonly) {
+		slot = stor_ro_find(s, key, STOR_TYPE_FLOAT);
+		if (slot == NULL)
+			return false;
+		u = rostor_u32(slot + 4);
+		memcpy(value, &u, sizeof(float));
+		return true;
+	}
+
+	item = stor_find(s, key);
+	if (item == NULL || item->type != STOR_TYPE_FLOAT)
+		return false;
+
+	*value = item->val.f;
+	return true;
+}
+
+/*
+ * Get a bool item.
+ */
+bool stor_get_bool(struct stor *s, const char *key, bool *value)
+{
+	struct stor_item *item;
+	const uint8_t *slot;
+
+	if (s->is_readonly) {
+		slot = stor_ro_find(s, key, STOR_TYPE_BOOL);
+		if (slot == NULL)
+			return false;
+		*value = rostor_u32(slot + 4) != 0;
+		return true;
+	}
+
+	item = stor_find(s, key);
+	if (item == NULL || item->type != STOR_TYPE_BOOL)
+		return false;
+
+	*value = item->val.b;
+	return true;
+}
+
+/*
+ * Get a blob item.
+ */
+bool stor_get_blob(struct stor *s, const char *key, const void **data, size_t *size)
+{
+	struct stor_item *item;
+	const uint8_t *slot;
+
+	if (s->is_readonly) {
+		slot = stor_ro_find(s, key, STOR_TYPE_BLOB);
+		if (slot == NULL)
+			return false;
+		*data = s->ro.pool + rostor_u32(slot + 4);
+		*size = rostor_u32(slot + 8);
+		return true;
+	}
+
+	item = stor_find(s, key);
+	if (item == NULL || item->type != STOR_TYPE_BLOB)
+		return false;
+
+	*data = item->val.blob.data;
+	*size = item->val.blob.size;
+	return true;
+}
+
+/* Find an item. */
+static struct stor_item *stor_find(struct stor *s, const char *key)
+{
+	int pos;
+
+	assert(s != NULL);
+	assert(key != NULL);
+
+	if (!stor_search(s, 0, key, &pos))
+		return NULL;
+
+	return s->sorted[pos];
+}
+
+/*
+ * Search the sorted index from lo. Returns true and the position if
+ * found, otherwise returns false and the position to insert.
+ */
+static bool stor_search(struct stor *s, int lo, const char *key, int *pos)
+{
+	int hi, mid, cmp;
+
+	hi = s->item_count;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		cmp = strcmp(s->sorted[mid]->key, key);
+		if (cmp == 0) {
+			*pos = mid;
 			return true;
 		}
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
 
-	sys_error("Too many keys.");
+	*pos = lo;
 	return false;
 }
 
 /*
- * Get an data item.
+ * Iterate items that have a key prefix, in the key order.
  */
-bool stor_get(struct stor *s, const char *key, const char **value)
+bool stor_iterate_prefix(struct stor *s, const char *prefix,
+			 bool (*callback)(void *arg, const char *key, int type),
+			 void *arg)
 {
-	int i;
+	struct stor_item *item;
+	size_t len;
+	int pos;
+
+	assert(s != NULL);
+	assert(prefix != NULL);
+	assert(callback != NULL);
 
-	for (i = 0; i < st->key_count; i++) {
-		if (stcmp(st->key[i], key) == 0) {
-			assert(st->value[i] != NULL);
-			return st->value[i];
+	if (s->is_readonly)
+		return stor_ro_iterate_prefix(s, prefix, callback, arg);
+
+	/* The items with a prefix start from the prefix itself. */
+	stor_search(s, 0, prefix, &pos);
+
+	len = strlen(prefix);
+	for (; pos < s->item_count; pos++) {
+		item = s->sorted[pos];
+		if (strncmp(item->key, prefix, len) != 0)
+			break;
+		if (!callback(arg, item->key, item->type))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Get string items at once.
+ */
+int stor_get_many(struct stor *s, const char **keys, int count, const char **values)
+{
+	struct stor_item *item;
+	int i, lo, pos, found;
+
+	assert(s != NULL);
+	assert(keys != NULL);
+	assert(values != NULL);
+
+	if (s->is_readonly) {
+		found = 0;
+		for (i = 0; i < count; i++) {
+			if (stor_get(s, keys[i], &values[i]))
+				found++;
+			else
+				values[i] = NULL;
 		}
+		return found;
 	}
-	return false;
+
+	found = 0;
+	lo = 0;
+	for (i = 0; i < count; i++) {
+		/* Narrow the search range while the keys are ascending. */
+		if (i > 0 && strcmp(keys[i - 1], keys[i]) > 0)
+			lo = 0;
+
+		values[i] = NULL;
+		if (!stor_search(s, lo, keys[i], &pos)) {
+			lo = pos;
+			continue;
+		}
+		lo = pos;
+
+		item = s->sorted[pos];
+		if (item->type != STOR_TYPE_STRING)
+			continue;
+		values[i] = item->val.s;
+		found++;
+	}
+
+	return found;
 }
 
 /*
@@ -164,19 +849,41 @@ bool stor_get(struct stor *s, const char *key, const char **value)
  */
 bool stor_remove(struct stor *s, const char *key)
 {
-	int i;
+	struct stor_item *item, *last;
+	int pos, last_pos;
 
-	for (i = 0; i < KEY_MAX; i++) {
-		if (stcmp(st->key[i], key) == 0) {
-			assert(st->value[i] != NULL);
-			free(st->key[i]);
-			st->key[i] = NULL;
-			free(st->value[i]);
-			st->value[i] = NULL;
-			return true;
-		}
+	assert(s != NULL);
+	assert(key != NULL);
+
+	if (s->is_readonly) {
+		sys_error("Storage \"%s\" is read-only.", s->file_name);
+		return false;
 	}
-	return false;
+
+	if (!stor_search(s, 0, key, &pos))
+		return false;
+	item = s->sorted[pos];
+
+	/* Free the item. */
+	stor_clear_value(item);
+	free(item->key);
+	item->key = NULL;
+
+	/* Remove from the sorted index. */
+	memmove(&s->sorted[pos], &s->sorted[pos + 1],
+		sizeof(struct stor_item *) * (size_t)(s->item_count - pos - 1));
+	s->item_count--;
+
+	/* Move the last item to the hole to keep the items packed. */
+	last = &s->item[s->item_count];
+	if (item != last) {
+		stor_search(s, 0, last->key, &last_pos);
+		*item = *last;
+		s->sorted[last_pos] = item;
+	}
+	memset(last, 0, sizeof(struct stor_item));
+
+	return true;
 }
 
 /*
@@ -186,81 +893,532 @@ bool stor_remove_all(struct stor *s)
 {
 	int i;
 
-	for (i = 0; i < KEY_MAX; i++) {
-		if (st->key[i] != NULL) {
-			assert(st->value[i] != NULL);
-			free(st->key[i]);
-			st->key[i] = NULL;
-			free(st->value[i]);
-			st->value[i] = NULL;
-		}
+	assert(s != NULL);
+
+	if (s->is_readonly) {
+		sys_error("Storage \"%s\" is read-only.", s->file_name);
+		return false;
+	}
+
+	for (i = 0; i < s->item_count; i++) {
+		stor_clear_value(&s->item[i]);
+		free(s->item[i].key);
+		memset(&s->item[i], 0, sizeof(struct stor_item));
 	}
+	s->item_count = 0;
+
 	return true;
 }
 
+/* Free a value of an item. */
+static void stor_clear_value(struct stor_item *item)
+{
+	switch (item->type) {
+	case STOR_TYPE_STRING:
+		free(item->val.s);
+		break;
+	case STOR_TYPE_BLOB:
+		free(item->val.blob.data);
+		break;
+	default:
+		break;
+	}
+	memset(&item->val, 0, sizeof(item->val));
+}
+
+/*
+ * Enable or disable the compression of a storage file.
+ */
+void stor_set_compression(struct stor *s, bool enable)
+{
+	assert(s != NULL);
+
+	s->is_compressed = enable;
+}
+
 /*
  * Close a storage.
  */
 bool stor_close(struct stor *s)
 {
-	char buf[4096];
 	FILE *fp;
-	int i;
+
+	assert(s != NULL);
+
+	/* Nothing to write for a read-only storage. */
+	if (s->is_readonly) {
+		stor_free(s);
+		return true;
+	}
 
 	/* Open a file. */
 #ifdef TARGET_WIN32
 	_fmode = _O_BINARY;
-	fp = _wfopen(win32_utf8_to_utf16(st->file_name), L"r");
+	fp = _wfopen(win32_utf8_to_utf16(s->file_name), L"wb");
 #else
-	fp = fopen(st->file_name, "r");
+	fp = fopen(s->file_name, "wb");
 #endif
 	if (fp == NULL) {
-		sys_error("Cannot open file \"%s\".", path);
-		stor_free(st);
+		sys_error("Cannot open file \"%s\".", s->file_name);
+		stor_free(s);
 		return false;
 	}
 
-	/* Write key-value pairs. */
-	for (i = 0; i < KEY_MAX; i++) {
-		if (st->key[i] == NULL)
-			continue;
-		assert(st->value[i] != NULL);
+	/* Write items. */
+	if (!stor_save(s, fp)) {
+		sys_error("Cannot write to \"%s\".", s->file_name);
+		fclose(fp);
+		stor_free(s);
+		return false;
+	}
 
-		if (fwrite(st->key[i], strlen(st->key[i]) + 1, 1, fp) != 1) {
-			sys_error("Cannot write to \"%s\".", path);
-			stor_free(s);
-			return false;
+	if (fclose(fp) != 0) {
+		sys_error("Cannot write to \"%s\".", s->file_name);
+		stor_free(s);
+		return false;
+	}
+
+	stor_free(s);
+	return true;
+}
+
+/* Write items to a storage file. */
+static bool stor_save(struct stor *s, FILE *fp)
+{
+	struct stor_stream *st;
+	uint32_t flags;
+	uint8_t b[4];
+	bool ret;
+	int i;
+
+	/* Write a header. */
+	flags = s->is_compressed ? STOR_FLAG_DEFLATE : 0;
+	b[0] = (uint8_t)(flags & 0xff);
+	b[1] = (uint8_t)((flags >> 8) & 0xff);
+	b[2] = (uint8_t)((flags >> 16) & 0xff);
+	b[3] = (uint8_t)((flags >> 24) & 0xff);
+	if (fwrite(STOR_MAGIC, 4, 1, fp) != 1)
+		return false;
+	if (fwrite(b, sizeof(b), 1, fp) != 1)
+		return false;
+
+	/* Allocate a stream. */
+	st = malloc(sizeof(struct stor_stream));
+	if (st == NULL) {
+		sys_out_of_memory();
+		return false;
+	}
+	if (!stor_stream_begin(st, fp, s->is_compressed, true)) {
+		free(st);
+		return false;
+	}
+
+	/* Write the body. */
+	ret = stor_stream_write_u32(st, (uint32_t)s->item_count);
+	for (i = 0; i < s->item_count && ret; i++)
+		ret = stor_write_item(st, s->sorted[i]);
+	if (ret)
+		ret = stor_stream_finish(st);
+
+	stor_stream_end(st);
+	free(st);
+
+	return ret;
+}
+
+/* Write an item. */
+static bool stor_write_item(struct stor_stream *st, struct stor_item *item)
+{
+	const void *value;
+	uint32_t key_size, value_size, u;
+	uint8_t b;
+
+	/* Write a type and a key. */
+	b = (uint8_t)item->type;
+	if (!stor_stream_write(st, &b, 1))
+		return false;
+	key_size = (uint32_t)strlen(item->key) + 1;
+	if (!stor_stream_write_u32(st, key_size))
+		return false;
+	if (!stor_stream_write(st, item->key, key_size))
+		return false;
+
+	/* Write a value. */
+	switch (item->type) {
+	case STOR_TYPE_STRING:
+		value = item->val.s;
+		value_size = (uint32_t)strlen(item->val.s) + 1;
+		break;
+	case STOR_TYPE_INT:
+		return stor_stream_write_u32(st, 4) &&
+		       stor_stream_write_u32(st, (uint32_t)item->val.i);
+	case STOR_TYPE_FLOAT:
+		memcpy(&u, &item->val.f, sizeof(float));
+		return stor_stream_write_u32(st, 4) &&
+		       stor_stream_write_u32(st, u);
+	case STOR_TYPE_BOOL:
+		b = item->val.b ? 1 : 0;
+		value = &b;
+		value_size = 1;
+		break;
+	case STOR_TYPE_BLOB:
+		value = item->val.blob.data;
+		value_size = (uint32_t)item->val.blob.size;
+		break;
+	default:
+		assert(0);
+		return false;
+	}
+	if (!stor_stream_write_u32(st, value_size))
+		return false;
+	if (value_size > 0 && !stor_stream_write(st, value, value_size))
+		return false;
+
+	return true;
+}
+
+/*
+ * Stream
+ */
+
+/* Start a stream on a file. */
+static bool stor_stream_begin(struct stor_stream *st, FILE *fp, bool is_compressed, bool is_writing)
+{
+	int ret;
+
+	st->fp = fp;
+	st->is_compressed = is_compressed;
+	st->is_writing = is_writing;
+	if (!is_compressed)
+		return true;
+
+	memset(&st->z, 0, sizeof(z_stream));
+	if (is_writing) {
+		ret = deflateInit(&st->z, Z_DEFAULT_COMPRESSION);
+		st->z.next_out = st->buf;
+		st->z.avail_out = STREAM_BUF_SIZE;
+	} else {
+		ret = inflateInit(&st->z);
+	}
+	if (ret != Z_OK) {
+		sys_error("zlib initialization failed.");
+		return false;
+	}
+
+	return true;
+}
+
+/* Read bytes from a stream. */
+static bool stor_stream_read(struct stor_stream *st, void *buf, size_t size)
+{
+	size_t len;
+	int ret;
+
+	if (size == 0)
+		return true;
+
+	if (!st->is_compressed)
+		return fread(buf, size, 1, st->fp) == 1;
+
+	st->z.next_out = buf;
+	st->z.avail_out = (uInt)size;
+	while (st->z.avail_out > 0) {
+		/* Refill the input buffer. */
+		if (st->z.avail_in == 0) {
+			len = fread(st->buf, 1, STREAM_BUF_SIZE, st->fp);
+			if (len == 0)
+				return false;
+			st->z.next_in = st->buf;
+			st->z.avail_in = (uInt)len;
 		}
 
-		if (fwrite(st->value[i], strlen(st->value[i]) + 1, 1, fp) != 1) {
-			sys_error("Cannot write to \"%s\".", path);
-			stor_free(s);
+		/* Inflate. */
+		ret = inflate(&st->z, Z_NO_FLUSH);
+		if (ret == Z_STREAM_END && st->z.avail_out > 0)
 			return false;
+		if (ret != Z_OK && ret != Z_STREAM_END)
+			return false;
+	}
+
+	return true;
+}
+
+/* Read a little-endian u32 from a stream. */
+static bool stor_stream_read_u32(struct stor_stream *st, uint32_t *data)
+{
+	uint8_t b[4];
+
+	if (!stor_stream_read(st, b, sizeof(b)))
+		return false;
+
+	*data = (uint32_t)b[0] |
+		((uint32_t)b[1] << 8) |
+		((uint32_t)b[2] << 16) |
+		((uint32_t)b[3] << 24);
+	return true;
+}
+
+/* Write bytes to a stream. */
+static bool stor_stream_write(struct stor_stream *st, const void *buf, size_t size)
+{
+	if (size == 0)
+		return true;
+
+	if (!st->is_compressed)
+		return fwrite(buf, size, 1, st->fp) == 1;
+
+	st->z.next_in = (Bytef *)buf;
+	st->z.avail_in = (uInt)size;
+	while (st->z.avail_in > 0) {
+		/* Deflate. */
+		if (deflate(&st->z, Z_NO_FLUSH) == Z_STREAM_ERROR)
+			return false;
+
+		/* Flush the output buffer if full. */
+		if (st->z.avail_out == 0) {
+			if (fwrite(st->buf, STREAM_BUF_SIZE, 1, st->fp) != 1)
+				return false;
+			st->z.next_out = st->buf;
+			st->z.avail_out = STREAM_BUF_SIZE;
 		}
 	}
 
-	stor_free(s);
 	return true;
 }
 
+/* Write a little-endian u32 to a stream. */
+static bool stor_stream_write_u32(struct stor_stream *st, uint32_t data)
+{
+	uint8_t b[4];
+
+	b[0] = (uint8_t)(data & 0xff);
+	b[1] = (uint8_t)((data >> 8) & 0xff);
+	b[2] = (uint8_t)((data >> 16) & 0xff);
+	b[3] = (uint8_t)((data >> 24) & 0xff);
+
+	return stor_stream_write(st, b, sizeof(b));
+}
+
+/* Flush the pending output of a writing stream. */
+static bool stor_stream_finish(struct stor_stream *st)
+{
+	size_t len;
+	int ret;
+
+	if (!st->is_compressed)
+		return true;
+
+	do {
+		ret = deflate(&st->z, Z_FINISH);
+		if (ret == Z_STREAM_ERROR)
+			return false;
+
+		/* Write out the output buffer. */
+		len = STREAM_BUF_SIZE - st->z.avail_out;
+		if (len > 0 && fwrite(st->buf, len, 1, st->fp) != 1)
+			return false;
+		st->z.next_out = st->buf;
+		st->z.avail_out = STREAM_BUF_SIZE;
+	} while (ret != Z_STREAM_END);
+
+	return true;
+}
+
+/* Release a stream. (The file is not closed.) */
+static void stor_stream_end(struct stor_stream *st)
+{
+	if (!st->is_compressed)
+		return;
+
+	if (st->is_writing)
+		deflateEnd(&st->z);
+	else
+		inflateEnd(&st->z);
+}
+
 /* Free stor object. */
 static void stor_free(struct stor *s)
 {
 	int i;
 
-	free(st->file_name);
-	st->file_name = NULL;
+	free(s->file_name);
+	s->file_name = NULL;
 
-	for (i = 0; i < KEY_MAX; i++) {
-		if (st->key[i] != NULL) {
-			free(st->key[i]);
-			st->key[i] = NULL;
+	/* Release the file image of a read-only storage. */
+	if (s->ro.data != NULL) {
+#ifdef USE_MMAP
+		if (s->ro.is_mapped)
+			munmap((void *)s->ro.data, s->ro.size);
+		else
+			free((void *)s->ro.data);
+#else
+		free((void *)s->ro.data);
+#endif
+	}
+
+	for (i = 0; i < s->item_count; i++) {
+		stor_clear_value(&s->item[i]);
+		free(s->item[i].key);
+	}
+
+	free(s);
+}
+
+/*
+ * Read-only Storage
+ */
+
+/* Map a read-only storage file and validate it. */
+static bool stor_ro_load(struct stor *s, FILE *fp)
+{
+	struct stor_ro *ro;
+	const uint8_t *slot;
+	uint64_t expected, end;
+	uint32_t i, key_offset, value, value_size, type;
+	long len;
+
+	ro = &s->ro;
+
+	/* Get the file size. */
+	if (fseek(fp, 0, SEEK_END) != 0)
+		return false;
+	len = ftell(fp);
+	if (len < ROSTOR_HEADER_SIZE)
+		return false;
+	ro->size = (size_t)len;
+	rewind(fp);
+
+	/* Map the file, or read it if we cannot. */
+#ifdef USE_MMAP
+	ro->data = mmap(NULL, ro->size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+	if (ro->data == MAP_FAILED)
+		ro->data = NULL;
+	else
+		ro->is_mapped = true;
+#endif
+	if (ro->data == NULL) {
+		ro->data = malloc(ro->size);
+		if (ro->data == NULL) {
+			sys_out_of_memory();
+			return false;
 		}
-		if (st->value[i] != NULL) {
-			free(st->value[i]);
-			st->value[i] = NULL;
+		if (fread((void *)ro->data, ro->size, 1, fp) != 1)
+			return false;
+	}
+
+	/* Get the header. */
+	ro->item_count = rostor_u32(ro->data + 4);
+	ro->bucket_count = rostor_u32(ro->data + 8);
+	ro->pool_size = rostor_u32(ro->data + 12);
+	if (ro->item_count > 0 && (ro->bucket_count == 0 || ro->pool_size == 0))
+		return false;
+
+	/* Check the file size. */
+	expected = ROSTOR_HEADER_SIZE +
+		   (uint64_t)ro->bucket_count * 4 +
+		   (uint64_t)ro->item_count * ROSTOR_SLOT_SIZE +
+		   (uint64_t)ro->item_count * 4 +
+		   ro->pool_size;
+	if (expected != (uint64_t)ro->size)
+		return false;
+
+	/* Get the sections. */
+	ro->disp = ro->data + ROSTOR_HEADER_SIZE;
+	ro->slot = ro->disp + (size_t)ro->bucket_count * 4;
+	ro->order = ro->slot + (size_t)ro->item_count * ROSTOR_SLOT_SIZE;
+	ro->pool = (const char *)(ro->order + (size_t)ro->item_count * 4);
+
+	/* The pool must end with a NUL so that every key is terminated. */
+	if (ro->pool_size > 0 && ro->pool[ro->pool_size - 1] != '\0')
+		return false;
+
+	/* Check the slots so that lookups don't have to. */
+	for (i = 0; i < ro->item_count; i++) {
+		slot = ro->slot + (size_t)i * ROSTOR_SLOT_SIZE;
+		key_offset = rostor_u32(slot);
+		value = rostor_u32(slot + 4);
+		value_size = rostor_u32(slot + 8);
+		type = rostor_u32(slot + 12);
+		if (key_offset >= ro->pool_size)
+			return false;
+		if (type > STOR_TYPE_BLOB)
+			return false;
+		if (type == STOR_TYPE_STRING || type == STOR_TYPE_BLOB) {
+			end = (uint64_t)value + value_size;
+			if (end > ro->pool_size)
+				return false;
+			if (type == STOR_TYPE_STRING &&
+			    (value_size == 0 || ro->pool[end - 1] != '\0'))
+				return false;
 		}
+		if (rostor_u32(ro->order + (size_t)i * 4) >= ro->item_count)
+			return false;
 	}
 
-	free(st);
+	return true;
+}
+
+/* Find a slot of a read-only storage. */
+static const uint8_t *stor_ro_find(struct stor *s, const char *key, int type)
+{
+	struct stor_ro *ro;
+	const uint8_t *slot;
+	uint32_t d;
+
+	assert(key != NULL);
+
+	ro = &s->ro;
+	if (ro->item_count == 0)
+		return NULL;
+
+	/* Get a slot by the perfect hash. */
+	d = rostor_u32(ro->disp + (size_t)(rostor_hash(key, 0) % ro->bucket_count) * 4);
+	slot = ro->slot + (size_t)(rostor_hash(key, d) % ro->item_count) * ROSTOR_SLOT_SIZE;
+
+	/* Check the key and the type. */
+	if (strcmp(ro->pool + rostor_u32(slot), key) != 0)
+		return NULL;
+	if (rostor_u32(slot + 12) != (uint32_t)type)
+		return NULL;
+
+	return slot;
+}
+
+/* Iterate items of a read-only storage that have a key prefix. */
+static bool stor_ro_iterate_prefix(struct stor *s, const char *prefix,
+				   bool (*callback)(void *arg, const char *key, int type),
+				   void *arg)
+{
+	struct stor_ro *ro;
+	const uint8_t *slot;
+	const char *key;
+	size_t len;
+	uint32_t lo, hi, mid;
+
+	ro = &s->ro;
+
+	/* Search the first key not less than the prefix. */
+	lo = 0;
+	hi = ro->item_count;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		slot = ro->slot + (size_t)rostor_u32(ro->order + (size_t)mid * 4) * ROSTOR_SLOT_SIZE;
+		if (strcmp(ro->pool + rostor_u32(slot), prefix) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	/* Walk the keys that have the prefix. */
+	len = strlen(prefix);
+	for (; lo < ro->item_count; lo++) {
+		slot = ro->slot + (size_t)rostor_u32(ro->order + (size_t)lo * 4) * ROSTOR_SLOT_SIZE;
+		key = ro->pool + rostor_u32(slot);
+		if (strncmp(key, prefix, len) != 0)
+			break;
+		if (!callback(arg, key, (int)rostor_u32(slot + 12)))
+			return false;
+	}
+
+	return true;
 }
@@ -15,7 +15,7 @@
 #include "mediakit/compat.h"
 
 /* Initialize the stdstor module. */
-bool stdstor_init(void);
+bool stdstor_init(char *(*make_path_func)(const char *));
 
 /* Cleanup the stdstor module. */
 void stdstor_cleanup(void);
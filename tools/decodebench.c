@@ -0,0 +1,195 @@
+/* -*- coding: utf-8; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * MediaKit
+ * Copyright (c) 2025, Tamako Mori. All rights reserved.
+ */
+
+/*
+ * decodebench.c: The image decoder benchmark.
+ *
+ * Usage: decodebench [-n <runs>] <file>...
+ *
+ * Each file is read into memory once and decoded by
+ * image_create_with_data() the given number of times. (10 by default)
+ * The best and the average times are printed with the pixel rate of the
+ * best run.
+ *
+ * The codecs are linked from libroot, so build this against the libroot
+ * of each external/build-libs.sh to compare the codec builds.
+ */
+
+#include "mediakit/mediakit.h"
+
+#include <time.h>
+
+/* The default number of runs. */
+#define DEFAULT_RUNS	(10)
+
+/* Format names in the order of IMAGE_FORMAT_*. */
+static const char *format_name[] = {
+	"?",
+	"png",
+	"jpeg",
+	"webp",
+};
+
+/* Forward declarations. */
+static bool bench_file(const char *file, int runs);
+static uint8_t *read_file(const char *file, size_t *size);
+static double now(void);
+
+int main(int argc, char *argv[])
+{
+	int runs, i;
+	bool ok;
+
+	runs = DEFAULT_RUNS;
+	i = 1;
+	if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+		runs = atoi(argv[2]);
+		i = 3;
+	}
+	if (i == argc || runs <= 0) {
+		fprintf(stderr, "Usage: decodebench [-n <runs>] <file>...\n");
+		return 1;
+	}
+
+	if (!image_init())
+		return 1;
+
+	printf("SIMD level: %s, %d runs\n", image_get_simd_level(), runs);
+	printf("%-32s %-5s %11s %10s %10s %10s\n",
+	       "file", "type", "size", "best ms", "avg ms", "Mpixel/s");
+
+	ok = true;
+	for (; i < argc; i++) {
+		if (!bench_file(argv[i], runs))
+			ok = false;
+	}
+
+	image_cleanup();
+
+	return ok ? 0 : 1;
+}
+
+/* Decode a file and print the times. */
+static bool bench_file(const char *file, int runs)
+{
+	struct image_info info;
+	struct image *img;
+	uint8_t *data;
+	size_t size;
+	double start, t, best, total;
+	char metrics[32];
+	int i;
+
+	data = read_file(file, &size);
+	if (data == NULL)
+		return false;
+
+	if (!image_probe(data, size, &info)) {
+		fprintf(stderr, "Unknown format \"%s\".\n", file);
+		free(data);
+		return false;
+	}
+
+	best = 0;
+	total = 0;
+	for (i = 0; i < runs; i++) {
+		start = now();
+		if (!image_create_with_data(data, size, &img)) {
+			fprintf(stderr, "Cannot decode \"%s\".\n", file);
+			free(data);
+			return false;
+		}
+		t = now() - start;
+		image_destroy(img);
+
+		if (i == 0 || t < best)
+			best = t;
+		total += t;
+	}
+
+	snprintf(metrics, sizeof(metrics), "%dx%d", info.width, info.height);
+	printf("%-32s %-5s %11s %10.2f %10.2f %10.1f\n",
+	       file,
+	       format_name[info.format],
+	       metrics,
+	       best,
+	       total / runs,
+	       (double)info.width * info.height / (best * 1000.0));
+
+	free(data);
+	return true;
+}
+
+/* Read a file into memory. */
+static uint8_t *read_file(const char *file, size_t *size)
+{
+	FILE *fp;
+	uint8_t *data;
+	long len;
+
+	fp = fopen(file, "rb");
+	if (fp == NULL) {
+		fprintf(stderr, "Cannot open \"%s\".\n", file);
+		return NULL;
+	}
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	rewind(fp);
+
+	data = malloc((size_t)len + 1);
+	if (data == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		fclose(fp);
+		return NULL;
+	}
+	if (len > 0 && fread(data, (size_t)len, 1, fp) != 1) {
+		fprintf(stderr, "Cannot read \"%s\".\n", file);
+		free(data);
+		fclose(fp);
+		return NULL;
+	}
+	*size = (size_t)len;
+
+	fclose(fp);
+	return data;
+}
+
+/* Get the monotonic time in ms. */
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1000000.0;
+}
+
+/*
+ * The logging functions that the image module calls.
+ */
+
+void sys_log(const char *s, ...)
+{
+	va_list ap;
+
+	va_start(ap, s);
+	vprintf(s, ap);
+	va_end(ap);
+}
+
+void sys_error(const char *s, ...)
+{
+	va_list ap;
+
+	va_start(ap, s);
+	vfprintf(stderr, s, ap);
+	va_end(ap);
+}
+
+void sys_out_of_memory(void)
+{
+	fprintf(stderr, "Out of memory.\n");
+}
@@ -0,0 +1,1011 @@
+/* -*- coding: utf-8; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * MediaKit
+ * Copyright (c) 2025, Tamako Mori. All rights reserved.
+ */
+
+/*
+ * kerneltest.c: The image row kernel test.
+ *
+ * Usage: kerneltest [-b]
+ *
+ * The row kernels of each level that runs on the CPU are checked on
+ * random rows of every width up to WIDTH_MAX at every alignment:
+ *  - The C kernels must be within 1 of a float reference, or within 2
+ *    for the Porter-Duff composition which rounds the premultiplied
+ *    source before the products.  The RGB expansion has nothing to
+ *    round, and is only compared with the C kernel.
+ *  - The SIMD kernels must match the C kernels bit for bit, and must not
+ *    touch the pixels after a row.
+ * The exit status is 1 if a check fails.
+ *
+ * With -b, the time to run each kernel over a 1920x1080 frame is printed
+ * for each level after the checks.  The blending kernels run at alpha=192,
+ * except alpha_pm_opaque which is the alpha_pm blending at alpha=255.
+ *
+ * MEDIAKIT_IMAGE_SIMD=<level> skips the levels above the given one.
+ */
+
+#include "mediakit/mediakit.h"
+#include "imagekernel.h"
+
+#include <math.h>
+#include <time.h>
+
+/* The widest row to check. (Covers the tails of two AVX2 loops.) */
+#define WIDTH_MAX	(67)
+
+/* Pixel offsets to check. (All alignments of a 32-byte vector.) */
+#define ALIGN_COUNT	(8)
+
+/* Allowed errors against the float reference. */
+#define TOLERANCE		(1)
+#define COMPOSITE_TOLERANCE	(2)
+
+/* Random rows per width and alignment. */
+#define ROUNDS		(16)
+
+/* Guard pixels after a row. */
+#define GUARD		(16)
+
+/* The row buffer size. */
+#define BUF_SIZE	(ALIGN_COUNT + WIDTH_MAX + GUARD)
+
+/* A source image for the resamplers. */
+#define SRC_WIDTH	(24)
+#define SRC_HEIGHT	(8)
+
+/* The benchmark frame. */
+#define FRAME_WIDTH	(1920)
+#define FRAME_HEIGHT	(1080)
+
+/* The benchmark takes the best of this number of runs. */
+#define BENCH_RUNS	(5)
+
+/* Kernels. */
+enum kernel {
+	KERNEL_ALPHA,
+	KERNEL_ADD,
+	KERNEL_SUB,
+	KERNEL_ALPHA_PM,
+	KERNEL_ALPHA_PM_OPAQUE,
+	KERNEL_ADD_PM,
+	KERNEL_SUB_PM,
+	KERNEL_LERP,
+	KERNEL_BILINEAR,
+	KERNEL_AFFINE_BILINEAR,
+	KERNEL_EXPAND_RGB,
+	KERNEL_EXPAND_BGR,
+	KERNEL_RULE,
+	KERNEL_RULE_PM,
+	KERNEL_COMPOSITE,
+	KERNEL_COMPOSITE_PM,
+	KERNEL_COUNT
+};
+
+/* Kernel names. */
+static const char *kernel_name[KERNEL_COUNT] = {
+	"alpha",
+	"add",
+	"sub",
+	"alpha_pm",
+	"alpha_pm_opaque",
+	"add_pm",
+	"sub_pm",
+	"lerp",
+	"bilinear",
+	"affine_bilinear",
+	"expand_rgb",
+	"expand_bgr",
+	"rule",
+	"rule_pm",
+	"composite",
+	"composite_pm",
+};
+
+/* The kernels of a level. (NULL if the level uses the C kernel.) */
+struct level {
+	const char *name;
+	image_row_func alpha_row;
+	image_row_func add_row;
+	image_row_func sub_row;
+	image_row_func alpha_pm_row;
+	image_row_func alpha_pm_opaque_row;
+	image_row_func add_pm_row;
+	image_row_func sub_pm_row;
+	image_lerp_func lerp_row;
+	image_resample_func bilinear_row;
+	image_affine_func affine_bilinear_row;
+	image_expand_func expand_rgb_row;
+	image_expand_func expand_bgr_row;
+	image_rule_func rule_row;
+	image_rule_func rule_pm_row;
+	image_composite_func composite_row;
+	image_composite_func composite_pm_row;
+};
+
+/* Levels in the order of image_get_simd_level(). */
+static struct level level[4];
+static int level_count;
+
+/* Porter-Duff factors in the order of enum image_composite_op. */
+static const struct image_pd pd_table[] = {
+	{   0,  0,   0,  0 },
+	{ 255,  0,   0,  0 },
+	{   0,  0, 255,  0 },
+	{ 255,  0, 255, -1 },
+	{ 255, -1, 255,  0 },
+	{   0,  1,   0,  0 },
+	{   0,  0,   0,  1 },
+	{ 255, -1,   0,  0 },
+	{   0,  0, 255, -1 },
+	{   0,  1, 255, -1 },
+	{ 255, -1,   0,  1 },
+	{ 255, -1, 255, -1 },
+};
+
+/* A float reference of a pixel. (r[i] is the channel at the shift 8 * i.) */
+typedef void (*ref_func)(pixel_t d, pixel_t s, uint32_t alpha, double *r);
+
+/* Random state. */
+static uint32_t seed = 1;
+
+/* Failures. */
+static int fail_count;
+
+/* Row buffers. */
+static pixel_t src_buf[BUF_SIZE];
+static pixel_t rule_buf[BUF_SIZE];
+static pixel_t dst_buf[BUF_SIZE];
+static pixel_t ref_buf[BUF_SIZE];
+static pixel_t out_buf[BUF_SIZE];
+static uint8_t byte_buf[BUF_SIZE * 3];
+
+/* A source image for the resamplers, with a padding column and row. */
+static pixel_t src_image[(SRC_WIDTH + 1) * (SRC_HEIGHT + 1)];
+
+/* Forward declarations. */
+static void add_levels(void);
+static void check_level(int index);
+static void check_row(const char *name, int index, image_row_func ref_row, image_row_func row, ref_func ref, bool is_pm);
+static void check_lerp(int index, image_lerp_func row);
+static void check_bilinear(int index, image_resample_func row);
+static void check_affine_bilinear(int index, image_affine_func row);
+static void check_expand(const char *name, int index, image_expand_func ref_row, image_expand_func row);
+static void check_rule(const char *name, int index, image_rule_func ref_row, image_rule_func row, bool is_pm);
+static void check_composite(const char *name, int index, image_composite_func ref_row, image_composite_func row, bool is_pm);
+static bool compare_rows(const char *name, int index, int width, int align);
+static bool compare_ref(const char *name, int index, int width, int x, pixel_t out, const double *r, int tolerance);
+static void ref_alpha(pixel_t d, pixel_t s, uint32_t alpha, double *r);
+static void ref_add(pixel_t d, pixel_t s, uint32_t alpha, double *r);
+static void ref_sub(pixel_t d, pixel_t s, uint32_t alpha, double *r);
+static void ref_alpha_pm(pixel_t d, pixel_t s, uint32_t alpha, double *r);
+static void ref_alpha_pm_opaque(pixel_t d, pixel_t s, uint32_t alpha, double *r);
+static void ref_add_pm(pixel_t d, pixel_t s, uint32_t alpha, double *r);
+static void ref_sub_pm(pixel_t d, pixel_t s, uint32_t alpha, double *r);
+static void ref_composite(pixel_t d, pixel_t s, uint32_t alpha, const struct image_pd *pd, bool is_pm, double *r);
+static void fill_rows(bool is_pm);
+static pixel_t random_pixel(void);
+static uint32_t random_alpha(void);
+static uint32_t random_u32(void);
+static uint32_t channel(pixel_t p, int i);
+static void bench(void);
+static double bench_kernel(int index, int k, pixel_t *dst, const pixel_t *src, const uint8_t *bytes);
+static double now(void);
+
+int main(int argc, char *argv[])
+{
+	bool is_bench;
+	int i;
+
+	is_bench = false;
+	if (argc == 2 && strcmp(argv[1], "-b") == 0) {
+		is_bench = true;
+	} else if (argc != 1) {
+		fprintf(stderr, "Usage: kerneltest [-b]\n");
+		return 1;
+	}
+
+	if (!image_init())
+		return 1;
+	add_levels();
+
+	for (i = 0; i < level_count; i++)
+		check_level(i);
+
+	if (is_bench && fail_count == 0)
+		bench();
+
+	image_cleanup();
+
+	if (fail_count > 0) {
+		printf("%d failures.\n", fail_count);
+		return 1;
+	}
+	return 0;
+}
+
+/* Add the levels up to the one that image_init() selected. */
+static void add_levels(void)
+{
+	const char *top;
+
+	top = image_get_simd_level();
+
+	level[0].name = "c";
+	level[0].alpha_row = image_alpha_row_c;
+	level[0].add_row = image_add_row_c;
+	level[0].sub_row = image_sub_row_c;
+	level[0].alpha_pm_row = image_alpha_pm_row_c;
+	level[0].alpha_pm_opaque_row = image_alpha_pm_opaque_row_c;
+	level[0].add_pm_row = image_add_pm_row_c;
+	level[0].sub_pm_row = image_sub_pm_row_c;
+	level[0].lerp_row = image_lerp_row_c;
+	level[0].bilinear_row = image_bilinear_row_c;
+	level[0].affine_bilinear_row = image_affine_bilinear_row_c;
+	level[0].expand_rgb_row = image_expand_rgb_row_c;
+	level[0].expand_bgr_row = image_expand_bgr_row_c;
+	level[0].rule_row = image_rule_row_c;
+	level[0].rule_pm_row = image_rule_pm_row_c;
+	level[0].composite_row = image_composite_row_c;
+	level[0].composite_pm_row = image_composite_pm_row_c;
+	level_count = 1;
+	if (strcmp(top, "c") == 0)
+		return;
+
+#if defined(ARCH_X86) || defined(ARCH_X86_64)
+	level[1].name = "sse2";
+	level[1].alpha_row = image_alpha_row_sse2;
+	level[1].add_row = image_add_row_sse2;
+	level[1].sub_row = image_sub_row_sse2;
+	level[1].alpha_pm_row = image_alpha_pm_row_sse2;
+	level[1].alpha_pm_opaque_row = image_alpha_pm_opaque_row_sse2;
+	level[1].add_pm_row = image_add_pm_row_sse2;
+	level[1].sub_pm_row = image_sub_pm_row_sse2;
+	level[1].lerp_row = image_lerp_row_sse2;
+	level[1].bilinear_row = image_bilinear_row_sse2;
+	level[1].affine_bilinear_row = image_affine_bilinear_row_sse2;
+	level[1].rule_row = image_rule_row_sse2;
+	level[1].rule_pm_row = image_rule_pm_row_sse2;
+	level[1].composite_row = image_composite_row_sse2;
+	level[1].composite_pm_row = image_composite_pm_row_sse2;
+	level_count = 2;
+	if (strcmp(top, "sse2") == 0)
+		return;
+
+	level[2].name = "avx2";
+	level[2].alpha_row = image_alpha_row_avx2;
+	level[2].add_row = image_add_row_avx2;
+	level[2].sub_row = image_sub_row_avx2;
+	level[2].alpha_pm_row = image_alpha_pm_row_avx2;
+	level[2].alpha_pm_opaque_row = image_alpha_pm_opaque_row_avx2;
+	level[2].add_pm_row = image_add_pm_row_avx2;
+	level[2].sub_pm_row = image_sub_pm_row_avx2;
+	level[2].lerp_row = image_lerp_row_avx2;
+	level[2].expand_rgb_row = image_expand_rgb_row_avx2;
+	level[2].expand_bgr_row = image_expand_bgr_row_avx2;
+	level[2].rule_row = image_rule_row_avx2;
+	level[2].rule_pm_row = image_rule_pm_row_avx2;
+	level[2].composite_row = image_composite_row_avx2;
+	level[2].composite_pm_row = image_composite_pm_row_avx2;
+	level_count = 3;
+#endif
+
+#if defined(ARCH_ARM64)
+	level[1].name = "neon";
+	level[1].alpha_row = image_alpha_row_neon;
+	level[1].add_row = image_add_row_neon;
+	level[1].sub_row = image_sub_row_neon;
+	level[1].alpha_pm_row = image_alpha_pm_row_neon;
+	level[1].alpha_pm_opaque_row = image_alpha_pm_opaque_row_neon;
+	level[1].add_pm_row = image_add_pm_row_neon;
+	level[1].sub_pm_row = image_sub_pm_row_neon;
+	level[1].lerp_row = image_lerp_row_neon;
+	level[1].bilinear_row = image_bilinear_row_neon;
+	level[1].affine_bilinear_row = image_affine_bilinear_row_neon;
+	level[1].expand_rgb_row = image_expand_rgb_row_neon;
+	level[1].expand_bgr_row = image_expand_bgr_row_neon;
+	level[1].rule_row = image_rule_row_neon;
+	level[1].rule_pm_row = image_rule_pm_row_neon;
+	level[1].composite_row = image_composite_row_neon;
+	level[1].composite_pm_row = image_composite_pm_row_neon;
+	level_count = 2;
+#endif
+}
+
+/* Check the kernels of a level. */
+static void check_level(int index)
+{
+	const struct level *c, *lv;
+	int last_fail_count;
+
+	c = &level[0];
+	lv = &level[index];
+	last_fail_count = fail_count;
+
+	/* Same seeds for all levels, so that a failure is reproducible. */
+	seed = 1;
+
+	if (lv->alpha_row != NULL)
+		check_row("alpha", index, c->alpha_row, lv->alpha_row, ref_alpha, false);
+	if (lv->add_row != NULL)
+		check_row("add", index, c->add_row, lv->add_row, ref_add, false);
+	if (lv->sub_row != NULL)
+		check_row("sub", index, c->sub_row, lv->sub_row, ref_sub, false);
+	if (lv->alpha_pm_row != NULL)
+		check_row("alpha_pm", index, c->alpha_pm_row, lv->alpha_pm_row, ref_alpha_pm, true);
+	if (lv->alpha_pm_opaque_row != NULL)
+		check_row("alpha_pm_opaque", index, c->alpha_pm_opaque_row, lv->alpha_pm_opaque_row, ref_alpha_pm_opaque, true);
+	if (lv->add_pm_row != NULL)
+		check_row("add_pm", index, c->add_pm_row, lv->add_pm_row, ref_add_pm, true);
+	if (lv->sub_pm_row != NULL)
+		check_row("sub_pm", index, c->sub_pm_row, lv->sub_pm_row, ref_sub_pm, true);
+	if (lv->lerp_row != NULL)
+		check_lerp(index, lv->lerp_row);
+	if (lv->bilinear_row != NULL)
+		check_bilinear(index, lv->bilinear_row);
+	if (lv->affine_bilinear_row != NULL)
+		check_affine_bilinear(index, lv->affine_bilinear_row);
+	if (lv->expand_rgb_row != NULL)
+		check_expand("expand_rgb", index, c->expand_rgb_row, lv->expand_rgb_row);
+	if (lv->expand_bgr_row != NULL)
+		check_expand("expand_bgr", index, c->expand_bgr_row, lv->expand_bgr_row);
+	if (lv->rule_row != NULL)
+		check_rule("rule", index, c->rule_row, lv->rule_row, false);
+	if (lv->rule_pm_row != NULL)
+		check_rule("rule_pm", index, c->rule_pm_row, lv->rule_pm_row, true);
+	if (lv->composite_row != NULL)
+		check_composite("composite", index, c->composite_row, lv->composite_row, false);
+	if (lv->composite_pm_row != NULL)
+		check_composite("composite_pm", index, c->composite_pm_row, lv->composite_pm_row, true);
+
+	printf("%-5s %s\n", lv->name, fail_count == last_fail_count ? "ok" : "FAILED");
+}
+
+/* Check a blending kernel. */
+static void check_row(const char *name, int index, image_row_func ref_row, image_row_func row, ref_func ref, bool is_pm)
+{
+	double r[4];
+	uint32_t alpha;
+	int width, align, n, x;
+
+	for (width = 0; width <= WIDTH_MAX; width++) {
+		for (align = 0; align < ALIGN_COUNT; align++) {
+			for (n = 0; n < ROUNDS; n++) {
+				fill_rows(is_pm);
+				alpha = random_alpha();
+				row(out_buf + align, src_buf + align, width, alpha);
+				if (index > 0) {
+					ref_row(ref_buf + align, src_buf + align, width, alpha);
+					if (!compare_rows(name, index, width, align))
+						return;
+					continue;
+				}
+				for (x = 0; x < width; x++) {
+					ref(dst_buf[align + x], src_buf[align + x], alpha, r);
+					if (!compare_ref(name, index, width, x, out_buf[align + x], r, TOLERANCE))
+						return;
+				}
+			}
+		}
+	}
+}
+
+/* Check an interpolation kernel. */
+static void check_lerp(int index, image_lerp_func row)
+{
+	double r[4];
+	uint32_t w;
+	int width, align, n, x, i;
+
+	for (width = 0; width <= WIDTH_MAX; width++) {
+		for (align = 0; align < ALIGN_COUNT; align++) {
+			for (n = 0; n < ROUNDS; n++) {
+				fill_rows(false);
+				w = random_u32() % 257;
+				row(out_buf + align, src_buf + align, rule_buf + align, width, w);
+				if (index > 0) {
+					level[0].lerp_row(ref_buf + align, src_buf + align, rule_buf + align, width, w);
+					if (!compare_rows("lerp", index, width, align))
+						return;
+					continue;
+				}
+				for (x = 0; x < width; x++) {
+					for (i = 0; i < 4; i++) {
+						r[i] = (channel(src_buf[align + x], i) * (256.0 - w) +
+							channel(rule_buf[align + x], i) * w) / 256.0;
+					}
+					if (!compare_ref("lerp", index, width, x, out_buf[align + x], r, TOLERANCE))
+						return;
+				}
+			}
+		}
+	}
+}
+
+/* Check a horizontal resampling kernel. */
+static void check_bilinear(int index, image_resample_func row)
+{
+	double r[4];
+	uint32_t w;
+	int32_t fx, step, f;
+	int width, align, n, max_x, x, i, j;
+
+	for (width = 0; width <= WIDTH_MAX; width++) {
+		for (align = 0; align < ALIGN_COUNT; align++) {
+			for (n = 0; n < ROUNDS; n++) {
+				/* The source row has a padding pixel, as in image_draw_scaled(). */
+				fill_rows(false);
+				max_x = 1 + (int)(random_u32() % (WIDTH_MAX - 1));
+				fx = (int32_t)(random_u32() % 0x40000) - 0x20000;
+				step = (int32_t)(random_u32() % 0x30000);
+				row(out_buf + align, src_buf, width, fx, step, max_x);
+				if (index > 0) {
+					level[0].bilinear_row(ref_buf + align, src_buf, width, fx, step, max_x);
+					if (!compare_rows("bilinear", index, width, align))
+						return;
+					continue;
+				}
+				f = fx;
+				for (x = 0; x < width; x++) {
+					image_sample_pos(f, max_x, &j, &w);
+					f += step;
+					for (i = 0; i < 4; i++) {
+						r[i] = (channel(src_buf[j], i) * (256.0 - w) +
+							channel(src_buf[j + 1], i) * w) / 256.0;
+					}
+					if (!compare_ref("bilinear", index, width, x, out_buf[align + x], r, TOLERANCE))
+						return;
+				}
+			}
+		}
+	}
+}
+
+/* Check an affine sampling kernel. */
+static void check_affine_bilinear(int index, image_affine_func row)
+{
+	const pixel_t *p;
+	double r[4], fx, fy;
+	uint32_t wx, wy;
+	int32_t fu, fv, du, dv, u, v;
+	int width, align, n, x, i, j, k;
+
+	for (k = 0; k < (int)(sizeof(src_image) / sizeof(pixel_t)); k++)
+		src_image[k] = random_pixel();
+
+	for (width = 0; width <= WIDTH_MAX; width++) {
+		for (align = 0; align < ALIGN_COUNT; align++) {
+			for (n = 0; n < ROUNDS; n++) {
+				/* Lines that start and end outside of the source. */
+				fill_rows(false);
+				fu = (int32_t)(random_u32() % ((SRC_WIDTH + 4) << 16)) - (2 << 16);
+				fv = (int32_t)(random_u32() % ((SRC_HEIGHT + 4) << 16)) - (2 << 16);
+				du = (int32_t)(random_u32() % 0x30000) - 0x18000;
+				dv = (int32_t)(random_u32() % 0x30000) - 0x18000;
+				row(out_buf + align, src_image, SRC_WIDTH + 1, width, fu, fv, du, dv, SRC_WIDTH - 1, SRC_HEIGHT - 1);
+				if (index > 0) {
+					level[0].affine_bilinear_row(ref_buf + align, src_image, SRC_WIDTH + 1, width, fu, fv, du, dv, SRC_WIDTH - 1, SRC_HEIGHT - 1);
+					if (!compare_rows("affine_bilinear", index, width, align))
+						return;
+					continue;
+				}
+				u = fu;
+				v = fv;
+				for (x = 0; x < width; x++) {
+					image_sample_pos(u, SRC_WIDTH - 1, &i, &wx);
+					image_sample_pos(v, SRC_HEIGHT - 1, &j, &wy);
+					u += du;
+					v += dv;
+					p = src_image + (SRC_WIDTH + 1) * j + i;
+					fx = wx / 256.0;
+					fy = wy / 256.0;
+					for (k = 0; k < 4; k++) {
+						r[k] = channel(p[0], k) * (1 - fx) * (1 - fy) +
+						       channel(p[1], k) * fx * (1 - fy) +
+						       channel(p[SRC_WIDTH + 1], k) * (1 - fx) * fy +
+						       channel(p[SRC_WIDTH + 2], k) * fx * fy;
+					}
+					if (!compare_ref("affine_bilinear", index, width, x, out_buf[align + x], r, TOLERANCE))
+						return;
+				}
+			}
+		}
+	}
+}
+
+/* Check an RGB expansion kernel. */
+static void check_expand(const char *name, int index, image_expand_func ref_row, image_expand_func row)
+{
+	int width, align, n, k;
+
+	for (width = 0; width <= WIDTH_MAX; width++) {
+		for (align = 0; align < ALIGN_COUNT; align++) {
+			for (n = 0; n < ROUNDS; n++) {
+				fill_rows(false);
+				for (k = 0; k < (int)sizeof(byte_buf); k++)
+					byte_buf[k] = (uint8_t)random_u32();
+				row(out_buf + align, byte_buf + align, width);
+				ref_row(ref_buf + align, byte_buf + align, width);
+				if (!compare_rows(name, index, width, align))
+					return;
+			}
+		}
+	}
+}
+
+/* Check a rule transition kernel. */
+static void check_rule(const char *name, int index, image_rule_func ref_row, image_rule_func row, bool is_pm)
+{
+	double r[4];
+	uint32_t pos, limit, gain, weight;
+	int width, align, n, x;
+
+	for (width = 0; width <= WIDTH_MAX; width++) {
+		for (align = 0; align < ALIGN_COUNT; align++) {
+			for (n = 0; n < ROUNDS; n++) {
+				/* The same parameters as image_draw_rule(). */
+				fill_rows(is_pm);
+				limit = random_u32() % 256 + 1;
+				pos = ((random_u32() % 256) * (255 + limit) + 127) / 255;
+				gain = (255 * 256 + limit - 1) / limit;
+				row(out_buf + align, src_buf + align, rule_buf + align, width, pos, limit, gain);
+				if (index > 0) {
+					ref_row(ref_buf + align, src_buf + align, rule_buf + align, width, pos, limit, gain);
+					if (!compare_rows(name, index, width, align))
+						return;
+					continue;
+				}
+
+				/* Blend by the weight of the rule value. */
+				for (x = 0; x < width; x++) {
+					weight = image_rule_weight(rule_buf[align + x] & 0xff, pos, limit, gain);
+					if (is_pm)
+						ref_alpha_pm(dst_buf[align + x], src_buf[align + x], weight, r);
+					else
+						ref_alpha(dst_buf[align + x], src_buf[align + x], weight, r);
+					if (!compare_ref(name, index, width, x, out_buf[align + x], r, TOLERANCE))
+						return;
+				}
+			}
+		}
+	}
+}
+
+/* Check a Porter-Duff composition kernel for all operators. */
+static void check_composite(const char *name, int index, image_composite_func ref_row, image_composite_func row, bool is_pm)
+{
+	const struct image_pd *pd;
+	double r[4];
+	uint32_t alpha;
+	int width, align, n, op, x;
+
+	for (op = 0; op < (int)(sizeof(pd_table) / sizeof(pd_table[0])); op++) {
+		pd = &pd_table[op];
+		for (width = 0; width <= WIDTH_MAX; width++) {
+			for (align = 0; align < ALIGN_COUNT; align++) {
+				for (n = 0; n < ROUNDS; n++) {
+					/* The destination is always premultiplied. */
+					fill_rows(is_pm);
+					for (x = 0; x < BUF_SIZE; x++)
+						dst_buf[x] = ref_buf[x] = out_buf[x] = image_premultiply_pixel(dst_buf[x]);
+					alpha = random_alpha();
+					row(out_buf + align, src_buf + align, width, alpha, pd);
+					if (index > 0) {
+						ref_row(ref_buf + align, src_buf + align, width, alpha, pd);
+						if (!compare_rows(name, index, width, align))
+							return;
+						continue;
+					}
+					for (x = 0; x < width; x++) {
+						ref_composite(dst_buf[align + x], src_buf[align + x], alpha, pd, is_pm, r);
+						if (!compare_ref(name, index, width, x, out_buf[align + x], r, COMPOSITE_TOLERANCE))
+							return;
+					}
+				}
+			}
+		}
+	}
+}
+
+/* Compare the output row with the C kernel output, including the guard pixels. */
+static bool compare_rows(const char *name, int index, int width, int align)
+{
+	int x;
+
+	for (x = 0; x < BUF_SIZE; x++) {
+		if (out_buf[x] != ref_buf[x]) {
+			printf("%s %s: width %d, align %d, x %d: 0x%08x, expected 0x%08x\n",
+			       level[index].name, name, width, align, x - align,
+			       (unsigned int)out_buf[x], (unsigned int)ref_buf[x]);
+			fail_count++;
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Compare an output pixel with a float reference. */
+static bool compare_ref(const char *name, int index, int width, int x, pixel_t out, const double *r, int tolerance)
+{
+	double e;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		e = fabs((double)channel(out, i) - floor(r[i] + 0.5));
+		if (e > tolerance) {
+			printf("%s %s: width %d, x %d: 0x%08x, expected (%.2f, %.2f, %.2f, %.2f)\n",
+			       level[index].name, name, width, x, (unsigned int)out,
+			       r[3], r[2], r[1], r[0]);
+			fail_count++;
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Reference of image_alpha_pixel(). */
+static void ref_alpha(pixel_t d, pixel_t s, uint32_t alpha, double *r)
+{
+	double a;
+	int i;
+
+	a = alpha / 255.0 * (channel(s, 3) / 255.0);
+	for (i = 0; i < 3; i++)
+		r[i] = channel(s, i) * a + channel(d, i) * (1 - a);
+	r[3] = 255;
+}
+
+/* Reference of image_add_pixel(). */
+static void ref_add(pixel_t d, pixel_t s, uint32_t alpha, double *r)
+{
+	double a;
+	int i;
+
+	a = alpha / 255.0 * (channel(s, 3) / 255.0);
+	for (i = 0; i < 3; i++)
+		r[i] = fmin(channel(d, i) + channel(s, i) * a, 255);
+	r[3] = 255;
+}
+
+/* Reference of image_sub_pixel(). */
+static void ref_sub(pixel_t d, pixel_t s, uint32_t alpha, double *r)
+{
+	double a;
+	int i;
+
+	a = alpha / 255.0 * (channel(s, 3) / 255.0);
+	for (i = 0; i < 3; i++)
+		r[i] = fmax(channel(d, i) - channel(s, i) * a, 0);
+	r[3] = 255;
+}
+
+/* Reference of image_alpha_pm_pixel(). */
+static void ref_alpha_pm(pixel_t d, pixel_t s, uint32_t alpha, double *r)
+{
+	double a, na;
+	int i;
+
+	a = alpha / 255.0;
+	na = 1 - channel(s, 3) * a / 255.0;
+	for (i = 0; i < 3; i++)
+		r[i] = fmin(channel(s, i) * a + channel(d, i) * na, 255);
+	r[3] = 255;
+}
+
+/* Reference of image_alpha_pm_opaque_pixel(). (alpha is ignored as by the kernel) */
+static void ref_alpha_pm_opaque(pixel_t d, pixel_t s, uint32_t alpha, double *r)
+{
+	UNUSED_PARAMETER(alpha);
+
+	ref_alpha_pm(d, s, 255, r);
+}
+
+/* Reference of image_add_pm_pixel(). */
+static void ref_add_pm(pixel_t d, pixel_t s, uint32_t alpha, double *r)
+{
+	double a;
+	int i;
+
+	a = alpha / 255.0;
+	for (i = 0; i < 3; i++)
+		r[i] = fmin(channel(d, i) + channel(s, i) * a, 255);
+	r[3] = 255;
+}
+
+/* Reference of image_sub_pm_pixel(). */
+static void ref_sub_pm(pixel_t d, pixel_t s, uint32_t alpha, double *r)
+{
+	double a;
+	int i;
+
+	a = alpha / 255.0;
+	for (i = 0; i < 3; i++)
+		r[i] = fmax(channel(d, i) - channel(s, i) * a, 0);
+	r[3] = 255;
+}
+
+/* Reference of a composition. (R = S * Fs + D * Fd) */
+static void ref_composite(pixel_t d, pixel_t s, uint32_t alpha, const struct image_pd *pd, bool is_pm, double *r)
+{
+	double sc[4], fs, fd;
+	int i;
+
+	/* Premultiply the source, scaled by alpha. */
+	for (i = 0; i < 4; i++)
+		sc[i] = channel(s, i) * (alpha / 255.0);
+	if (!is_pm) {
+		for (i = 0; i < 3; i++)
+			sc[i] *= channel(s, 3) / 255.0;
+	}
+
+	fs = (pd->src_base + pd->src_scale * (double)channel(d, 3)) / 255.0;
+	fd = (pd->dst_base + pd->dst_scale * sc[3]) / 255.0;
+	for (i = 0; i < 4; i++)
+		r[i] = fmin(sc[i] * fs + channel(d, i) * fd, 255);
+}
+
+/* Fill the row buffers with random pixels, with runs of opaque and clear source pixels. */
+static void fill_rows(bool is_pm)
+{
+	uint32_t run;
+	int x;
+
+	run = 0;
+	for (x = 0; x < BUF_SIZE; x++) {
+		if (x % 8 == 0)
+			run = random_u32() >> 30;
+		src_buf[x] = random_pixel();
+		if (run == 1)
+			src_buf[x] |= 0xff000000;
+		else if (run == 2)
+			src_buf[x] &= 0x00ffffff;
+		if (is_pm)
+			src_buf[x] = image_premultiply_pixel(src_buf[x]);
+		rule_buf[x] = random_pixel();
+		dst_buf[x] = ref_buf[x] = out_buf[x] = random_pixel();
+	}
+}
+
+/* Get a random pixel, with more of the alphas at the ends. */
+static pixel_t random_pixel(void)
+{
+	pixel_t p;
+
+	p = random_u32();
+	switch (p >> 29) {
+	case 0:
+		return p & 0x00ffffff;
+	case 1:
+		return p | 0xff000000;
+	default:
+		return p;
+	}
+}
+
+/* Get a random alpha, with more of the ends. */
+static uint32_t random_alpha(void)
+{
+	uint32_t a;
+
+	a = random_u32();
+	switch (a >> 30) {
+	case 0:
+		return 0;
+	case 1:
+		return 255;
+	default:
+		return a & 0xff;
+	}
+}
+
+/* Get a random number. (xorshift32) */
+static uint32_t random_u32(void)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+/* Get a channel at the shift 8 * i. */
+static uint32_t channel(pixel_t p, int i)
+{
+	return (p >> (8 * i)) & 0xff;
+}
+
+/* Print the time to run each kernel over a frame. */
+static void bench(void)
+{
+	pixel_t *dst, *src;
+	uint8_t *bytes;
+	double ms;
+	size_t k;
+	int i, j;
+
+	dst = malloc(sizeof(pixel_t) * FRAME_WIDTH * FRAME_HEIGHT);
+	src = malloc(sizeof(pixel_t) * (FRAME_WIDTH + 1) * (FRAME_HEIGHT + 1));
+	bytes = malloc((size_t)FRAME_WIDTH * FRAME_HEIGHT * 3);
+	if (dst == NULL || src == NULL || bytes == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	for (k = 0; k < (size_t)FRAME_WIDTH * FRAME_HEIGHT; k++)
+		dst[k] = random_pixel() | 0xff000000;
+	for (k = 0; k < (size_t)(FRAME_WIDTH + 1) * (FRAME_HEIGHT + 1); k++)
+		src[k] = image_premultiply_pixel(random_pixel());
+	for (k = 0; k < (size_t)FRAME_WIDTH * FRAME_HEIGHT * 3; k++)
+		bytes[k] = (uint8_t)random_u32();
+
+	printf("\nms per %dx%d frame, best of %d:\n", FRAME_WIDTH, FRAME_HEIGHT, BENCH_RUNS);
+	printf("%-16s", "");
+	for (i = 0; i < level_count; i++)
+		printf("%8s", level[i].name);
+	printf("\n");
+	for (j = 0; j < KERNEL_COUNT; j++) {
+		printf("%-16s", kernel_name[j]);
+		for (i = 0; i < level_count; i++) {
+			ms = bench_kernel(i, j, dst, src, bytes);
+			if (ms < 0)
+				printf("%8s", "-");
+			else
+				printf("%8.2f", ms);
+		}
+		printf("\n");
+	}
+
+	free(dst);
+	free(src);
+	free(bytes);
+}
+
+/* Run a kernel over a frame and get the best time in ms. (-1 if the level has no such kernel) */
+static double bench_kernel(int index, int k, pixel_t *dst, const pixel_t *src, const uint8_t *bytes)
+{
+	const struct level *lv;
+	const pixel_t *s;
+	pixel_t *d;
+	double start, t, best;
+	int run, y;
+
+	lv = &level[index];
+	best = -1;
+	for (run = 0; run < BENCH_RUNS; run++) {
+		start = now();
+		for (y = 0; y < FRAME_HEIGHT; y++) {
+			d = dst + FRAME_WIDTH * y;
+			s = src + (FRAME_WIDTH + 1) * y;
+			switch (k) {
+			case KERNEL_ALPHA:
+				if (lv->alpha_row == NULL)
+					return -1;
+				lv->alpha_row(d, s, FRAME_WIDTH, 192);
+				break;
+			case KERNEL_ADD:
+				if (lv->add_row == NULL)
+					return -1;
+				lv->add_row(d, s, FRAME_WIDTH, 192);
+				break;
+			case KERNEL_SUB:
+				if (lv->sub_row == NULL)
+					return -1;
+				lv->sub_row(d, s, FRAME_WIDTH, 192);
+				break;
+			case KERNEL_ALPHA_PM:
+				if (lv->alpha_pm_row == NULL)
+					return -1;
+				lv->alpha_pm_row(d, s, FRAME_WIDTH, 192);
+				break;
+			case KERNEL_ALPHA_PM_OPAQUE:
+				if (lv->alpha_pm_opaque_row == NULL)
+					return -1;
+				lv->alpha_pm_opaque_row(d, s, FRAME_WIDTH, 255);
+				break;
+			case KERNEL_ADD_PM:
+				if (lv->add_pm_row == NULL)
+					return -1;
+				lv->add_pm_row(d, s, FRAME_WIDTH, 192);
+				break;
+			case KERNEL_SUB_PM:
+				if (lv->sub_pm_row == NULL)
+					return -1;
+				lv->sub_pm_row(d, s, FRAME_WIDTH, 192);
+				break;
+			case KERNEL_LERP:
+				if (lv->lerp_row == NULL)
+					return -1;
+				lv->lerp_row(d, s, s + FRAME_WIDTH + 1, FRAME_WIDTH, 96);
+				break;
+			case KERNEL_BILINEAR:
+				/* Upscale 1280 pixels. */
+				if (lv->bilinear_row == NULL)
+					return -1;
+				lv->bilinear_row(d, s, FRAME_WIDTH, 0, 0x10000 * 2 / 3, 1279);
+				break;
+			case KERNEL_AFFINE_BILINEAR:
+				/* Rotate by about 10 degrees. */
+				if (lv->affine_bilinear_row == NULL)
+					return -1;
+				lv->affine_bilinear_row(d, src, FRAME_WIDTH + 1, FRAME_WIDTH,
+							(y * 11380), (y * 64540), 64540, -11380,
+							FRAME_WIDTH - 1, FRAME_HEIGHT - 1);
+				break;
+			case KERNEL_EXPAND_RGB:
+				if (lv->expand_rgb_row == NULL)
+					return -1;
+				lv->expand_rgb_row(d, bytes + (size_t)FRAME_WIDTH * 3 * y, FRAME_WIDTH);
+				break;
+			case KERNEL_EXPAND_BGR:
+				if (lv->expand_bgr_row == NULL)
+					return -1;
+				lv->expand_bgr_row(d, bytes + (size_t)FRAME_WIDTH * 3 * y, FRAME_WIDTH);
+				break;
+			case KERNEL_RULE:
+				if (lv->rule_row == NULL)
+					return -1;
+				lv->rule_row(d, s, s + FRAME_WIDTH + 1, FRAME_WIDTH, 192, 64, 1020);
+				break;
+			case KERNEL_RULE_PM:
+				if (lv->rule_pm_row == NULL)
+					return -1;
+				lv->rule_pm_row(d, s, s + FRAME_WIDTH + 1, FRAME_WIDTH, 192, 64, 1020);
+				break;
+			case KERNEL_COMPOSITE:
+				/* Source over. */
+				if (lv->composite_row == NULL)
+					return -1;
+				lv->composite_row(d, s, FRAME_WIDTH, 192, &pd_table[3]);
+				break;
+			case KERNEL_COMPOSITE_PM:
+				if (lv->composite_pm_row == NULL)
+					return -1;
+				lv->composite_pm_row(d, s, FRAME_WIDTH, 192, &pd_table[3]);
+				break;
+			default:
+				assert(0);
+				break;
+			}
+		}
+		t = now() - start;
+		if (best < 0 || t < best)
+			best = t;
+	}
+	return best;
+}
+
+/* Get the monotonic time in ms. */
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1000000.0;
+}
+
+/*
+ * The logging functions that the image module calls.
+ */
+
+void sys_log(const char *s, ...)
+{
+	va_list ap;
+
+	va_start(ap, s);
+	vprintf(s, ap);
+	va_end(ap);
+}
+
+void sys_error(const char *s, ...)
+{
+	va_list ap;
+
+	va_start(ap, s);
+	vfprintf(stderr, s, ap);
+	va_end(ap);
+}
+
+void sys_out_of_memory(void)
+{
+	fprintf(stderr, "Out of memory.\n");
+}
@@ -0,0 +1,493 @@
+/* -*- coding: utf-8; tab-width: 8; indent-tabs-mode: t; -*- */
+
+/*
+ * MediaKit
+ * Copyright (c) 2025, Tamako Mori. All rights reserved.
+ */
+
+/*
+ * mkrostor.c: The read-only storage builder.
+ *
+ * Usage: mkrostor <input.txt> <output.dat>
+ *
+ * Each line of the input is one of:
+ *     key=string         (\n, \t and \\ are unescaped)
+ *     key:int=123
+ *     key:float=1.5
+ *     key:bool=true
+ *     key:blob=file      (The content of a file.)
+ * Empty lines and lines starting with '#' are ignored.
+ */
+
+#include "mediakit/mediakit.h"
+#include "rostor.h"
+
+/* Keys per bucket on average. */
+#define BUCKET_LOAD	(4)
+
+/* Give up the displacement search after this. */
+#define DISP_MAX	(100000000)
+
+/* An item. */
+struct item {
+	char *key;
+	uint32_t key_offset;
+	int type;
+	uint32_t value;		/* Pool offset, or an int/float/bool. */
+	uint8_t *data;		/* For a string or a blob. */
+	uint32_t size;
+	uint32_t bucket;
+	uint32_t slot;
+};
+
+/* Items. */
+static struct item *item;
+static uint32_t item_count;
+
+/* Buckets. (Item indices in the order of buckets.) */
+static uint32_t bucket_count;
+static uint32_t *bucket_item;
+static uint32_t *bucket_start;
+static uint32_t *bucket_order;
+static uint32_t *disp;
+
+/* Slot to item. (UINT32_MAX if free.) */
+static uint32_t *slot_item;
+
+/* Pool. */
+static uint8_t *pool;
+static uint32_t pool_size;
+
+/* Forward declaration. */
+static bool read_input(const char *file);
+static bool parse_line(char *line, int lineno);
+static bool read_blob(const char *file, uint8_t **data, uint32_t *size);
+static char *read_line(FILE *fp);
+static bool build_hash(void);
+static bool build_pool(void);
+static bool write_output(const char *file);
+static bool write_u32(FILE *fp, uint32_t data);
+static int cmp_item(const void *a, const void *b);
+static int cmp_bucket(const void *a, const void *b);
+static void *xmalloc(size_t size);
+
+int main(int argc, char *argv[])
+{
+	if (argc != 3) {
+		fprintf(stderr, "Usage: mkrostor <input.txt> <output.dat>\n");
+		return 1;
+	}
+
+	if (!read_input(argv[1]))
+		return 1;
+	if (!build_hash())
+		return 1;
+	if (!build_pool())
+		return 1;
+	if (!write_output(argv[2]))
+		return 1;
+
+	printf("%u items, %u buckets, %u bytes of pool.\n",
+	       item_count, bucket_count, pool_size);
+	return 0;
+}
+
+/* Read an input file and sort items by key. */
+static bool read_input(const char *file)
+{
+	FILE *fp;
+	char *line;
+	uint32_t i;
+	int lineno;
+
+	fp = fopen(file, "rb");
+	if (fp == NULL) {
+		fprintf(stderr, "Cannot open \"%s\".\n", file);
+		return false;
+	}
+
+	lineno = 0;
+	while ((line = read_line(fp)) != NULL) {
+		lineno++;
+		if (line[0] != '\0' && line[0] != '#') {
+			if (!parse_line(line, lineno)) {
+				free(line);
+				fclose(fp);
+				return false;
+			}
+		}
+		free(line);
+	}
+	fclose(fp);
+
+	/* Sort by key and reject duplicates. */
+	qsort(item, item_count, sizeof(struct item), cmp_item);
+	for (i = 1; i < item_count; i++) {
+		if (strcmp(item[i - 1].key, item[i].key) == 0) {
+			fprintf(stderr, "Duplicated key \"%s\".\n", item[i].key);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* Parse an input line. */
+static bool parse_line(char *line, int lineno)
+{
+	struct item *it;
+	char *eq, *colon, *src, *dst;
+	int32_t i;
+	float f;
+
+	eq = strchr(line, '=');
+	if (eq == NULL) {
+		fprintf(stderr, "%d: No '='.\n", lineno);
+		return false;
+	}
+	*eq = '\0';
+	colon = strchr(line, ':');
+	if (colon != NULL)
+		*colon = '\0';
+	if (line[0] == '\0') {
+		fprintf(stderr, "%d: Empty key.\n", lineno);
+		return false;
+	}
+
+	/* Add an item. */
+	item = realloc(item, sizeof(struct item) * (item_count + 1));
+	if (item == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		return false;
+	}
+	it = &item[item_count++];
+	memset(it, 0, sizeof(struct item));
+	it->key = strdup(line);
+	if (it->key == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		return false;
+	}
+
+	/* Parse a value. */
+	src = eq + 1;
+	if (colon == NULL) {
+		/* Unescape a string. */
+		it->type = STOR_TYPE_STRING;
+		it->data = xmalloc(strlen(src) + 1);
+		dst = (char *)it->data;
+		while (*src != '\0') {
+			if (*src == '\\' && *(src + 1) != '\0') {
+				src++;
+				if (*src == 'n')
+					*dst++ = '\n';
+				else if (*src == 't')
+					*dst++ = '\t';
+				else
+					*dst++ = *src;
+				src++;
+				continue;
+			}
+			*dst++ = *src++;
+		}
+		*dst++ = '\0';
+		it->size = (uint32_t)(dst - (char *)it->data);
+	} else if (strcmp(colon + 1, "int") == 0) {
+		it->type = STOR_TYPE_INT;
+		i = (int32_t)strtol(src, NULL, 0);
+		it->value = (uint32_t)i;
+	} else if (strcmp(colon + 1, "float") == 0) {
+		it->type = STOR_TYPE_FLOAT;
+		f = strtof(src, NULL);
+		memcpy(&it->value, &f, sizeof(float));
+	} else if (strcmp(colon + 1, "bool") == 0) {
+		it->type = STOR_TYPE_BOOL;
+		it->value = (strcmp(src, "true") == 0 || strcmp(src, "1") == 0) ? 1 : 0;
+	} else if (strcmp(colon + 1, "blob") == 0) {
+		it->type = STOR_TYPE_BLOB;
+		if (!read_blob(src, &it->data, &it->size))
+			return false;
+	} else {
+		fprintf(stderr, "%d: Unknown type \"%s\".\n", lineno, colon + 1);
+		return false;
+	}
+
+	return true;
+}
+
+/* Read a blob file. */
+static bool read_blob(const char *file, uint8_t **data, uint32_t *size)
+{
+	FILE *fp;
+	long len;
+
+	fp = fopen(file, "rb");
+	if (fp == NULL) {
+		fprintf(stderr, "Cannot open \"%s\".\n", file);
+		return false;
+	}
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	rewind(fp);
+
+	*data = xmalloc((size_t)len + 1);
+	if (len > 0 && fread(*data, (size_t)len, 1, fp) != 1) {
+		fprintf(stderr, "Cannot read \"%s\".\n", file);
+		fclose(fp);
+		return false;
+	}
+	*size = (uint32_t)len;
+
+	fclose(fp);
+	return true;
+}
+
+/* Read a line of any length without the newline. */
+static char *read_line(FILE *fp)
+{
+	char *buf;
+	size_t len, size;
+	int c;
+
+	size = 256;
+	buf = xmalloc(size);
+	len = 0;
+	while ((c = fgetc(fp)) != EOF && c != '\n') {
+		if (len + 1 == size) {
+			size *= 2;
+			buf = realloc(buf, size);
+			if (buf == NULL) {
+				fprintf(stderr, "Out of memory.\n");
+				exit(1);
+			}
+		}
+		buf[len++] = (char)c;
+	}
+	if (c == EOF && len == 0) {
+		free(buf);
+		return NULL;
+	}
+	if (len > 0 && buf[len - 1] == '\r')
+		len--;
+	buf[len] = '\0';
+
+	return buf;
+}
+
+/* Build a minimal perfect hash by the "hash and displace" method. */
+static bool build_hash(void)
+{
+	uint32_t b, i, j, k, n, d, slot;
+	bool ok;
+
+	if (item_count == 0)
+		return true;
+
+	/* Distribute items to buckets. */
+	bucket_count = (item_count + BUCKET_LOAD - 1) / BUCKET_LOAD;
+	bucket_start = xmalloc(sizeof(uint32_t) * (bucket_count + 1));
+	bucket_item = xmalloc(sizeof(uint32_t) * item_count);
+	bucket_order = xmalloc(sizeof(uint32_t) * bucket_count);
+	disp = xmalloc(sizeof(uint32_t) * bucket_count);
+	slot_item = xmalloc(sizeof(uint32_t) * item_count);
+	memset(bucket_start, 0, sizeof(uint32_t) * (bucket_count + 1));
+	for (i = 0; i < item_count; i++) {
+		item[i].bucket = rostor_hash(item[i].key, 0) % bucket_count;
+		bucket_start[item[i].bucket + 1]++;
+	}
+	for (b = 0; b < bucket_count; b++)
+		bucket_start[b + 1] += bucket_start[b];
+	for (b = 0; b < bucket_count; b++)
+		bucket_order[b] = bucket_start[b];
+	for (i = 0; i < item_count; i++)
+		bucket_item[bucket_order[item[i].bucket]++] = i;
+	for (i = 0; i < item_count; i++)
+		slot_item[i] = UINT32_MAX;
+
+	/* Place larger buckets first while the table is empty. */
+	for (b = 0; b < bucket_count; b++)
+		bucket_order[b] = b;
+	qsort(bucket_order, bucket_count, sizeof(uint32_t), cmp_bucket);
+
+	for (k = 0; k < bucket_count; k++) {
+		b = bucket_order[k];
+		n = bucket_start[b + 1] - bucket_start[b];
+		disp[b] = 0;
+		if (n == 0)
+			continue;
+
+		/* Search a displacement that puts all keys on free slots. */
+		for (d = 1; d < DISP_MAX; d++) {
+			ok = true;
+			for (i = 0; i < n && ok; i++) {
+				slot = rostor_hash(item[bucket_item[bucket_start[b] + i]].key, d) % item_count;
+				if (slot_item[slot] != UINT32_MAX) {
+					ok = false;
+					break;
+				}
+				for (j = 0; j < i; j++) {
+					if (item[bucket_item[bucket_start[b] + j]].slot == slot) {
+						ok = false;
+						break;
+					}
+				}
+				item[bucket_item[bucket_start[b] + i]].slot = slot;
+			}
+			if (ok)
+				break;
+		}
+		if (d == DISP_MAX) {
+			fprintf(stderr, "Cannot build a perfect hash.\n");
+			return false;
+		}
+
+		/* Take the slots. */
+		disp[b] = d;
+		for (i = 0; i < n; i++) {
+			j = bucket_item[bucket_start[b] + i];
+			slot_item[item[j].slot] = j;
+		}
+	}
+
+	return true;
+}
+
+/* Pack keys and values into the pool. */
+static bool build_pool(void)
+{
+	size_t size, len;
+	uint32_t i;
+
+	size = 0;
+	for (i = 0; i < item_count; i++) {
+		size += strlen(item[i].key) + 1;
+		if (item[i].type == STOR_TYPE_STRING || item[i].type == STOR_TYPE_BLOB)
+			size += item[i].size;
+	}
+	if (size > UINT32_MAX) {
+		fprintf(stderr, "Too large.\n");
+		return false;
+	}
+
+	/* Keep the last byte a NUL. (A blob may be at the end.) */
+	if (item_count > 0)
+		size++;
+
+	pool = xmalloc(size);
+	memset(pool, 0, size);
+	pool_size = 0;
+	for (i = 0; i < item_count; i++) {
+		/* Key. */
+		len = strlen(item[i].key) + 1;
+		memcpy(pool + pool_size, item[i].key, len);
+		item[i].key_offset = pool_size;
+		pool_size += (uint32_t)len;
+
+		/* Value. */
+		if (item[i].type == STOR_TYPE_STRING || item[i].type == STOR_TYPE_BLOB) {
+			if (item[i].size > 0)
+				memcpy(pool + pool_size, item[i].data, item[i].size);
+			item[i].value = pool_size;
+			pool_size += item[i].size;
+		}
+	}
+	pool_size = (uint32_t)size;
+
+	return true;
+}
+
+/* Write an output file. */
+static bool write_output(const char *file)
+{
+	FILE *fp;
+	struct item *it;
+	uint32_t i;
+	bool ok;
+
+	fp = fopen(file, "wb");
+	if (fp == NULL) {
+		fprintf(stderr, "Cannot open \"%s\".\n", file);
+		return false;
+	}
+
+	/* Header. */
+	ok = fwrite(ROSTOR_MAGIC, 4, 1, fp) == 1;
+	ok = ok && write_u32(fp, item_count);
+	ok = ok && write_u32(fp, bucket_count);
+	ok = ok && write_u32(fp, pool_size);
+
+	/* Displacements. */
+	for (i = 0; i < bucket_count && ok; i++)
+		ok = write_u32(fp, disp[i]);
+
+	/* Slots. */
+	for (i = 0; i < item_count && ok; i++) {
+		it = &item[slot_item[i]];
+		ok = write_u32(fp, it->key_offset) &&
+		     write_u32(fp, it->value) &&
+		     write_u32(fp, it->size) &&
+		     write_u32(fp, (uint32_t)it->type);
+	}
+
+	/* Key order. (The items are sorted.) */
+	for (i = 0; i < item_count && ok; i++)
+		ok = write_u32(fp, item[i].slot);
+
+	/* Pool. */
+	if (ok && pool_size > 0)
+		ok = fwrite(pool, pool_size, 1, fp) == 1;
+
+	if (fclose(fp) != 0)
+		ok = false;
+	if (!ok) {
+		fprintf(stderr, "Cannot write \"%s\".\n", file);
+		return false;
+	}
+
+	return true;
+}
+
+/* Write a little-endian u32. */
+static bool write_u32(FILE *fp, uint32_t data)
+{
+	uint8_t b[4];
+
+	b[0] = (uint8_t)(data & 0xff);
+	b[1] = (uint8_t)((data >> 8) & 0xff);
+	b[2] = (uint8_t)((data >> 16) & 0xff);
+	b[3] = (uint8_t)((data >> 24) & 0xff);
+
+	return fwrite(b, sizeof(b), 1, fp) == 1;
+}
+
+/* Compare items by key. */
+static int cmp_item(const void *a, const void *b)
+{
+	return strcmp(((const struct item *)a)->key, ((const struct item *)b)->key);
+}
+
+/* Compare buckets by size, descending. */
+static int cmp_bucket(const void *a, const void *b)
+{
+	uint32_t ba, bb, na, nb;
+
+	ba = *(const uint32_t *)a;
+	bb = *(const uint32_t *)b;
+	na = bucket_start[ba + 1] - bucket_start[ba];
+	nb = bucket_start[bb + 1] - bucket_start[bb];
+	if (na != nb)
+		return na < nb ? 1 : -1;
+	return ba < bb ? -1 : (ba > bb ? 1 : 0);
+}
+
+/* Allocate a memory or exit. */
+static void *xmalloc(size_t size)
+{
+	void *p;
+
+	p = malloc(size > 0 ? size : 1);
+	if (p == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	return p;
+}